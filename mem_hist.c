@@ -0,0 +1,133 @@
+/*
+ * Log-linear latency histogram (HDR-style) and a cheap tick counter.
+ */
+
+#define _POSIX_C_SOURCE 200809L // for clock_gettime()
+
+#include <string.h>
+#include <time.h>
+
+#include "mem_hist.h"
+
+
+
+/*********************/
+/*                   */
+/* Static functions  */
+/*                   */
+/*********************/
+static unsigned _mem_hist_bucket(unsigned long long value) {
+    // small values get a bucket each
+    if (value < MEM_HIST_SUB_COUNT)
+        return (unsigned) value;
+
+    // larger ones keep their top MEM_HIST_SUB_BITS bits
+    unsigned msb = 63 - (unsigned) __builtin_clzll(value);
+    unsigned shift = msb - (MEM_HIST_SUB_BITS - 1);
+    unsigned top = (unsigned) (value >> shift); // in [SUB_COUNT/2, SUB_COUNT)
+
+    return MEM_HIST_SUB_COUNT
+           + (shift - 1) * (MEM_HIST_SUB_COUNT / 2)
+           + (top - MEM_HIST_SUB_COUNT / 2);
+}
+
+// highest value which falls into the bucket
+static unsigned long long _mem_hist_bucket_value(unsigned bucket) {
+    if (bucket < MEM_HIST_SUB_COUNT)
+        return bucket;
+
+    unsigned shift = (bucket - MEM_HIST_SUB_COUNT) / (MEM_HIST_SUB_COUNT / 2) + 1;
+    unsigned long long top = (bucket - MEM_HIST_SUB_COUNT) % (MEM_HIST_SUB_COUNT / 2)
+                             + MEM_HIST_SUB_COUNT / 2;
+
+    return (top << shift) + ((1ull << shift) - 1);
+}
+
+
+
+/****************************************/
+/*                                      */
+/* Definitions of user-facing functions */
+/*                                      */
+/****************************************/
+void mem_hist_reset(mem_hist_pt hist) {
+    memset(hist, 0, sizeof(mem_hist_t));
+}
+
+void mem_hist_record(mem_hist_pt hist, unsigned long long value) {
+    hist->buckets[_mem_hist_bucket(value)] += 1;
+    hist->count += 1;
+    hist->sum += value;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+void mem_hist_merge(mem_hist_pt into, const mem_hist_t *from) {
+    for (unsigned b = 0; b < MEM_HIST_BUCKETS; ++b)
+        into->buckets[b] += from->buckets[b];
+    into->count += from->count;
+    into->sum += from->sum;
+    if (from->max > into->max)
+        into->max = from->max;
+}
+
+unsigned long long mem_hist_percentile(const mem_hist_t *hist, double p) {
+    if (hist->count == 0)
+        return 0;
+
+    // rank of the value we are after, 1-based
+    unsigned long long rank = (unsigned long long) (p * (double) hist->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    unsigned long long seen = 0;
+    for (unsigned b = 0; b < MEM_HIST_BUCKETS; ++b) {
+        seen += hist->buckets[b];
+        if (seen >= rank) {
+            // the bucket's upper bound, but never past the true max
+            unsigned long long value = _mem_hist_bucket_value(b);
+            return (value < hist->max) ? value : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+void mem_hist_print(const mem_hist_t *hist, FILE *out, const char *name, double scale) {
+    double mean = (hist->count > 0) ? (double) hist->sum / (double) hist->count : 0.0;
+
+    fprintf(out, "%-16s count=%llu mean=%.1f p50=%.1f p99=%.1f p999=%.1f max=%.1f\n",
+            name,
+            hist->count,
+            mean * scale,
+            (double) mem_hist_percentile(hist, 0.50) * scale,
+            (double) mem_hist_percentile(hist, 0.99) * scale,
+            (double) mem_hist_percentile(hist, 0.999) * scale,
+            (double) hist->max * scale);
+}
+
+unsigned long long mem_hist_clock_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ull + (unsigned long long) ts.tv_nsec;
+}
+
+double mem_hist_ns_per_tick() {
+    static double ns_per_tick = 0.0;
+
+    if (ns_per_tick == 0.0) {
+        // spin for ~10ms against the monotonic clock
+        unsigned long long ns0 = mem_hist_clock_ns();
+        unsigned long long ticks0 = mem_hist_ticks();
+        unsigned long long ns1;
+        do {
+            ns1 = mem_hist_clock_ns();
+        } while (ns1 - ns0 < 10000000ull);
+        unsigned long long ticks1 = mem_hist_ticks();
+
+        ns_per_tick = (ticks1 > ticks0) ? (double) (ns1 - ns0) / (double) (ticks1 - ticks0) : 1.0;
+    }
+
+    return ns_per_tick;
+}
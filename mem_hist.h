@@ -0,0 +1,79 @@
+/*
+ * Log-linear latency histogram (HDR-style) and a cheap tick counter.
+ */
+
+#ifndef DENVER_OS_PA_C_MEM_HIST_H
+#define DENVER_OS_PA_C_MEM_HIST_H
+
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* constants */
+
+// 2^MEM_HIST_SUB_BITS linear buckets, then 2^(MEM_HIST_SUB_BITS-1) buckets per
+// power of two, so a recorded value is off by at most ~3%
+#define MEM_HIST_SUB_BITS   5
+#define MEM_HIST_SUB_COUNT  (1u << MEM_HIST_SUB_BITS)
+#define MEM_HIST_BUCKETS    (MEM_HIST_SUB_COUNT + (64 - MEM_HIST_SUB_BITS) * (MEM_HIST_SUB_COUNT / 2))
+
+/* type declarations */
+
+typedef struct _mem_hist {
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long max;
+    unsigned long long buckets[MEM_HIST_BUCKETS];
+} mem_hist_t, *mem_hist_pt;
+
+/* function declarations */
+
+void
+mem_hist_reset(mem_hist_pt hist);
+
+void
+mem_hist_record(mem_hist_pt hist, unsigned long long value);
+
+void
+mem_hist_merge(mem_hist_pt into, const mem_hist_t *from);
+
+// value at or below which the fraction p (0..1) of the recorded values lie
+unsigned long long
+mem_hist_percentile(const mem_hist_t *hist, double p);
+
+// one line: count, mean, p50, p99, p999, max, with values scaled by 'scale'
+void
+mem_hist_print(const mem_hist_t *hist, FILE *out, const char *name, double scale);
+
+unsigned long long
+mem_hist_clock_ns();
+
+// nanoseconds per tick of mem_hist_ticks(), calibrated once on first call
+double
+mem_hist_ns_per_tick();
+
+// cheapest available monotonic counter (TSC on x86, virtual counter on arm64)
+static inline unsigned long long
+mem_hist_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    unsigned long long ticks;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (ticks));
+    return ticks;
+#else
+    return mem_hist_clock_ns();
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //DENVER_OS_PA_C_MEM_HIST_H
@@ -2,9 +2,30 @@
  * Created by Ivo Georgiev on 2/9/16.
  */
 
+#define _POSIX_C_SOURCE 200809L // for read()/write()
+#define _DEFAULT_SOURCE // for MAP_ANONYMOUS
+
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h> // for perror()
+#include <stdint.h> // for uintptr_t
+#include <string.h> // for memset()
+#include <stdatomic.h> // for the trace ring
+#include <errno.h>
+#include <unistd.h> // for the snapshots
+#if defined(MEM_POOL_PROFILE) || defined(MEM_POOL_GUARD)
+#include <execinfo.h> // for backtrace()
+#endif
+#ifdef MEM_POOL_PROFILE
+#include <math.h> // for the sampling intervals
+#endif
+#ifdef MEM_POOL_GUARD
+#include <signal.h> // for the fault handler
+#include <sys/mman.h> // for the guard pages
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h> // for the bitmap scans
+#endif
 
 #include "mem_pool.h"
 
@@ -13,20 +34,33 @@
 /* Constants */
 /*           */
 /*************/
-static const float      MEM_FILL_FACTOR                 = 0.75;
-static const unsigned   MEM_EXPAND_FACTOR               = 2;
-
 static const unsigned   MEM_POOL_STORE_INIT_CAPACITY    = 20;
 static const float      MEM_POOL_STORE_FILL_FACTOR      = 0.75;
 static const unsigned   MEM_POOL_STORE_EXPAND_FACTOR    = 2;
+static const float      MEM_POOL_STORE_SHRINK_FACTOR    = 0.25;
 
 static const unsigned   MEM_NODE_HEAP_INIT_CAPACITY     = 40;
 static const float      MEM_NODE_HEAP_FILL_FACTOR       = 0.75;
 static const unsigned   MEM_NODE_HEAP_EXPAND_FACTOR     = 2;
+static const float      MEM_NODE_HEAP_SHRINK_FACTOR     = 0.25;
 
 static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
 static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
+static const float      MEM_GAP_IX_SHRINK_FACTOR        = 0.25;
+
+// small-object size classes, all multiples of 16, up to MEM_POOL_SMALL_MAX
+#define MEM_SMALL_NUM_CLASSES 16
+static const size_t     MEM_SMALL_CLASS_SIZES[MEM_SMALL_NUM_CLASSES] = {
+        16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+static const unsigned   MEM_SMALL_INIT_CAPACITY         = 16;
+static const unsigned   MEM_SMALL_EXPAND_FACTOR         = 2;
+
+// slab metadata is allocated at its own size as alignment, so a handle finds its slab by masking
+#define MEM_SLAB_META_SIZE 1024
+#define MEM_SLAB_OBJECTS ((MEM_SLAB_META_SIZE - offsetof(slab_t, records)) / sizeof(alloc_t))
 
 
 
@@ -35,27 +69,251 @@ static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 /* Type declarations */
 /*                   */
 /*********************/
-typedef struct _node {
-    alloc_t alloc_record;
-    unsigned used;
-    unsigned allocated;
-    struct _node *next, *prev; // doubly-linked list for gap deletion
-} node_t, *node_pt;
-
-typedef struct _gap {
-    size_t size;
-    node_pt node;
-} gap_t, *gap_pt;
+// node flags; the rest of the byte is spare
+#define MEM_NODE_USED       0x01
+#define MEM_NODE_ALLOCATED  0x02
+#define MEM_NODE_PINNED     0x04    // never moved by compaction
+#define MEM_NODE_TAG_SHIFT  3       // the allocation's tag is in the bits above the flags
+
+#define MEM_NODE_TAG(flags) ((unsigned) (flags) >> MEM_NODE_TAG_SHIFT)
+
+#define MEM_NODE_NONE 0xFFFFFFFFu   // end of a list
+
+#define MEM_BITMAP_NONE SIZE_MAX    // no free run long enough
+
+#define MEM_SNAPSHOT_MAGIC      0x4E53504Du // "MPSN"
+#define MEM_SNAPSHOT_VERSION    1
+#define MEM_SNAPSHOT_DATA       0x1         // the pool contents follow the metadata
+#define MEM_SNAPSHOT_CHUNK      256         // records converted per write/read
+
+_Static_assert(MEM_POOL_TAGS <= 1 << (8 - MEM_NODE_TAG_SHIFT), "the tags must fit the spare node flag bits");
+
+typedef struct _slab {
+    uint64_t free_mask;         // bit i set-records[i] is free
+    struct _slab *next, *prev;  // the class's slabs with free objects
+    char *mem;                  // the objects, carved out of the pool
+    unsigned block_id;          // id of the (pinned) pool allocation holding them
+    unsigned size_class;
+    unsigned ix;                // in the small-object layer's slab table
+    alloc_t records[];          // the handles of the objects
+} slab_t, *slab_pt;
+
+_Static_assert(MEM_SLAB_OBJECTS <= 64, "a slab's free objects must fit the mask");
+
+typedef struct _pool_small {
+    slab_pt partial[MEM_SMALL_NUM_CLASSES]; // slabs with free objects, by class
+    slab_pt *slabs;         // by index, so that ids can be resolved; NULL slots are free
+    unsigned *free_ix;      // stack of the free slots
+    unsigned num_free_ix;
+    unsigned num_slabs;     // slots ever handed out
+    unsigned capacity;
+    slab_pt *by_addr;       // the live slabs sorted by address, to tell handles from other pointers
+    unsigned num_live;
+} pool_small_t, *pool_small_pt;
+
+typedef struct _pool_latency {
+    unsigned sample_every;  // time 1 in sample_every calls
+    unsigned countdown;
+    mem_hist_t hist[MEM_LAT_NUM_OPS];
+} pool_latency_t, *pool_latency_pt;
+
+#define MEM_PROFILE_DEPTH 32    // frames kept per sampled allocation
+
+typedef struct _pool_sample {
+    unsigned id;                // of the allocation
+    unsigned depth;
+    size_t size;                // as requested
+    void *frames[MEM_PROFILE_DEPTH];
+} pool_sample_t, *pool_sample_pt;
+
+typedef struct _pool_profile {
+    size_t sample_bytes;        // mean bytes allocated between samples
+    long long countdown;        // bytes to the next sample, overshot by the allocation sampled
+    uint64_t rng;               // xorshift state for the intervals
+    pool_sample_pt *table;      // the live samples by id, linear probing, NULL-empty
+    unsigned capacity;          // a power of two
+    unsigned num_live;
+} pool_profile_t, *pool_profile_pt;
+
+#define MEM_GUARD_DEPTH 16      // frames kept of a guarded allocation and of its deletion
+#define MEM_GUARD_ALIGN 16      // a guarded allocation ends at most this close to its guard page
+#define MEM_GUARD_FILL  0xAB    // between a guarded allocation and its guard page, checked on deletion
+
+typedef enum _guard_state { MEM_GUARD_FREE, MEM_GUARD_LIVE, MEM_GUARD_QUARANTINED } guard_state;
+
+typedef struct _guard_slot {
+    alloc_t record;             // the handle, mem on the slot's page
+    uint32_t next;              // the free or the quarantined slots
+    uint8_t state;              // guard_state
+    uint8_t tag;
+    uint8_t alloc_depth;
+    uint8_t del_depth;
+    void *alloc_frames[MEM_GUARD_DEPTH];
+    void *del_frames[MEM_GUARD_DEPTH];
+} guard_slot_t, *guard_slot_pt;
+
+typedef struct _pool_guard {
+    char *map;                  // a guard page, then a page and a guard page per slot
+    size_t map_size;
+    size_t page_size;
+    unsigned sample_every;      // mean allocations between guarded ones
+    unsigned countdown;
+    uint64_t rng;               // xorshift state for the countdowns
+    unsigned num_slots;
+    unsigned num_live;
+    uint32_t free_slots;        // not used since enabled or reset, chained through next
+    uint32_t quarantine_head;   // deleted and inaccessible, reused oldest first when no slot is free
+    uint32_t quarantine_tail;
+    guard_slot_t slots[];
+} pool_guard_t, *pool_guard_pt;
+
+typedef struct _pool_trace {
+    FILE *sink;
+    unsigned capacity;                  // a power of two
+    atomic_ullong head;                 // next record to write, advanced by the pool's thread
+    atomic_ullong tail;                 // next record to flush, advanced by the flushing thread
+    atomic_ullong dropped;              // records lost because the ring was full
+    pool_trace_record_t records[];
+} pool_trace_t, *pool_trace_pt;
+
+// everything in a snapshot is host byte order, and node references are indices;
+// the header is followed by the node records (offset, size), next, prev and flags,
+// up to node_hwm, the gap sizes and nodes (the two bitmaps instead for BITMAP) and the contents
+typedef struct _pool_snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    char policy[32];        // by name, registered policies are numbered per process
+    uint64_t total_size;
+    uint64_t alloc_size;
+    uint64_t high_water;
+    uint32_t num_allocs;
+    uint32_t num_gaps;
+    uint32_t total_nodes;
+    uint32_t used_nodes;
+    uint32_t node_hwm;
+    uint32_t head;
+    uint32_t unused_nodes;
+    uint32_t gap_ix_capacity;
+    uint32_t flags;
+    uint32_t reserved;
+} pool_snapshot_header_t;
+
+// growth and shrink of a metadata array, from pool_config_t or the defaults
+typedef struct _pool_tuning {
+    unsigned init_capacity;     // also the floor for shrinking
+    float fill_factor;
+    unsigned expand_factor;
+    float shrink_factor;        // 0-never shrink
+} pool_tuning_t;
 
 typedef struct _pool_mgr {
     pool_t pool;
-    node_pt node_heap;
+    const struct _pool_policy *policy_ops;  // looked up once, by mem_pool_open
+    // the node heap, as parallel arrays indexed by node (the index is the allocation id)
+    alloc_pt node_records;  // the allocation records handed out to the user
+    uint32_t *node_next;    // doubly-linked list in address order, for gap deletion
+    uint32_t *node_prev;
+    uint8_t *node_flags;
+    uint32_t head;          // the segment at the start of the pool, not always node 0
     unsigned total_nodes;
     unsigned used_nodes;
-    gap_pt gap_ix;
+    unsigned node_hwm;      // nodes at or above this index have never been handed out
+    uint32_t unused_nodes;  // unused nodes below node_hwm, chained through node_next
+    unsigned node_shrink_at;    // try to shrink the node heap with fewer used nodes than this
+    pool_tuning_t node_tuning;
+    // the gap index, sorted ascending by size, sizes kept apart for the scan
+    size_t *gap_size;
+    uint32_t *gap_node;
     unsigned gap_ix_capacity;
+    pool_tuning_t gap_ix_tuning;
+    // BITMAP pools: one bit per block instead of the list and the gap index
+    uint64_t *bitmap_used;
+    uint64_t *bitmap_start;     // set on the first block of each allocation
+    size_t bitmap_blocks;
+    size_t bitmap_words;        // the bits past bitmap_blocks in the last word are set in bitmap_used
+    size_t bitmap_largest;      // blocks in the largest clear run, MEM_BITMAP_NONE until rescanned
+    size_t bitmap_largest_at;   // its first block
+    size_t high_water;      // peak offset from pool.mem of the end of any allocation
+    pool_tag_stats_t tags[MEM_POOL_TAGS];
+#ifdef MEM_POOL_STATS
+    pool_stats_t stats;
+#endif
+#ifdef MEM_POOL_LATENCY
+    pool_latency_pt latency; // NULL unless enabled
+#endif
+#ifdef MEM_POOL_PROFILE
+    pool_profile_pt profile; // NULL unless started
+#endif
+#ifdef MEM_POOL_GUARD
+    pool_guard_pt guard;     // NULL unless enabled
+#endif
+    pool_trace_pt trace;     // NULL unless enabled
+    pool_small_pt small;     // NULL unless enabled
+    // sub-pools: mem is a pinned allocation of the parent, returned on close
+    struct _pool_mgr *parent;   // NULL for a pool of its own
+    unsigned parent_block;      // id of the allocation in the parent
+    unsigned num_subpools;      // open sub-pools carved out of this pool
 } pool_mgr_t, *pool_mgr_pt;
 
+typedef struct _pool_policy {
+    pool_policy_ops_t ops;  // name and hooks, all NULL but the name for the built-in policies
+    // the gap node to allocate from, or MEM_NODE_NONE; NULL for BITMAP
+    unsigned (*find_node)(pool_mgr_pt pool_mgr, size_t size, unsigned *visited);
+} pool_policy_t, *pool_policy_pt;
+
+
+
+/**********/
+/*        */
+/* Macros */
+/*        */
+/**********/
+#ifdef MEM_POOL_STATS
+#define STAT_INC(mgr, field)        ((mgr)->stats.field += 1)
+#define STAT_SEARCH(mgr, visited)   _mem_stat_search((mgr), (visited))
+#else
+#define STAT_INC(mgr, field)        ((void) 0)
+#define STAT_SEARCH(mgr, visited)   ((void) (visited))
+#endif
+
+#define POLICY_HOOK(mgr, hook, ...) \
+    do { if ((mgr)->policy_ops->ops.hook != NULL) \
+             (mgr)->policy_ops->ops.hook(&(mgr)->pool, __VA_ARGS__, (mgr)->policy_ops->ops.ctx); } while (0)
+
+#ifdef MEM_POOL_PROFILE
+#define PROFILE_ALLOC(mgr, alloc, size) \
+    do { if ((mgr)->profile != NULL && ((mgr)->profile->countdown -= (long long) (size)) <= 0) \
+             _mem_profile_sample((mgr), (alloc), (size)); } while (0)
+#define PROFILE_DEL(mgr, alloc) \
+    do { if ((mgr)->profile != NULL && (mgr)->profile->num_live > 0) _mem_profile_forget((mgr), (alloc)); } while (0)
+#else
+#define PROFILE_ALLOC(mgr, alloc, size) ((void) 0)
+#define PROFILE_DEL(mgr, alloc)         ((void) 0)
+#endif
+
+#ifdef MEM_POOL_GUARD
+#define GUARD_ALLOC(mgr, size, tag) \
+    (((mgr)->guard != NULL && --(mgr)->guard->countdown == 0) ? _mem_guard_alloc((mgr), (size), (tag)) : NULL)
+#define GUARD_SLOT(mgr, alloc) (((mgr)->guard != NULL) ? _mem_guard_slot((mgr), (alloc)) : MEM_NODE_NONE)
+#define GUARD_DEL(mgr, slot)   _mem_guard_del((mgr), (slot))
+#else
+#define GUARD_ALLOC(mgr, size, tag) NULL
+#define GUARD_SLOT(mgr, alloc)      MEM_NODE_NONE
+#define GUARD_DEL(mgr, slot)        ALLOC_FAIL
+#endif
+
+#define TRACE(mgr, op, size, handle, result) \
+    do { if ((mgr)->trace != NULL) _mem_trace_record((mgr), (op), (size), (handle), (result)); } while (0)
+
+#ifdef MEM_POOL_LATENCY
+#define LATENCY_SAMPLE(mgr)         _mem_latency_sample(mgr)
+#define LATENCY_RECORD(mgr, op, t0) \
+    mem_hist_record(&(mgr)->latency->hist[op], mem_hist_ticks() - (t0))
+#else
+#define LATENCY_SAMPLE(mgr)         0
+#define LATENCY_RECORD(mgr, op, t0) ((void) (t0))
+#endif
+
 
 
 /***************************/
@@ -63,10 +321,30 @@ typedef struct _pool_mgr {
 /* Static global variables */
 /*                         */
 /***************************/
-static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
+static pool_mgr_pt *pool_store = NULL; // an array of pointers to the open pools, in no order
 static unsigned pool_store_size = 0;
 static unsigned pool_store_capacity = 0;
 
+static unsigned _mem_find_first_fit(pool_mgr_pt pool_mgr, size_t size, unsigned *visited);
+static unsigned _mem_find_best_fit(pool_mgr_pt pool_mgr, size_t size, unsigned *visited);
+static unsigned _mem_find_worst_fit(pool_mgr_pt pool_mgr, size_t size, unsigned *visited);
+static unsigned _mem_find_registered(pool_mgr_pt pool_mgr, size_t size, unsigned *visited);
+
+// indexed by alloc_policy, the built-in ones first, then the registered ones
+static pool_policy_t policy_table[MEM_POLICY_MAX] = {
+        [FIRST_FIT] = {{.name = "first_fit"}, _mem_find_first_fit},
+        [BEST_FIT]  = {{.name = "best_fit"},  _mem_find_best_fit},
+        [BITMAP]    = {{.name = "bitmap"},    NULL},
+        [WORST_FIT] = {{.name = "worst_fit"}, _mem_find_worst_fit},
+};
+static unsigned num_policies = WORST_FIT + 1;
+
+#ifdef MEM_POOL_GUARD
+// the faults in guard slots are reported by a handler for the whole process, which then
+// puts back the one it replaced, so that retrying the access goes on to crash as before
+static struct sigaction guard_prev_action;
+#endif
+
 
 
 /********************************************/
@@ -77,15 +355,90 @@ static unsigned pool_store_capacity = 0;
 static alloc_status _mem_resize_pool_store();
 static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr);
 static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr);
+static alloc_status _mem_realloc_node_heap(pool_mgr_pt pool_mgr, unsigned total_nodes);
+static alloc_status _mem_shrink_node_heap(pool_mgr_pt pool_mgr, unsigned total_nodes);
+static alloc_status _mem_realloc_gap_ix(pool_mgr_pt pool_mgr, unsigned capacity);
+static pool_pt _mem_pool_open(size_t size, alloc_policy policy, const pool_config_t *config, char *mem);
+static alloc_status _mem_tuning(const pool_config_t *config,
+                                const pool_tuning_t *defaults,
+                                double entries,
+                                pool_tuning_t *tuning);
 static alloc_status
         _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
                            size_t size,
-                           node_pt node);
+                           unsigned node);
 static alloc_status
         _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                 size_t size,
-                                node_pt node);
+                                unsigned node);
 static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_new_alloc(pool_pt pool, size_t size, unsigned tag);
+static alloc_status _mem_del_alloc(pool_pt pool, alloc_pt alloc);
+static void _mem_tag_alloc(pool_mgr_pt pool_mgr, unsigned tag, size_t size);
+static void _mem_tag_del(pool_mgr_pt pool_mgr, unsigned tag, size_t size);
+static void _mem_tag_recount(pool_mgr_pt pool_mgr);
+static unsigned _mem_get_unused_node(pool_mgr_pt pool_mgr);
+static void _mem_put_unused_node(pool_mgr_pt pool_mgr, unsigned node);
+static void _mem_init_pool_mgr(pool_mgr_pt pool_mgr);
+static void _mem_release_pool_mgr(pool_mgr_pt pool_mgr);
+static unsigned _mem_alloc_node(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static alloc_status _mem_merge_next_gap(pool_mgr_pt pool_mgr, unsigned node);
+#ifdef MEM_POOL_STATS
+static void _mem_stat_search(pool_mgr_pt pool_mgr, unsigned visited);
+#endif
+#ifdef MEM_POOL_LATENCY
+static int _mem_latency_sample(pool_mgr_pt pool_mgr);
+#endif
+#ifdef MEM_POOL_PROFILE
+static void _mem_profile_sample(pool_mgr_pt pool_mgr, alloc_pt alloc, size_t size);
+static void _mem_profile_forget(pool_mgr_pt pool_mgr, alloc_pt alloc);
+static void _mem_profile_clear(pool_profile_pt profile);
+static long long _mem_profile_interval(pool_profile_pt profile);
+static double _mem_profile_weight(pool_profile_pt profile, size_t size);
+static int _mem_profile_cmp(const void *a, const void *b);
+#endif
+#ifdef MEM_POOL_GUARD
+static alloc_pt _mem_guard_alloc(pool_mgr_pt pool_mgr, size_t size, unsigned tag);
+static alloc_status _mem_guard_del(pool_mgr_pt pool_mgr, unsigned slot);
+static unsigned _mem_guard_slot(pool_mgr_pt pool_mgr, const void *alloc);
+static void _mem_guard_init(pool_guard_pt guard);
+static unsigned _mem_guard_interval(pool_guard_pt guard);
+static void _mem_guard_fault(int sig, siginfo_t *info, void *context);
+static void _mem_guard_report(pool_guard_pt guard, unsigned slot, const char *what, const char *addr);
+static void _mem_guard_write(const char *str);
+static void _mem_guard_write_num(uint64_t value, unsigned base);
+static void _mem_guard_write_frames(const char *title, void *const *frames, unsigned depth);
+#endif
+static unsigned _mem_node_id(pool_mgr_pt pool_mgr, const void *node);
+static void _mem_trace_record(pool_mgr_pt pool_mgr,
+                              pool_trace_op op,
+                              size_t size,
+                              unsigned handle,
+                              unsigned result);
+static alloc_status _mem_trace_drain(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_small_alloc(pool_mgr_pt pool_mgr, size_t size);
+static alloc_status _mem_small_del(pool_mgr_pt pool_mgr, slab_pt slab, alloc_pt alloc);
+static slab_pt _mem_small_slab(pool_mgr_pt pool_mgr, const void *alloc);
+static unsigned _mem_small_position(pool_small_pt small, slab_pt slab);
+static slab_pt _mem_small_new_slab(pool_mgr_pt pool_mgr, unsigned size_class);
+static void _mem_small_release_slab(pool_mgr_pt pool_mgr, slab_pt slab);
+static void _mem_small_trim(pool_mgr_pt pool_mgr);
+static void _mem_small_discard(pool_mgr_pt pool_mgr);
+static alloc_status _mem_write_all(int fd, const void *buf, size_t size);
+static alloc_status _mem_read_all(int fd, void *buf, size_t size);
+static alloc_status _mem_snapshot_metadata(pool_mgr_pt pool_mgr, int fd);
+static alloc_status _mem_restore_metadata(pool_mgr_pt pool_mgr, int fd, const pool_snapshot_header_t *header);
+static void _mem_bitmap_init(pool_mgr_pt pool_mgr);
+static alloc_pt _mem_bitmap_alloc(pool_mgr_pt pool_mgr, size_t size, unsigned tag);
+static alloc_status _mem_bitmap_del(pool_mgr_pt pool_mgr, unsigned node);
+static size_t _mem_bitmap_find(const uint64_t *used, size_t num_words, size_t n, unsigned *visited);
+static size_t _mem_bitmap_skip_full(const uint64_t *used, size_t i, size_t num_words);
+static void _mem_bitmap_fill(uint64_t *map, size_t start, size_t n, int set);
+static int _mem_bitmap_test(const uint64_t *map, size_t i);
+static size_t _mem_bitmap_clear_below(const uint64_t *used, size_t block);
+static size_t _mem_bitmap_clear_from(const uint64_t *used, size_t num_words, size_t block);
+static size_t _mem_bitmap_largest_run(pool_mgr_pt pool_mgr);
+static size_t _mem_bitmap_segment_start(pool_mgr_pt pool_mgr, size_t block);
 
 
 
@@ -135,12 +488,79 @@ alloc_status mem_free() {
 }
 
 pool_pt mem_pool_open(size_t size, alloc_policy policy) {
+    return mem_pool_open_ex(size, policy, NULL);
+}
+
+pool_pt mem_pool_open_ex(size_t size, alloc_policy policy, const pool_config_t *config) {
+    return _mem_pool_open(size, policy, config, NULL);
+}
+
+pool_pt mem_subpool_open(pool_pt parent, size_t size, alloc_policy policy) {
+    // get the mgr from the pool
+    pool_mgr_pt parentManager = (pool_mgr_pt) parent;
+    if (parentManager->pool.mem == NULL || size == 0)
+        return NULL;
+
+    // reserve the block, past the small-object layer, since a slab object cannot be pinned
+    alloc_pt block = _mem_new_alloc(parent, size, 0);
+    unsigned block_id = (block != NULL) ? _mem_node_id(parentManager, block) : MEM_TRACE_NO_HANDLE;
+    TRACE(parentManager, MEM_TRACE_ALLOC, size, block_id, (block != NULL) ? ALLOC_OK : ALLOC_FAIL);
+    if (block == NULL)
+        return NULL;
+
+    // an independent pool in it, which compaction of the parent must not move
+    pool_pt pool = _mem_pool_open(size, policy, NULL, block->mem);
+    if (pool == NULL) {
+        mem_del_alloc(parent, block);
+        return NULL;
+    }
+    parentManager->node_flags[block_id] |= MEM_NODE_PINNED;
+    parentManager->num_subpools += 1;
+
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    myPoolManager->parent = parentManager;
+    myPoolManager->parent_block = block_id;
+
+    return pool;
+}
+
+// mem is the pool's memory for a sub-pool, NULL to allocate it
+static pool_pt _mem_pool_open(size_t size, alloc_policy policy, const pool_config_t *config, char *mem) {
+    static const pool_config_t default_config;
+    static const pool_tuning_t default_node_tuning = {
+            MEM_NODE_HEAP_INIT_CAPACITY,
+            MEM_NODE_HEAP_FILL_FACTOR,
+            MEM_NODE_HEAP_EXPAND_FACTOR,
+            MEM_NODE_HEAP_SHRINK_FACTOR
+    };
+    static const pool_tuning_t default_gap_ix_tuning = {
+            MEM_GAP_IX_INIT_CAPACITY,
+            MEM_GAP_IX_FILL_FACTOR,
+            MEM_GAP_IX_EXPAND_FACTOR,
+            MEM_GAP_IX_SHRINK_FACTOR
+    };
+    pool_tuning_t node_tuning, gap_ix_tuning;
+
     // make sure there the pool store is allocated
     if (pool_store == NULL)
         return NULL;
 
+    // make sure the policy exists
+    if ((unsigned) policy >= num_policies)
+        return NULL;
+
+    // size the node heap for the allocations and the gaps between them, the gap index for the gaps
+    if (config == NULL)
+        config = &default_config;
+    if (_mem_tuning(config, &default_node_tuning,
+                    (double) config->expected_allocs + config->expected_gaps + 1, &node_tuning) != ALLOC_OK
+        || _mem_tuning(config, &default_gap_ix_tuning,
+                       (double) config->expected_gaps + 1, &gap_ix_tuning) != ALLOC_OK)
+        return NULL;
+
     // expand the pool store, if necessary
-    _mem_resize_pool_store();
+    if (_mem_resize_pool_store() != ALLOC_OK)
+        return NULL;
 
     // allocate a new mem pool mgr
     // check success, on error return null
@@ -148,61 +568,108 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
     if (myPoolManager == NULL)
         return NULL;
 
-    // allocate a new memory pool
+    // allocate a new memory pool, unless it is given
     // check success, on error deallocate mgr and return null
-    myPoolManager->pool.mem = malloc(size);
+    myPoolManager->pool.mem = (mem != NULL) ? mem : malloc(size);
     if (myPoolManager->pool.mem == NULL) {
         free(myPoolManager);
         return NULL;
     }
 
-    // allocate a new node heap
-    // check success, on error deallocate mgr/pool and return null
-    myPoolManager->node_heap = malloc(MEM_NODE_HEAP_INIT_CAPACITY * sizeof(node_t));
-    if (myPoolManager->node_heap == NULL) {
-        free(myPoolManager->pool.mem);
+    // allocate a new node heap and gap index
+    // check success, on error deallocate whatever was allocated and return null
+    myPoolManager->node_records = malloc(node_tuning.init_capacity * sizeof(alloc_t));
+    myPoolManager->node_next = malloc(node_tuning.init_capacity * sizeof(uint32_t));
+    myPoolManager->node_prev = malloc(node_tuning.init_capacity * sizeof(uint32_t));
+    myPoolManager->node_flags = malloc(node_tuning.init_capacity * sizeof(uint8_t));
+    myPoolManager->gap_size = malloc(gap_ix_tuning.init_capacity * sizeof(size_t));
+    myPoolManager->gap_node = malloc(gap_ix_tuning.init_capacity * sizeof(uint32_t));
+    if (myPoolManager->node_records == NULL || myPoolManager->node_next == NULL
+        || myPoolManager->node_prev == NULL || myPoolManager->node_flags == NULL
+        || myPoolManager->gap_size == NULL || myPoolManager->gap_node == NULL) {
+        free(myPoolManager->node_records);
+        free(myPoolManager->node_next);
+        free(myPoolManager->node_prev);
+        free(myPoolManager->node_flags);
+        free(myPoolManager->gap_size);
+        free(myPoolManager->gap_node);
+        if (mem == NULL)
+            free(myPoolManager->pool.mem);
         free(myPoolManager);
         return NULL;
     }
 
-    // allocate a new gap index
-    // check success, on error deallocate mgr/pool/heap and return null
-    myPoolManager->gap_ix = malloc(MEM_GAP_IX_INIT_CAPACITY * sizeof(gap_t));
-    if (myPoolManager->gap_ix == NULL) {
-        free(myPoolManager->node_heap);
-        free(myPoolManager->pool.mem);
-        free(myPoolManager);
-        return NULL;
+    // allocate the bitmaps of a BITMAP pool, which only hands out whole blocks
+    // check success, on error deallocate the rest and return null
+    myPoolManager->bitmap_blocks = (policy == BITMAP) ? size / MEM_POOL_BITMAP_BLOCK : 0;
+    myPoolManager->bitmap_words = (myPoolManager->bitmap_blocks + 63) / 64;
+    myPoolManager->bitmap_used = NULL;
+    myPoolManager->bitmap_start = NULL;
+    if (policy == BITMAP) {
+        myPoolManager->bitmap_used = malloc(myPoolManager->bitmap_words * sizeof(uint64_t));
+        myPoolManager->bitmap_start = malloc(myPoolManager->bitmap_words * sizeof(uint64_t));
+        if (myPoolManager->bitmap_blocks == 0
+            || myPoolManager->bitmap_used == NULL || myPoolManager->bitmap_start == NULL) {
+            free(myPoolManager->bitmap_used);
+            free(myPoolManager->bitmap_start);
+            free(myPoolManager->node_records);
+            free(myPoolManager->node_next);
+            free(myPoolManager->node_prev);
+            free(myPoolManager->node_flags);
+            free(myPoolManager->gap_size);
+            free(myPoolManager->gap_node);
+            if (mem == NULL)
+                free(myPoolManager->pool.mem);
+            free(myPoolManager);
+            return NULL;
+        }
+        // the tail past the last whole block is never used
+        size = myPoolManager->bitmap_blocks * MEM_POOL_BITMAP_BLOCK;
     }
 
     // assign all the pointers and update meta data:
-    //   initialize top node of node heap
-    myPoolManager->node_heap[0].alloc_record.mem = myPoolManager->pool.mem;
-    myPoolManager->node_heap[0].alloc_record.size = size;
-    myPoolManager->node_heap[0].used = 1;
-    myPoolManager->node_heap[0].allocated = 0;
-    myPoolManager->node_heap[0].next = NULL;
-    myPoolManager->node_heap[0].prev = NULL;
-
-    //  (was missing) initialize pool mgr pool
+    //   initialize pool mgr pool
     myPoolManager->pool.policy = policy;
+    myPoolManager->policy_ops = &policy_table[policy];
     myPoolManager->pool.total_size = size;
-    myPoolManager->pool.alloc_size = 0;
-    myPoolManager->pool.num_allocs = 0;
-    myPoolManager->pool.num_gaps = 0;
-
-    //   initialize top node of gap index
-    _mem_add_to_gap_ix(myPoolManager, size, &myPoolManager->node_heap[0]);
 
     //   initialize pool mgr
-    myPoolManager->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
-    myPoolManager->used_nodes = 1;
-    myPoolManager->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
+    myPoolManager->total_nodes = node_tuning.init_capacity;
+    myPoolManager->node_shrink_at = 0;
+    myPoolManager->node_tuning = node_tuning;
+    myPoolManager->gap_ix_capacity = gap_ix_tuning.init_capacity;
+    myPoolManager->gap_ix_tuning = gap_ix_tuning;
+
+    //   initialize top node of node heap and top node of gap index
+    _mem_init_pool_mgr(myPoolManager);
+#ifdef MEM_POOL_STATS
+    memset(&myPoolManager->stats, 0, sizeof(pool_stats_t));
+#endif
+#ifdef MEM_POOL_LATENCY
+    myPoolManager->latency = NULL;
+#endif
+#ifdef MEM_POOL_PROFILE
+    myPoolManager->profile = NULL;
+#endif
+#ifdef MEM_POOL_GUARD
+    myPoolManager->guard = NULL;
+#endif
+    myPoolManager->trace = NULL;
+    myPoolManager->small = NULL;
+    myPoolManager->parent = NULL;
+    myPoolManager->parent_block = MEM_NODE_NONE;
+    myPoolManager->num_subpools = 0;
 
     //   link pool mgr to pool store
     pool_store[pool_store_size] = myPoolManager;
     pool_store_size = pool_store_size + 1;
 
+    // turn on the optional layers asked for
+    if (config->small_objects && mem_pool_small_enable(&myPoolManager->pool) != ALLOC_OK) {
+        _mem_release_pool_mgr(myPoolManager);
+        return NULL;
+    }
+
     // return the address of the mgr, cast to (pool_pt)
     return &(myPoolManager->pool);
 }
@@ -215,255 +682,375 @@ alloc_status mem_pool_close(pool_pt pool) {
         return ALLOC_CALLED_AGAIN;
     }
 
+    // slabs kept around empty are not the user's allocations
+    if (myPoolManager->small != NULL)
+        _mem_small_trim(myPoolManager);
+
+#ifdef MEM_POOL_GUARD
+    // guarded allocations are the user's, though outside the pool
+    if (myPoolManager->guard != NULL && myPoolManager->guard->num_live > 0) {
+        TRACE(myPoolManager, MEM_TRACE_CLOSE, 0, MEM_TRACE_NO_HANDLE, ALLOC_NOT_FREED);
+        return ALLOC_NOT_FREED;
+    }
+#endif
+
     // check if pool has only one gap
-    else if (myPoolManager->pool.num_gaps != 1) {
+    if (myPoolManager->pool.num_gaps != 1) {
+        TRACE(myPoolManager, MEM_TRACE_CLOSE, 0, MEM_TRACE_NO_HANDLE, ALLOC_NOT_FREED);
         return ALLOC_NOT_FREED;
     }
 
     // check if it has zero allocations
     else if (myPoolManager->pool.num_allocs != 0) {
+        TRACE(myPoolManager, MEM_TRACE_CLOSE, 0, MEM_TRACE_NO_HANDLE, ALLOC_NOT_FREED);
         return ALLOC_NOT_FREED;
     }
 
     else {
-        // free memory pool
-        free(myPoolManager->pool.mem);
-        // free node heap
-        free(myPoolManager->node_heap);
-        // free gap index
-        free(myPoolManager->gap_ix);
-        // find mgr in pool store and set to null
-        for (int i = 0; i < pool_store_size; i++) {
-            if (pool_store[i] == myPoolManager) {
-                pool_store[i] = NULL;
-            }
-        }
-
-        // note: don't decrement pool_store_size, because it only grows
-        // free mgr
-        free(myPoolManager);
+        TRACE(myPoolManager, MEM_TRACE_CLOSE, 0, MEM_TRACE_NO_HANDLE, ALLOC_OK);
+        _mem_release_pool_mgr(myPoolManager);
 
         return ALLOC_OK;
     }
 }
 
+alloc_status mem_pool_close_force(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt myPoolManager = (pool_mgr_pt)pool;
+    // check if this pool is allocated
+    if (myPoolManager->pool.mem == NULL) {
+        return ALLOC_CALLED_AGAIN;
+    }
+
+    // the memory of open sub-pools cannot go with it
+    if (myPoolManager->num_subpools > 0) {
+        TRACE(myPoolManager, MEM_TRACE_CLOSE, myPoolManager->pool.num_allocs, MEM_TRACE_NO_HANDLE, ALLOC_NOT_FREED);
+        return ALLOC_NOT_FREED;
+    }
+
+    // live allocations are discarded along with the pool
+    TRACE(myPoolManager, MEM_TRACE_CLOSE, myPoolManager->pool.num_allocs, MEM_TRACE_NO_HANDLE, ALLOC_OK);
+    _mem_release_pool_mgr(myPoolManager);
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_reset(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt myPoolManager = (pool_mgr_pt)pool;
+    // check if this pool is allocated
+    if (myPoolManager->pool.mem == NULL) {
+        return ALLOC_CALLED_AGAIN;
+    }
+
+    // open sub-pools are allocations which cannot be discarded
+    if (myPoolManager->num_subpools > 0) {
+        TRACE(myPoolManager, MEM_TRACE_RESET, 0, MEM_TRACE_NO_HANDLE, ALLOC_NOT_FREED);
+        return ALLOC_NOT_FREED;
+    }
+
+    // back to a single gap; the node heap and gap index keep their capacity
+    // and the stale entries in them are never looked at again
+    if (myPoolManager->small != NULL)
+        _mem_small_discard(myPoolManager);
+#ifdef MEM_POOL_PROFILE
+    if (myPoolManager->profile != NULL)
+        _mem_profile_clear(myPoolManager->profile);
+#endif
+#ifdef MEM_POOL_GUARD
+    // every slot inaccessible and free again, quarantine or not
+    if (myPoolManager->guard != NULL) {
+        mprotect(myPoolManager->guard->map, myPoolManager->guard->map_size, PROT_NONE);
+        _mem_guard_init(myPoolManager->guard);
+    }
+#endif
+    _mem_init_pool_mgr(myPoolManager);
+    TRACE(myPoolManager, MEM_TRACE_RESET, 0, MEM_TRACE_NO_HANDLE, ALLOC_OK);
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_shrink_metadata(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt myPoolManager = (pool_mgr_pt)pool;
+    // check if this pool is allocated
+    if (myPoolManager->pool.mem == NULL) {
+        return ALLOC_CALLED_AGAIN;
+    }
+
+    // the empty slabs kept for reuse go first, their nodes and metadata with them
+    if (myPoolManager->small != NULL)
+        _mem_small_trim(myPoolManager);
+
+    // the node heap down to its highest node in use, the gap index down to its entries
+    if (_mem_shrink_node_heap(myPoolManager, 0) == ALLOC_OK)
+        STAT_INC(myPoolManager, node_heap_resizes);
+    unsigned capacity = myPoolManager->pool.num_gaps;
+    if (capacity < myPoolManager->gap_ix_tuning.init_capacity)
+        capacity = myPoolManager->gap_ix_tuning.init_capacity;
+    if (capacity < myPoolManager->gap_ix_capacity
+        && _mem_realloc_gap_ix(myPoolManager, capacity) == ALLOC_OK)
+        STAT_INC(myPoolManager, gap_ix_resizes);
+
+    return ALLOC_OK;
+}
+
+size_t mem_pool_metadata_size(pool_pt pool) {
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    size_t size = sizeof(pool_mgr_t);
+
+    size += myPoolManager->total_nodes * (sizeof(alloc_t) + 2 * sizeof(uint32_t) + sizeof(uint8_t));
+    size += myPoolManager->gap_ix_capacity * (sizeof(size_t) + sizeof(uint32_t));
+    size += 2 * myPoolManager->bitmap_words * sizeof(uint64_t);
+#ifdef MEM_POOL_LATENCY
+    if (myPoolManager->latency != NULL)
+        size += sizeof(pool_latency_t);
+#endif
+    if (myPoolManager->trace != NULL)
+        size += sizeof(pool_trace_t) + myPoolManager->trace->capacity * sizeof(pool_trace_record_t);
+    if (myPoolManager->small != NULL) {
+        pool_small_pt small = myPoolManager->small;
+        size += sizeof(pool_small_t) + small->capacity * (2 * sizeof(slab_pt) + sizeof(unsigned));
+        size += (small->num_slabs - small->num_free_ix) * MEM_SLAB_META_SIZE;
+    }
+#ifdef MEM_POOL_GUARD
+    if (myPoolManager->guard != NULL)
+        size += sizeof(pool_guard_t) + myPoolManager->guard->num_slots * sizeof(guard_slot_t);
+#endif
+
+    return size;
+}
+
 alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
+    return mem_new_alloc_tagged(pool, size, 0);
+}
+
+alloc_pt mem_new_alloc_tagged(pool_pt pool, size_t size, unsigned tag) {
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    unsigned long long t0 = 0;
+    int timed;
+
+    if (tag >= MEM_POOL_TAGS)
+        return NULL;
+
+    timed = LATENCY_SAMPLE(myPoolManager);
+
+    if (timed)
+        t0 = mem_hist_ticks();
+
+    // now and then a request gets a guard slot outside the pool, if it fits one
+    alloc_pt alloc = GUARD_ALLOC(myPoolManager, size, tag);
+
+    // small untagged requests come out of a slab, unless no slab can be had
+    // (slab objects have no node to keep a tag in)
+    if (alloc == NULL && myPoolManager->small != NULL && tag == 0 && size > 0 && size <= MEM_POOL_SMALL_MAX)
+        alloc = _mem_small_alloc(myPoolManager, size);
+    if (alloc == NULL)
+        alloc = _mem_new_alloc(pool, size, tag);
+    if (alloc != NULL)
+        PROFILE_ALLOC(myPoolManager, alloc, size);
+
+    if (timed)
+        LATENCY_RECORD(myPoolManager, MEM_LAT_ALLOC, t0);
+
+    TRACE(myPoolManager, MEM_TRACE_ALLOC, size,
+          (alloc != NULL) ? mem_alloc_id(pool, alloc) : MEM_TRACE_NO_HANDLE,
+          (alloc != NULL) ? ALLOC_OK : ALLOC_FAIL);
+
+    return alloc;
+}
+
+alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    unsigned long long t0 = 0;
+    int timed = LATENCY_SAMPLE(myPoolManager);
+    unsigned handle = 0;
+    size_t size = 0;
+
+    // the record has to be read before the node is released
+    if (myPoolManager->trace != NULL) {
+        handle = mem_alloc_id(pool, alloc);
+        size = (handle != MEM_TRACE_NO_HANDLE) ? alloc->size : 0;
+    }
+
+    PROFILE_DEL(myPoolManager, alloc);
+
+    if (timed)
+        t0 = mem_hist_ticks();
+
+    // handles outside the node heap may be guarded allocations or small objects;
+    // the guard slots go first, their handles are never looked at as slabs
+    unsigned slot = GUARD_SLOT(myPoolManager, alloc);
+    slab_pt slab = (slot == MEM_NODE_NONE) ? _mem_small_slab(myPoolManager, alloc) : NULL;
+    alloc_status status;
+    if (slot != MEM_NODE_NONE)
+        status = GUARD_DEL(myPoolManager, slot);
+    else if (slab != NULL)
+        status = _mem_small_del(myPoolManager, slab, alloc);
+    else
+        status = _mem_del_alloc(pool, alloc);
+
+    if (timed)
+        LATENCY_RECORD(myPoolManager, MEM_LAT_DEL, t0);
+
+    TRACE(myPoolManager, MEM_TRACE_DEL, size, handle, status);
+
+    return status;
+}
+
+static alloc_pt _mem_new_alloc(pool_pt pool, size_t size, unsigned tag) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
-    int gapNumber = 0;
     size_t remainingGap = 0;
-    node_pt myNode = NULL;
-    node_pt unusedNode = NULL;
+    unsigned myNode = MEM_NODE_NONE;
+    unsigned unusedNode = MEM_NODE_NONE;
+    unsigned visited = 0;
     // check if any gaps, return null if none
     if (myPoolManager->pool.num_gaps == 0) {
+        STAT_INC(myPoolManager, num_failures);
         return NULL;
     }
 
     // expand heap node, if necessary, quit on error
     if (_mem_resize_node_heap(myPoolManager) != ALLOC_OK) {
+        STAT_INC(myPoolManager, num_failures);
         return NULL;
     };
 
     // check used nodes fewer than total nodes, quit on error
     if (myPoolManager->used_nodes > myPoolManager->total_nodes) {
+        STAT_INC(myPoolManager, num_failures);
         return NULL;
     }
-    // get a node for allocation:
-    // if FIRST_FIT, then find the first sufficient node in the node heap
-    if (myPoolManager->pool.policy == FIRST_FIT) {
-        for (int i = 0; i < myPoolManager->total_nodes; i++) {
-            if (myPoolManager->node_heap[i].used == 1) {
-                if (myPoolManager->node_heap[i].allocated == 0) {
-                    if (myPoolManager->node_heap[i].alloc_record.size >= size) {
-                        myNode = &myPoolManager->node_heap[i];
-                        break;
-                    }
-                }
-            }
-        }
-    }
 
-    // if BEST_FIT, then find the first sufficient node in the gap index
-    else if (myPoolManager->pool.policy == BEST_FIT) {
-        for(int i = 0; i < myPoolManager->pool.num_gaps; ++i) {
-            if (myPoolManager->gap_ix[i].size >= size) {
-                myNode = myPoolManager->gap_ix[i].node;
-                break;
-            }
-        }
-    }
+    // if BITMAP, there are no gap nodes, find a run of free blocks instead
+    if (myPoolManager->pool.policy == BITMAP)
+        return _mem_bitmap_alloc(myPoolManager, size, tag);
 
-    else {
-        return NULL;
-    }
+    // get a node for allocation from the pool's policy
+    myNode = myPoolManager->policy_ops->find_node(myPoolManager, size, &visited);
+
+    STAT_SEARCH(myPoolManager, visited);
 
     // check if node found
-    if (myNode == NULL)
+    if (myNode == MEM_NODE_NONE) {
+        STAT_INC(myPoolManager, num_failures);
         return NULL;
+    }
+    alloc_pt record = &myPoolManager->node_records[myNode];
 
     // update metadata (num_allocs, alloc_size)
+    STAT_INC(myPoolManager, num_allocs);
     myPoolManager->pool.num_allocs += 1;
     myPoolManager->pool.alloc_size += size;
+    _mem_tag_alloc(myPoolManager, tag, size);
 
     // calculate the size of the remaining gap, if any
-    remainingGap = myNode->alloc_record.size - size;
+    remainingGap = record->size - size;
 
     // remove node from gap index
-    _mem_remove_from_gap_ix(myPoolManager, size, myNode);
+    _mem_remove_from_gap_ix(myPoolManager, record->size, myNode);
+
+    // convert gap_node to an allocation node of given size and tag
+    myPoolManager->node_flags[myNode] |= MEM_NODE_ALLOCATED | (uint8_t) (tag << MEM_NODE_TAG_SHIFT);
+    record->size = size;
 
-    // convert gap_node to an allocation node of given size
-    myNode->allocated = 1;
-    myNode->alloc_record.size = size;
+    // update metadata (high_water)
+    size_t allocEnd = (size_t) (record->mem - myPoolManager->pool.mem) + size;
+    if (allocEnd > myPoolManager->high_water)
+        myPoolManager->high_water = allocEnd;
     // adjust node heap:
     //   if remaining gap, need a new node
     if (remainingGap > 0) {
-        //   find an unused one in the node heap
-        for (int i = 0; i < myPoolManager->total_nodes; ++i) {
-            if (myPoolManager->node_heap[i].used == 0) {
-                unusedNode = &(myPoolManager->node_heap[i]);
-                break;
-            }
-        }
+        STAT_INC(myPoolManager, num_splits);
+
+        //   get an unused one from the node heap
+        unusedNode = _mem_get_unused_node(myPoolManager);
 
         //   make sure one was found
-        if (unusedNode == NULL)
+        if (unusedNode == MEM_NODE_NONE)
             return NULL;
 
         //   initialize it to a gap node
-        unusedNode->used = 1;
-        unusedNode->allocated = 0;
-        unusedNode->alloc_record.mem = myNode->alloc_record.mem + myNode->alloc_record.size;
-        unusedNode->alloc_record.size = remainingGap;
-
-        //   update metadata (used_nodes)
-        myPoolManager->used_nodes += 1;
+        myPoolManager->node_records[unusedNode].mem = record->mem + record->size;
+        myPoolManager->node_records[unusedNode].size = remainingGap;
 
         //   update linked list (new node right after the node for allocation)
-        if (myNode->next) {
-            myNode->next->prev = unusedNode;
-        }
-        unusedNode->next = myNode->next;
-        myNode->next = unusedNode;
-        unusedNode->prev = myNode;
+        unsigned nextNode = myPoolManager->node_next[myNode];
+        if (nextNode != MEM_NODE_NONE)
+            myPoolManager->node_prev[nextNode] = unusedNode;
+        myPoolManager->node_next[unusedNode] = nextNode;
+        myPoolManager->node_next[myNode] = unusedNode;
+        myPoolManager->node_prev[unusedNode] = myNode;
 
         //   add to gap index
         //   check if successful
         if (_mem_add_to_gap_ix(myPoolManager, remainingGap, unusedNode) != ALLOC_OK)
             return NULL;
+
+        POLICY_HOOK(myPoolManager, on_split, record, remainingGap);
     }
-    // return allocation record by casting the node to (alloc_pt)
-    return (alloc_pt)myNode;
+    // return the allocation record of the node
+    return record;
 }
 
-alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
+static alloc_status _mem_del_alloc(pool_pt pool, alloc_pt alloc) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
 
-    // get node from alloc by casting the pointer to (node_pt)
-    node_pt myNode = (node_pt) alloc;
-
     // find the node in the node heap
     // this is node-to-delete
-    node_pt node = NULL;
-    for (int i = 0; i < myPoolManager->total_nodes; ++i) {
-        if (myPoolManager->node_heap[i].used == 1) {
-            if (&myPoolManager->node_heap[i] == myNode) {
-                node = &myPoolManager->node_heap[i];
-                break;
-            }
-        }
-    }
+    unsigned node = _mem_alloc_node(myPoolManager, alloc);
 
     // make sure it's found
-    if (node == NULL)
+    if (node == MEM_NODE_NONE) {
+        STAT_INC(myPoolManager, num_failures);
         return ALLOC_FAIL;
+    }
+    STAT_INC(myPoolManager, num_frees);
 
-    // convert to gap node
-    node->allocated = 0;
+    // if BITMAP, clearing the bits is all the coalescing there is
+    if (myPoolManager->pool.policy == BITMAP)
+        return _mem_bitmap_del(myPoolManager, node);
 
-    // update metadata (num_allocs, alloc_size)
+    POLICY_HOOK(myPoolManager, on_free, alloc);
+
+    // update metadata (num_allocs, alloc_size, the tag's usage)
     myPoolManager->pool.num_allocs -= 1;
-    myPoolManager->pool.alloc_size -= node->alloc_record.size;
+    myPoolManager->pool.alloc_size -= myPoolManager->node_records[node].size;
+    _mem_tag_del(myPoolManager, MEM_NODE_TAG(myPoolManager->node_flags[node]), myPoolManager->node_records[node].size);
 
-    // if the next node in the list is also a gap, merge into node-to-delete
-    if (node->next != NULL && node->next->allocated == 0) {
-        node_pt nextNode = node->next;
-        //   remove the next node from gap index
-        //   check success
-        if(_mem_remove_from_gap_ix(myPoolManager, nextNode->alloc_record.size, nextNode) != ALLOC_OK)
-            return ALLOC_FAIL;
+    // convert to gap node
+    myPoolManager->node_flags[node] = MEM_NODE_USED;
 
-        //   add the size to the node-to-delete
-        node->alloc_record.size += nextNode->alloc_record.size;
-
-        //   update node as unused
-        nextNode->used = 0;
-
-        //   update metadata (used nodes)
-        myPoolManager->used_nodes -= 1;
-
-        //   update linked list:
-        /*
-                        if (next->next) {
-                            next->next->prev = node_to_del;
-                            node_to_del->next = next->next;
-                        } else {
-                            node_to_del->next = NULL;
-                        }
-                        next->next = NULL;
-                        next->prev = NULL;
-         */
-        if (nextNode->next) {
-            nextNode->next->prev = nextNode->prev;
-            node->next = nextNode->next;
-        }
-        else {
-            node->next = NULL;
-        }
-        nextNode->next = NULL;
-        nextNode->prev = NULL;
-    }
+    // if the next node in the list is also a gap, merge into node-to-delete
+    if (_mem_merge_next_gap(myPoolManager, node) != ALLOC_OK)
+        return ALLOC_FAIL;
 
     // this merged node-to-delete might need to be added to the gap index
     // but one more thing to check...
     // if the previous node in the list is also a gap, merge into previous!
-    if (node->prev != NULL && node->prev->allocated == 0) {
-        node_pt prevNode = node->prev;
+    unsigned prevNode = myPoolManager->node_prev[node];
+    if (prevNode != MEM_NODE_NONE && !(myPoolManager->node_flags[prevNode] & MEM_NODE_ALLOCATED)) {
+        STAT_INC(myPoolManager, num_coalesces);
 
         //   remove the previous node from gap index
         //   check success
-        if (_mem_remove_from_gap_ix(myPoolManager, node->prev->alloc_record.size, node->prev) != ALLOC_OK)
+        if (_mem_remove_from_gap_ix(myPoolManager, myPoolManager->node_records[prevNode].size, prevNode) != ALLOC_OK)
             return ALLOC_FAIL;
 
         //   add the size of node-to-delete to the previous
-        node->prev->alloc_record.size += node->alloc_record.size;
-
-        //   update node-to-delete as unused
-        node->used = 0;
-
-        //   update metadata (used_nodes)
-        myPoolManager->used_nodes -= 1;
+        myPoolManager->node_records[prevNode].size += myPoolManager->node_records[node].size;
+        POLICY_HOOK(myPoolManager, on_coalesce, myPoolManager->node_records[prevNode].size);
 
         //   update linked list
-        /*
-                        if (node_to_del->next) {
-                            prev->next = node_to_del->next;
-                            node_to_del->next->prev = prev;
-                        } else {
-                            prev->next = NULL;
-                        }
-                        node_to_del->next = NULL;
-                        node_to_del->prev = NULL;
-         */
-        if (node->next) {
-            prevNode->next = node->next;
-            prevNode->next->prev = prevNode;
-        }
-        else {
-            prevNode->next = NULL;
-        }
-        node->next = NULL;
-        node->prev = NULL;
+        unsigned nextNode = myPoolManager->node_next[node];
+        myPoolManager->node_next[prevNode] = nextNode;
+        if (nextNode != MEM_NODE_NONE)
+            myPoolManager->node_prev[nextNode] = prevNode;
+
+        //   update node-to-delete as unused and metadata (used_nodes)
+        _mem_put_unused_node(myPoolManager, node);
 
         node = prevNode;
     }
@@ -471,7 +1058,7 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
     //   change the node to add to the previous node!
     // add the resulting node to the gap index
     // check success
-    if (_mem_add_to_gap_ix(myPoolManager, node->alloc_record.size, node) != ALLOC_OK)
+    if (_mem_add_to_gap_ix(myPoolManager, myPoolManager->node_records[node].size, node) != ALLOC_OK)
         return ALLOC_FAIL;
     return ALLOC_OK;
 }
@@ -479,181 +1066,2424 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
 void mem_inspect_pool(pool_pt pool,
                       pool_segment_pt *segments,
                       unsigned *num_segments) {
-    // get the mgr from the pool
-    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    pool_cursor_t cursor;
 
-    // allocate the segments array with size == used_nodes
-    pool_segment_pt segments_array = malloc(myPoolManager->used_nodes * sizeof(pool_segment_t));
+    // allocate the segments array with size == num_allocs + num_gaps
+    // (== used_nodes, except for BITMAP pools which keep no gap nodes)
+    unsigned num_segs = pool->num_allocs + pool->num_gaps;
+    pool_segment_pt segments_array = malloc(num_segs * sizeof(pool_segment_t));
 
     // check successful
     if (segments_array == NULL)
         return;
 
-    // loop through the node heap and the segments array
-    //    for each node, write the size and allocated in the segment
-    // "return" the values:
-    /*
-                    *segments = segs;
-                    *num_segments = pool_mgr->used_nodes;
-     */
-    node_pt firstNode = myPoolManager->node_heap;
-    for (int i = 0; i < myPoolManager->used_nodes; ++i) {
-        segments_array[i].size = firstNode->alloc_record.size;
-        segments_array[i].allocated = firstNode->allocated;
-        firstNode = firstNode->next;
-    }
+    // walk the whole list into the array and "return" the values
+    mem_pool_cursor(pool, &cursor);
+    *num_segments = mem_pool_cursor_fill(&cursor, segments_array, num_segs);
     *segments = segments_array;
-    *num_segments = myPoolManager->used_nodes;
 }
 
+void mem_pool_frag_stats(pool_pt pool, pool_frag_stats_pt stats) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
 
+    // the gap index is sorted ascending by size, so the largest gap is last;
+    // bitmap pools keep no gap index, only the bitmap
+    stats->num_gaps = pool->num_gaps;
+    if (pool->policy == BITMAP)
+        stats->largest_gap = _mem_bitmap_largest_run(myPoolManager) * MEM_POOL_BITMAP_BLOCK;
+    else
+        stats->largest_gap = (pool->num_gaps > 0) ? myPoolManager->gap_size[pool->num_gaps - 1] : 0;
+
+    // every byte not in an allocation is in a gap
+    stats->free_size = pool->total_size - pool->alloc_size;
+    stats->ext_frag = (stats->free_size > 0)
+                      ? 1.0 - (double) stats->largest_gap / (double) stats->free_size
+                      : 0.0;
+
+    stats->high_water = myPoolManager->high_water;
+}
 
-/***********************************/
-/*                                 */
-/* Definitions of static functions */
-/*                                 */
-/***********************************/
-static alloc_status _mem_resize_pool_store() {
-    //If the mem has to be expanded
-    if (((float) pool_store_size / pool_store_capacity)
-        > MEM_POOL_STORE_FILL_FACTOR) {
-        //First set the capacity to what it needs to be, then realloc for the new size.
-        pool_store_capacity = pool_store_capacity * MEM_EXPAND_FACTOR;
-        pool_store = realloc(pool_store, (pool_store_capacity * sizeof(pool_mgr_pt)));
+alloc_status mem_pool_stats(pool_pt pool, pool_stats_pt stats) {
+#ifdef MEM_POOL_STATS
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
 
-        //make sure the realloc worked.
-        if (pool_store = NULL)
-            return ALLOC_FAIL;
-        else
-            return ALLOC_OK;
-    }
-    else {
-        return ALLOC_OK;
-    }
+    *stats = myPoolManager->stats;
+    return ALLOC_OK;
+#else
+    (void) pool;
+    memset(stats, 0, sizeof(pool_stats_t));
+    return ALLOC_FAIL;
+#endif
 }
 
-static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
-    //If node_heap has to be expanded
-    if (((float) pool_mgr->used_nodes / pool_mgr->total_nodes)
-            > MEM_NODE_HEAP_FILL_FACTOR) {
-        //First set the total to what it needs to be, then realloc for new size.
-        pool_mgr->total_nodes = pool_mgr->total_nodes * MEM_NODE_HEAP_EXPAND_FACTOR;
-        pool_mgr->node_heap = realloc(pool_mgr->node_heap, (pool_mgr->total_nodes * sizeof(node_t)));
+alloc_status mem_pool_tag_stats(pool_pt pool, unsigned tag, pool_tag_stats_pt stats) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
 
-        //make sure the realloc worked.
-        if (pool_mgr->node_heap == NULL)
-            return ALLOC_FAIL;
-        else
-            return ALLOC_OK;
-    }
-    else {
-        return ALLOC_OK;
-    }
+    if (tag >= MEM_POOL_TAGS)
+        return ALLOC_FAIL;
+
+    *stats = myPoolManager->tags[tag];
+    return ALLOC_OK;
 }
 
-static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr) {
-    //If gap_ix has to be expanded
-    if (((float) pool_mgr->pool.num_gaps / pool_mgr->gap_ix_capacity)
-        > MEM_GAP_IX_FILL_FACTOR) {
-        //First set the capacity to what it needs to be, then realloc for new size.
-        pool_mgr->gap_ix_capacity = pool_mgr->gap_ix_capacity * MEM_GAP_IX_EXPAND_FACTOR;
-        pool_mgr->gap_ix = realloc(pool_mgr->gap_ix, (pool_mgr->gap_ix_capacity * sizeof(gap_t)));
+alloc_status mem_pool_latency_enable(pool_pt pool, unsigned sample_every) {
+#ifdef MEM_POOL_LATENCY
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
 
-        //make sure the realloc worked.
-        if (pool_mgr->gap_ix == NULL)
+    if (sample_every == 0)
+        return ALLOC_FAIL;
+
+    // allocate the histograms on first use, keep them when re-enabled
+    if (myPoolManager->latency == NULL) {
+        myPoolManager->latency = malloc(sizeof(pool_latency_t));
+        if (myPoolManager->latency == NULL)
             return ALLOC_FAIL;
-        else
-            return ALLOC_OK;
-    }
-    else {
-        return ALLOC_OK;
+        for (unsigned op = 0; op < MEM_LAT_NUM_OPS; ++op)
+            mem_hist_reset(&myPoolManager->latency->hist[op]);
     }
+
+    myPoolManager->latency->sample_every = sample_every;
+    myPoolManager->latency->countdown = sample_every;
+
+    return ALLOC_OK;
+#else
+    (void) pool;
+    (void) sample_every;
+    return ALLOC_FAIL;
+#endif
 }
 
-static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
-                                       size_t size,
-                                       node_pt node) {
+alloc_status mem_pool_latency_disable(pool_pt pool) {
+#ifdef MEM_POOL_LATENCY
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
 
-    // expand the gap index, if necessary (call the function)
-    //assert(_mem_resize_gap_ix(pool_mgr) == ALLOC_OK);
-    assert(_mem_resize_gap_ix(pool_mgr) == ALLOC_OK);
+    free(myPoolManager->latency);
+    myPoolManager->latency = NULL;
 
-    // add the entry at the end
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = size;
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = node;
+    return ALLOC_OK;
+#else
+    (void) pool;
+    return ALLOC_FAIL;
+#endif
+}
 
-    // update metadata (num_gaps)
-    pool_mgr->pool.num_gaps += 1;
+const mem_hist_t *mem_pool_latency(pool_pt pool, pool_latency_op op) {
+#ifdef MEM_POOL_LATENCY
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
 
-    // sort the gap index (call the function)
-    // check success
-    return _mem_sort_gap_ix(pool_mgr);
+    if (myPoolManager->latency == NULL || op >= MEM_LAT_NUM_OPS)
+        return NULL;
+
+    return &myPoolManager->latency->hist[op];
+#else
+    (void) pool;
+    (void) op;
+    return NULL;
+#endif
 }
 
-static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
-                                            size_t size,
-                                            node_pt node) {
-    // find the position of the node in the gap index
-    int position = -10;
-    for (int i = 0; i < pool_mgr->pool.num_gaps; ++i) {
-        if (pool_mgr->gap_ix[i].node == node) {
-            position = i;
-            break;
-        }
+void mem_pool_latency_dump(pool_pt pool, FILE *out) {
+    static const char *op_names[MEM_LAT_NUM_OPS] = {
+            "alloc", "del", "node_heap_resize", "gap_ix_resize"
+    };
+    double ns_per_tick = mem_hist_ns_per_tick();
+
+    for (unsigned op = 0; op < MEM_LAT_NUM_OPS; ++op) {
+        const mem_hist_t *hist = mem_pool_latency(pool, (pool_latency_op) op);
+        if (hist != NULL)
+            mem_hist_print(hist, out, op_names[op], ns_per_tick);
     }
+}
 
-    if (position == -1)
+alloc_status mem_pool_profile_start(pool_pt pool, size_t sample_bytes) {
+#ifdef MEM_POOL_PROFILE
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+
+    if (sample_bytes == 0)
         return ALLOC_FAIL;
+    if (myPoolManager->profile != NULL)
+        return ALLOC_CALLED_AGAIN;
 
-    // loop from there to the end of the array:
-    //    pull the entries (i.e. copy over) one position up
-    //    this effectively deletes the chosen node
-    while ( position < (pool_mgr->pool.num_gaps) ) {
-        pool_mgr->gap_ix[position].size = pool_mgr->gap_ix[position+1].size;
-        pool_mgr->gap_ix[position].node = pool_mgr->gap_ix[position+1].node;
-        ++position;
+    pool_profile_pt profile = calloc(1, sizeof(pool_profile_t));
+    if (profile == NULL)
+        return ALLOC_FAIL;
+
+    // backtrace() loads its unwinder on the first call, which allocates; get that out of the way
+    void *frame;
+    backtrace(&frame, 1);
+
+    profile->sample_bytes = sample_bytes;
+    profile->rng = (uint64_t) (uintptr_t) myPoolManager ^ mem_hist_ticks() ^ 0x9E3779B97F4A7C15ull;
+    if (profile->rng == 0)
+        profile->rng = 1;
+    profile->countdown = _mem_profile_interval(profile);
+    myPoolManager->profile = profile;
+
+    return ALLOC_OK;
+#else
+    (void) pool;
+    (void) sample_bytes;
+    return ALLOC_FAIL;
+#endif
+}
+
+alloc_status mem_pool_profile_stop(pool_pt pool) {
+#ifdef MEM_POOL_PROFILE
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+
+    if (myPoolManager->profile == NULL)
+        return ALLOC_CALLED_AGAIN;
+
+    _mem_profile_clear(myPoolManager->profile);
+    free(myPoolManager->profile->table);
+    free(myPoolManager->profile);
+    myPoolManager->profile = NULL;
+
+    return ALLOC_OK;
+#else
+    (void) pool;
+    return ALLOC_FAIL;
+#endif
+}
+
+alloc_status mem_pool_profile_dump(pool_pt pool, FILE *out, pool_profile_format format) {
+#ifdef MEM_POOL_PROFILE
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    pool_profile_pt profile = myPoolManager->profile;
+
+    if (profile == NULL)
+        return ALLOC_FAIL;
+
+    // the live samples, sorted so that equal stacks are next to each other
+    pool_sample_pt *samples = malloc((profile->num_live + 1) * sizeof(pool_sample_pt));
+    if (samples == NULL)
+        return ALLOC_FAIL;
+    unsigned num_samples = 0;
+    for (unsigned i = 0; i < profile->capacity; ++i)
+        if (profile->table[i] != NULL)
+            samples[num_samples++] = profile->table[i];
+    qsort(samples, num_samples, sizeof(pool_sample_pt), _mem_profile_cmp);
+
+    if (format == MEM_PROFILE_PPROF) {
+        // legacy heap profile text; pprof scales the raw samples back up by the rate
+        size_t total_size = 0;
+        for (unsigned i = 0; i < num_samples; ++i)
+            total_size += samples[i]->size;
+        fprintf(out, "heap profile: %u: %zu [%u: %zu] @ heap_v2/%zu\n",
+                num_samples, total_size, num_samples, total_size, profile->sample_bytes);
     }
 
-    // update metadata (num_gaps)
-    pool_mgr->pool.num_gaps = pool_mgr->pool.num_gaps - 1;
+    for (unsigned i = 0, j; i < num_samples; i = j) {
+        unsigned count = 0;
+        size_t size = 0;
+        double weighted_size = 0;
 
-    // zero out the element at position num_gaps!
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].size = 0;
-    pool_mgr->gap_ix[pool_mgr->pool.num_gaps].node = NULL;
+        for (j = i; j < num_samples && _mem_profile_cmp(&samples[i], &samples[j]) == 0; ++j) {
+            count += 1;
+            size += samples[j]->size;
+            weighted_size += samples[j]->size * _mem_profile_weight(profile, samples[j]->size);
+        }
+
+        pool_sample_pt sample = samples[i];
+        if (format == MEM_PROFILE_PPROF) {
+            fprintf(out, "%u: %zu [%u: %zu] @", count, size, count, size);
+            for (unsigned f = 0; f < sample->depth; ++f)
+                fprintf(out, " %p", sample->frames[f]);
+            fputc('\n', out);
+            continue;
+        }
+
+        // folded: the root frame first, the function name where there is a symbol, the estimated live bytes
+        char **symbols = backtrace_symbols(sample->frames, (int) sample->depth);
+        if (sample->depth == 0)
+            fputs("[unknown] ", out);
+        for (unsigned f = sample->depth; f-- > 0; ) {
+            const char *name = (symbols != NULL) ? strchr(symbols[f], '(') : NULL;
+            size_t length = (name != NULL) ? strcspn(name + 1, "+)") : 0;
+            if (length > 0)
+                fprintf(out, "%.*s", (int) length, name + 1);
+            else
+                fprintf(out, "%p", sample->frames[f]);
+            fputc((f > 0) ? ';' : ' ', out);
+        }
+        fprintf(out, "%.0f\n", weighted_size);
+        free(symbols);
+    }
+
+    // pprof symbolizes the addresses with the mappings
+    if (format == MEM_PROFILE_PPROF) {
+        FILE *maps = fopen("/proc/self/maps", "r");
+        fprintf(out, "\nMAPPED_LIBRARIES:\n");
+        if (maps != NULL) {
+            char buffer[4096];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), maps)) > 0)
+                fwrite(buffer, 1, n, out);
+            fclose(maps);
+        }
+    }
 
+    free(samples);
     return ALLOC_OK;
+#else
+    (void) pool;
+    (void) out;
+    (void) format;
+    return ALLOC_FAIL;
+#endif
 }
 
-// note: only called by _mem_add_to_gap_ix, which appends a single entry
-static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
-    // the new entry is at the end, so "bubble it up"
-    // loop from num_gaps - 1 until but not including 0:
+alloc_status mem_pool_guard_enable(pool_pt pool, unsigned sample_every, unsigned num_slots) {
+#ifdef MEM_POOL_GUARD
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
 
-    //zoot zoot bubble sort
-    for(int i = pool_mgr->pool.num_gaps -1; i > 0; --i) {
-        //    if the size of the current entry is less than the previous (u - 1)
-        if (pool_mgr->gap_ix[i].size <= pool_mgr->gap_ix[i-1].size) {
-            //    or if the sizes are the same but the current entry points to a
-            //    node with a lower address of pool allocation address (mem)
-            if (pool_mgr->gap_ix[i].size == pool_mgr->gap_ix[i-1].size) {
-                if (pool_mgr->gap_ix[i].node > pool_mgr->gap_ix[i-1].node)
-                    break;
-            }
-            //       swap them (by copying) (remember to use a temporary variable)
-            node_pt tmpNode = pool_mgr->gap_ix[i-1].node;
-            size_t tmpSize = pool_mgr->gap_ix[i-1].size;
+    if (sample_every == 0 || num_slots == 0 || num_slots >= MEM_ALLOC_ID_GUARD)
+        return ALLOC_FAIL;
+    if (myPoolManager->guard != NULL)
+        return ALLOC_CALLED_AGAIN;
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0)
+        return ALLOC_FAIL;
+
+    pool_guard_pt guard = calloc(1, sizeof(pool_guard_t) + num_slots * sizeof(guard_slot_t));
+    if (guard == NULL)
+        return ALLOC_FAIL;
 
-            pool_mgr->gap_ix[i-1].node = pool_mgr->gap_ix[i].node;
-            pool_mgr->gap_ix[i-1].size = pool_mgr->gap_ix[i].size;
+    // all of it inaccessible until a slot is handed out
+    guard->page_size = (size_t) page_size;
+    guard->map_size = (2 * (size_t) num_slots + 1) * guard->page_size;
+    guard->map = mmap(NULL, guard->map_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (guard->map == MAP_FAILED) {
+        free(guard);
+        return ALLOC_FAIL;
+    }
 
-            pool_mgr->gap_ix[i].node = tmpNode;
-            pool_mgr->gap_ix[i].size = tmpSize;
+    // the fault handler, again if someone else has taken SIGSEGV over since
+    struct sigaction action;
+    if (sigaction(SIGSEGV, NULL, &action) != 0
+        || !(action.sa_flags & SA_SIGINFO) || action.sa_sigaction != _mem_guard_fault) {
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = _mem_guard_fault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGSEGV, &action, &guard_prev_action) != 0) {
+            munmap(guard->map, guard->map_size);
+            free(guard);
+            return ALLOC_FAIL;
         }
-        else
+    }
+
+    // backtrace() loads its unwinder on the first call, which allocates; get that out of the way
+    void *frame;
+    backtrace(&frame, 1);
+
+    guard->num_slots = num_slots;
+    _mem_guard_init(guard);
+    guard->sample_every = sample_every;
+    guard->rng = (uint64_t) (uintptr_t) guard ^ mem_hist_ticks() ^ 0x9E3779B97F4A7C15ull;
+    if (guard->rng == 0)
+        guard->rng = 1;
+    guard->countdown = _mem_guard_interval(guard);
+    myPoolManager->guard = guard;
+
+    return ALLOC_OK;
+#else
+    (void) pool;
+    (void) sample_every;
+    (void) num_slots;
+    return ALLOC_FAIL;
+#endif
+}
+
+alloc_status mem_pool_guard_disable(pool_pt pool) {
+#ifdef MEM_POOL_GUARD
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    pool_guard_pt guard = myPoolManager->guard;
+
+    if (guard == NULL)
+        return ALLOC_CALLED_AGAIN;
+    if (guard->num_live > 0)
+        return ALLOC_NOT_FREED;
+
+    // the quarantine goes with the slots, the handler stays for the other pools
+    munmap(guard->map, guard->map_size);
+    free(guard);
+    myPoolManager->guard = NULL;
+
+    return ALLOC_OK;
+#else
+    (void) pool;
+    return ALLOC_FAIL;
+#endif
+}
+
+const char *mem_policy_name(alloc_policy policy) {
+    return ((unsigned) policy < num_policies) ? policy_table[policy].ops.name : NULL;
+}
+
+alloc_status mem_policy_from_name(const char *name, alloc_policy *policy) {
+    // policies are numbered from 0 with no holes
+    for (int p = 0; mem_policy_name((alloc_policy) p) != NULL; ++p) {
+        if (strcmp(mem_policy_name((alloc_policy) p), name) == 0) {
+            *policy = (alloc_policy) p;
+            return ALLOC_OK;
+        }
+    }
+
+    return ALLOC_FAIL;
+}
+
+alloc_status mem_policy_register(const pool_policy_ops_t *ops, alloc_policy *policy) {
+    alloc_policy existing;
+
+    // the name has to be new, since policies are looked up by it
+    if (ops->name == NULL || ops->find_gap == NULL
+        || mem_policy_from_name(ops->name, &existing) == ALLOC_OK)
+        return ALLOC_FAIL;
+    if (num_policies == MEM_POLICY_MAX)
+        return ALLOC_FAIL;
+
+    policy_table[num_policies].ops = *ops;
+    policy_table[num_policies].find_node = _mem_find_registered;
+    *policy = (alloc_policy) num_policies;
+    num_policies += 1;
+
+    return ALLOC_OK;
+}
+
+unsigned mem_alloc_id(pool_pt pool, alloc_pt alloc) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+
+    unsigned slot = GUARD_SLOT(myPoolManager, alloc);
+    if (slot != MEM_NODE_NONE)
+        return MEM_ALLOC_ID_GUARD | slot;
+
+    slab_pt slab = _mem_small_slab(myPoolManager, alloc);
+    if (slab != NULL)
+        return MEM_ALLOC_ID_SMALL | slab->ix << 6 | (unsigned) (alloc - slab->records);
+
+    return _mem_node_id(myPoolManager, alloc);
+}
+
+alloc_pt mem_alloc_from_id(pool_pt pool, unsigned id) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+
+    // small objects: the slab's index and the object's
+    if (id & MEM_ALLOC_ID_SMALL) {
+        pool_small_pt small = myPoolManager->small;
+        unsigned ix = (id & ~MEM_ALLOC_ID_SMALL) >> 6;
+        unsigned object = id & 63;
+
+        if (small == NULL || ix >= small->num_slabs || small->slabs[ix] == NULL
+            || object >= MEM_SLAB_OBJECTS || (small->slabs[ix]->free_mask >> object) & 1)
+            return NULL;
+
+        return &small->slabs[ix]->records[object];
+    }
+
+#ifdef MEM_POOL_GUARD
+    // guarded allocations: the slot's index
+    if ((id & MEM_ALLOC_ID_GUARD) && myPoolManager->guard != NULL) {
+        pool_guard_pt guard = myPoolManager->guard;
+        unsigned slot = id & ~MEM_ALLOC_ID_GUARD;
+
+        if (slot >= guard->num_slots || guard->slots[slot].state != MEM_GUARD_LIVE)
+            return NULL;
+
+        return &guard->slots[slot].record;
+    }
+#endif
+
+    // only live allocations have an id
+    if (id >= myPoolManager->node_hwm)
+        return NULL;
+
+    if ((myPoolManager->node_flags[id] & (MEM_NODE_USED | MEM_NODE_ALLOCATED))
+        != (MEM_NODE_USED | MEM_NODE_ALLOCATED))
+        return NULL;
+
+    return &myPoolManager->node_records[id];
+}
+
+alloc_status mem_pool_small_enable(pool_pt pool) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+
+    if (myPoolManager->small != NULL)
+        return ALLOC_CALLED_AGAIN;
+
+    // the slab table is allocated with the first slab
+    myPoolManager->small = calloc(1, sizeof(pool_small_t));
+    if (myPoolManager->small == NULL)
+        return ALLOC_FAIL;
+
+    return ALLOC_OK;
+}
+
+alloc_status mem_alloc_pin(pool_pt pool, alloc_pt alloc) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    unsigned node = _mem_alloc_node(myPoolManager, alloc);
+
+    if (node == MEM_NODE_NONE)
+        return ALLOC_FAIL;
+
+    myPoolManager->node_flags[node] |= MEM_NODE_PINNED;
+    return ALLOC_OK;
+}
+
+alloc_status mem_alloc_unpin(pool_pt pool, alloc_pt alloc) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    unsigned node = _mem_alloc_node(myPoolManager, alloc);
+
+    if (node == MEM_NODE_NONE)
+        return ALLOC_FAIL;
+
+    myPoolManager->node_flags[node] &= ~MEM_NODE_PINNED;
+    return ALLOC_OK;
+}
+
+alloc_status mem_pool_compact(pool_pt pool, mem_move_fn move_cb, void *ctx, size_t budget) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    alloc_status status = ALLOC_OK;
+    size_t moved = 0;
+
+    // a BITMAP pool keeps no address-ordered list to slide the allocations along
+    if (pool->policy == BITMAP)
+        return ALLOC_FAIL;
+
+    // one pass in address order: every gap followed by a movable allocation
+    // trades places with it, so the gap travels up, swallowing the gaps it meets,
+    // until it hits a pinned allocation or the end of the pool
+    uint32_t *next = myPoolManager->node_next;
+    uint32_t *prev = myPoolManager->node_prev;
+    uint8_t *flags = myPoolManager->node_flags;
+    unsigned gap = myPoolManager->head;
+    while (gap != MEM_NODE_NONE) {
+        unsigned alloc = next[gap];
+
+        if ((flags[gap] & MEM_NODE_ALLOCATED) || alloc == MEM_NODE_NONE || (flags[alloc] & MEM_NODE_PINNED)) {
+            gap = next[gap];
+            continue;
+        }
+
+        // the records stay put, merging only releases nodes and grows the gap index
+        alloc_pt gapRecord = &myPoolManager->node_records[gap];
+        alloc_pt allocRecord = &myPoolManager->node_records[alloc];
+
+        // always make progress, even on an allocation bigger than the budget
+        if (budget > 0 && moved > 0 && moved + allocRecord->size > budget) {
+            status = ALLOC_PARTIAL;
             break;
+        }
+
+        // slide the data down to the start of the gap (they may overlap)
+        char *old_mem = allocRecord->mem;
+        memmove(gapRecord->mem, old_mem, allocRecord->size);
+        allocRecord->mem = gapRecord->mem;
+        gapRecord->mem = allocRecord->mem + allocRecord->size;
+        moved += allocRecord->size;
+        STAT_INC(myPoolManager, num_moves);
+
+        // swap the two in the list: prev, gap, alloc, next -> prev, alloc, gap, next
+        prev[alloc] = prev[gap];
+        if (prev[gap] != MEM_NODE_NONE)
+            next[prev[gap]] = alloc;
+        else
+            myPoolManager->head = alloc;
+        next[gap] = next[alloc];
+        if (next[alloc] != MEM_NODE_NONE)
+            prev[next[alloc]] = gap;
+        next[alloc] = gap;
+        prev[gap] = alloc;
+
+        // the gap keeps its size and node, so its index entry only changes on a merge
+        if (next[gap] != MEM_NODE_NONE && !(flags[next[gap]] & MEM_NODE_ALLOCATED)) {
+            if (_mem_remove_from_gap_ix(myPoolManager, gapRecord->size, gap) != ALLOC_OK
+                || _mem_merge_next_gap(myPoolManager, gap) != ALLOC_OK
+                || _mem_add_to_gap_ix(myPoolManager, gapRecord->size, gap) != ALLOC_OK)
+                return ALLOC_FAIL;
+        }
+
+        // the owner fixes up any raw pointers, the record is already up to date
+        if (move_cb != NULL)
+            move_cb(allocRecord, old_mem, ctx);
+    }
+
+#ifdef MEM_POOL_STATS
+    myPoolManager->stats.bytes_moved += moved;
+#endif
+    TRACE(myPoolManager, MEM_TRACE_COMPACT, budget, MEM_TRACE_NO_HANDLE, status);
+
+    return status;
+}
+
+alloc_status mem_pool_snapshot(pool_pt pool, int fd, int with_data) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    pool_snapshot_header_t header;
+
+    // slab metadata lives outside the node heap and is not saved
+    if (myPoolManager->small != NULL)
+        return ALLOC_FAIL;
+#ifdef MEM_POOL_GUARD
+    // nor do guarded allocations live in the pool
+    if (myPoolManager->guard != NULL && myPoolManager->guard->num_live > 0)
+        return ALLOC_FAIL;
+#endif
+
+    memset(&header, 0, sizeof(header));
+    header.magic = MEM_SNAPSHOT_MAGIC;
+    header.version = MEM_SNAPSHOT_VERSION;
+    strncpy(header.policy, mem_policy_name(pool->policy), sizeof(header.policy) - 1);
+    header.total_size = pool->total_size;
+    header.alloc_size = pool->alloc_size;
+    header.high_water = myPoolManager->high_water;
+    header.num_allocs = pool->num_allocs;
+    header.num_gaps = pool->num_gaps;
+    header.total_nodes = myPoolManager->total_nodes;
+    header.used_nodes = myPoolManager->used_nodes;
+    header.node_hwm = myPoolManager->node_hwm;
+    header.head = myPoolManager->head;
+    header.unused_nodes = myPoolManager->unused_nodes;
+    header.gap_ix_capacity = myPoolManager->gap_ix_capacity;
+    header.flags = with_data ? MEM_SNAPSHOT_DATA : 0;
+
+    // one sequential stream: header, metadata, contents
+    if (_mem_write_all(fd, &header, sizeof(header)) != ALLOC_OK
+        || _mem_snapshot_metadata(myPoolManager, fd) != ALLOC_OK)
+        return ALLOC_FAIL;
+    if (with_data && _mem_write_all(fd, pool->mem, pool->total_size) != ALLOC_OK)
+        return ALLOC_FAIL;
+
+    return ALLOC_OK;
+}
+
+pool_pt mem_pool_restore(int fd) {
+    pool_snapshot_header_t header;
+    alloc_policy policy;
+
+    if (_mem_read_all(fd, &header, sizeof(header)) != ALLOC_OK
+        || header.magic != MEM_SNAPSHOT_MAGIC || header.version != MEM_SNAPSHOT_VERSION)
+        return NULL;
+
+    // the counts have to fit the capacities they came with
+    header.policy[sizeof(header.policy) - 1] = '\0';
+    if (mem_policy_from_name(header.policy, &policy) != ALLOC_OK
+        || header.node_hwm > header.total_nodes || header.used_nodes > header.node_hwm
+        || (policy != BITMAP && header.num_gaps > header.gap_ix_capacity) || header.total_size > SIZE_MAX
+        || header.total_nodes == 0 || header.gap_ix_capacity == 0)
+        return NULL;
+
+    // a fresh pool of the same size and policy, then the metadata on top
+    pool_pt pool = mem_pool_open((size_t) header.total_size, policy);
+    if (pool == NULL)
+        return NULL;
+
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+    if (pool->total_size != header.total_size
+        || _mem_restore_metadata(myPoolManager, fd, &header) != ALLOC_OK
+        || ((header.flags & MEM_SNAPSHOT_DATA)
+            && _mem_read_all(fd, pool->mem, pool->total_size) != ALLOC_OK)) {
+        mem_pool_close_force(pool);
+        return NULL;
     }
 
+    return pool;
+}
+
+alloc_status mem_pool_trace_start(pool_pt pool, unsigned capacity, FILE *sink) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+
+    // capacity has to be a power of two so the ring index is a mask
+    if (myPoolManager->trace != NULL || sink == NULL
+        || capacity == 0 || (capacity & (capacity - 1)) != 0)
+        return ALLOC_FAIL;
+
+    pool_trace_pt trace = malloc(sizeof(pool_trace_t) + capacity * sizeof(pool_trace_record_t));
+    if (trace == NULL)
+        return ALLOC_FAIL;
+
+    trace->sink = sink;
+    trace->capacity = capacity;
+    atomic_init(&trace->head, 0);
+    atomic_init(&trace->tail, 0);
+    atomic_init(&trace->dropped, 0);
+    myPoolManager->trace = trace;
+
+    // the trace starts with the pool as it is now
+    TRACE(myPoolManager, MEM_TRACE_OPEN, pool->total_size, pool->policy, ALLOC_OK);
+
     return ALLOC_OK;
 }
 
+alloc_status mem_pool_trace_flush(pool_pt pool) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+
+    if (myPoolManager->trace == NULL)
+        return ALLOC_FAIL;
+
+    return _mem_trace_drain(myPoolManager);
+}
+
+alloc_status mem_pool_trace_stop(pool_pt pool) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+
+    if (myPoolManager->trace == NULL)
+        return ALLOC_FAIL;
+
+    alloc_status status = _mem_trace_drain(myPoolManager);
+    fflush(myPoolManager->trace->sink);
+
+    free(myPoolManager->trace);
+    myPoolManager->trace = NULL;
+
+    return status;
+}
+
+unsigned long long mem_pool_trace_dropped(pool_pt pool) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+
+    if (myPoolManager->trace == NULL)
+        return 0;
+
+    return atomic_load_explicit(&myPoolManager->trace->dropped, memory_order_relaxed);
+}
+
+void mem_pool_cursor(pool_pt pool, pool_cursor_pt cursor) {
+    mem_pool_cursor_range(pool, cursor, 0, pool->total_size);
+}
+
+void mem_pool_cursor_range(pool_pt pool, pool_cursor_pt cursor, size_t start, size_t end) {
+    // get the mgr from the pool
+    pool_mgr_pt myPoolManager = (pool_mgr_pt) pool;
+
+    cursor->pool = pool;
+    cursor->offset = 0;
+    cursor->end = end;
+
+    // if BITMAP, the cursor walks blocks from the start of the segment holding start
+    if (pool->policy == BITMAP) {
+        size_t block = start / MEM_POOL_BITMAP_BLOCK;
+        cursor->next = (block < myPoolManager->bitmap_blocks)
+                       ? (unsigned) _mem_bitmap_segment_start(myPoolManager, block)
+                       : MEM_NODE_NONE;
+        return;
+    }
+
+    // skip the segments which end at or before start
+    unsigned node = myPoolManager->head;
+    while (node != MEM_NODE_NONE
+           && (size_t) (myPoolManager->node_records[node].mem - pool->mem)
+              + myPoolManager->node_records[node].size <= start) {
+        node = myPoolManager->node_next[node];
+    }
+
+    cursor->next = node;
+}
+
+int mem_pool_cursor_next(pool_cursor_pt cursor, pool_segment_pt segment) {
+    const pool_mgr_t *myPoolManager = (const pool_mgr_t *) cursor->pool;
+    unsigned node = cursor->next;
+
+    // check for the end of the list or of the range
+    if (node == MEM_NODE_NONE)
+        return 0;
+
+    // if BITMAP, a segment is an allocation up to the next start bit, or a run of clear bits
+    if (cursor->pool->policy == BITMAP) {
+        size_t offset = (size_t) node * MEM_POOL_BITMAP_BLOCK;
+        if (offset >= cursor->end) {
+            cursor->next = MEM_NODE_NONE;
+            return 0;
+        }
+
+        int allocated = _mem_bitmap_test(myPoolManager->bitmap_used, node);
+        size_t block = node + 1;
+        while (block < myPoolManager->bitmap_blocks
+               && _mem_bitmap_test(myPoolManager->bitmap_used, block) == allocated
+               && !_mem_bitmap_test(myPoolManager->bitmap_start, block))
+            ++block;
+
+        segment->size = (block - node) * MEM_POOL_BITMAP_BLOCK;
+        segment->allocated = (unsigned long) allocated;
+        cursor->offset = offset;
+        cursor->next = (block < myPoolManager->bitmap_blocks) ? (unsigned) block : MEM_NODE_NONE;
+        return 1;
+    }
+
+    size_t offset = (size_t) (myPoolManager->node_records[node].mem - cursor->pool->mem);
+    if (offset >= cursor->end) {
+        cursor->next = MEM_NODE_NONE;
+        return 0;
+    }
+
+    // write the size and allocated in the segment and advance
+    segment->size = myPoolManager->node_records[node].size;
+    segment->allocated = (myPoolManager->node_flags[node] & MEM_NODE_ALLOCATED) ? 1 : 0;
+    cursor->offset = offset;
+    cursor->next = myPoolManager->node_next[node];
+
+    return 1;
+}
+
+unsigned mem_pool_cursor_fill(pool_cursor_pt cursor, pool_segment_pt segments, unsigned capacity) {
+    unsigned num_segments = 0;
+
+    while (num_segments < capacity
+           && mem_pool_cursor_next(cursor, &segments[num_segments])) {
+        ++num_segments;
+    }
+
+    return num_segments;
+}
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+static alloc_status _mem_resize_pool_store() {
+    //If the mem has to be expanded
+    if (((float) pool_store_size / pool_store_capacity)
+        > MEM_POOL_STORE_FILL_FACTOR) {
+        //realloc for the new size, keeping the old store if it fails.
+        unsigned capacity = pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR;
+        pool_mgr_pt *store = realloc(pool_store, (capacity * sizeof(pool_mgr_pt)));
 
+        //make sure the realloc worked.
+        if (store == NULL)
+            return ALLOC_FAIL;
+
+        pool_store = store;
+        pool_store_capacity = capacity;
+        return ALLOC_OK;
+    }
+    //If most of it went unused as pools were closed, give half of it back
+    else if (pool_store_capacity > MEM_POOL_STORE_INIT_CAPACITY
+             && ((float) pool_store_size / pool_store_capacity) < MEM_POOL_STORE_SHRINK_FACTOR) {
+        unsigned capacity = pool_store_capacity / MEM_POOL_STORE_EXPAND_FACTOR;
+        if (capacity < MEM_POOL_STORE_INIT_CAPACITY)
+            capacity = MEM_POOL_STORE_INIT_CAPACITY;
+        pool_mgr_pt *store = realloc(pool_store, (capacity * sizeof(pool_mgr_pt)));
+
+        // keeping the bigger store is harmless
+        if (store != NULL) {
+            pool_store = store;
+            pool_store_capacity = capacity;
+        }
+        return ALLOC_OK;
+    }
+    else {
+        return ALLOC_OK;
+    }
+}
+
+static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
+    //If it is mostly unused since the last resize, give half of it back
+    //(the records only move here, as they do when it grows)
+    if (pool_mgr->total_nodes > pool_mgr->node_tuning.init_capacity
+        && pool_mgr->used_nodes < pool_mgr->node_shrink_at) {
+#ifdef MEM_POOL_LATENCY
+        unsigned long long t0 = mem_hist_ticks();
+#endif
+
+        //the nodes in use at the top of the heap may not allow it, then wait for usage to halve again
+        if (_mem_shrink_node_heap(pool_mgr, pool_mgr->total_nodes / pool_mgr->node_tuning.expand_factor) != ALLOC_OK) {
+            pool_mgr->node_shrink_at = pool_mgr->used_nodes / 2;
+            return ALLOC_OK;
+        }
+        STAT_INC(pool_mgr, node_heap_resizes);
+
+#ifdef MEM_POOL_LATENCY
+        if (pool_mgr->latency != NULL)
+            LATENCY_RECORD(pool_mgr, MEM_LAT_NODE_HEAP_RESIZE, t0);
+#endif
+
+        return ALLOC_OK;
+    }
+    //If node_heap has to be expanded
+    else if (((float) pool_mgr->used_nodes / pool_mgr->total_nodes)
+            > pool_mgr->node_tuning.fill_factor) {
+#ifdef MEM_POOL_LATENCY
+        unsigned long long t0 = mem_hist_ticks();
+#endif
+
+        //realloc for the new size, keeping the old heap if it fails.
+        if (_mem_realloc_node_heap(pool_mgr, pool_mgr->total_nodes * pool_mgr->node_tuning.expand_factor) != ALLOC_OK)
+            return ALLOC_FAIL;
+        STAT_INC(pool_mgr, node_heap_resizes);
+
+#ifdef MEM_POOL_LATENCY
+        if (pool_mgr->latency != NULL)
+            LATENCY_RECORD(pool_mgr, MEM_LAT_NODE_HEAP_RESIZE, t0);
+#endif
+
+        return ALLOC_OK;
+    }
+    else {
+        return ALLOC_OK;
+    }
+}
+
+static alloc_status _mem_resize_gap_ix(pool_mgr_pt pool_mgr) {
+    //If gap_ix has to be expanded
+    if (((float) pool_mgr->pool.num_gaps / pool_mgr->gap_ix_capacity)
+        > pool_mgr->gap_ix_tuning.fill_factor) {
+#ifdef MEM_POOL_LATENCY
+        unsigned long long t0 = mem_hist_ticks();
+#endif
+
+        //realloc for the new size, keeping the old index if it fails.
+        if (_mem_realloc_gap_ix(pool_mgr, pool_mgr->gap_ix_capacity * pool_mgr->gap_ix_tuning.expand_factor) != ALLOC_OK)
+            return ALLOC_FAIL;
+        STAT_INC(pool_mgr, gap_ix_resizes);
+
+#ifdef MEM_POOL_LATENCY
+        if (pool_mgr->latency != NULL)
+            LATENCY_RECORD(pool_mgr, MEM_LAT_GAP_IX_RESIZE, t0);
+#endif
+
+        return ALLOC_OK;
+    }
+    //If it is mostly unused, give half of it back; the entries are packed at the front
+    else if (pool_mgr->gap_ix_capacity > pool_mgr->gap_ix_tuning.init_capacity
+             && ((float) pool_mgr->pool.num_gaps / pool_mgr->gap_ix_capacity) < pool_mgr->gap_ix_tuning.shrink_factor) {
+        unsigned capacity = pool_mgr->gap_ix_capacity / pool_mgr->gap_ix_tuning.expand_factor;
+        if (capacity < pool_mgr->gap_ix_tuning.init_capacity)
+            capacity = pool_mgr->gap_ix_tuning.init_capacity;
+
+        //a failure still leaves room for the entries, so it is not one
+        if (_mem_realloc_gap_ix(pool_mgr, capacity) == ALLOC_OK)
+            STAT_INC(pool_mgr, gap_ix_resizes);
+        return ALLOC_OK;
+    }
+    else {
+        return ALLOC_OK;
+    }
+}
+
+// note: the links are indices, so nothing has to follow the arrays if they move
+static alloc_status _mem_realloc_node_heap(pool_mgr_pt pool_mgr, unsigned total_nodes) {
+    alloc_pt records = realloc(pool_mgr->node_records, total_nodes * sizeof(alloc_t));
+    uint32_t *next = NULL, *prev = NULL;
+    uint8_t *flags = NULL;
+
+    // every array that was reallocated is kept, so whatever fails,
+    // all of them hold at least the smaller of the two sizes
+    if (records != NULL) {
+        pool_mgr->node_records = records;
+        next = realloc(pool_mgr->node_next, total_nodes * sizeof(uint32_t));
+    }
+    if (next != NULL) {
+        pool_mgr->node_next = next;
+        prev = realloc(pool_mgr->node_prev, total_nodes * sizeof(uint32_t));
+    }
+    if (prev != NULL) {
+        pool_mgr->node_prev = prev;
+        flags = realloc(pool_mgr->node_flags, total_nodes * sizeof(uint8_t));
+    }
+    if (flags == NULL) {
+        if (total_nodes < pool_mgr->total_nodes)
+            pool_mgr->total_nodes = total_nodes;
+        return ALLOC_FAIL;
+    }
+    pool_mgr->node_flags = flags;
+    pool_mgr->total_nodes = total_nodes;
+    pool_mgr->node_shrink_at = (unsigned) (total_nodes * pool_mgr->node_tuning.shrink_factor);
+
+    return ALLOC_OK;
+}
+
+// shrink to total_nodes, or as close to it as the highest node in use allows, not below the initial capacity;
+// ALLOC_FAIL if that would not make the heap smaller
+static alloc_status _mem_shrink_node_heap(pool_mgr_pt pool_mgr, unsigned total_nodes) {
+    // node ids are stable, so only the unused nodes on top can go
+    unsigned hwm = pool_mgr->node_hwm;
+    while (hwm > 0 && pool_mgr->node_flags[hwm - 1] == 0)
+        --hwm;
+
+    if (total_nodes < hwm)
+        total_nodes = hwm;
+    if (total_nodes < pool_mgr->node_tuning.init_capacity)
+        total_nodes = pool_mgr->node_tuning.init_capacity;
+    if (total_nodes >= pool_mgr->total_nodes)
+        return ALLOC_FAIL;
+
+    // rechain the unused nodes left below the new top, lowest first,
+    // so that the top of the heap empties out sooner next time
+    pool_mgr->node_hwm = hwm;
+    pool_mgr->unused_nodes = MEM_NODE_NONE;
+    while (hwm-- > 0) {
+        if (pool_mgr->node_flags[hwm] == 0) {
+            pool_mgr->node_next[hwm] = pool_mgr->unused_nodes;
+            pool_mgr->unused_nodes = hwm;
+        }
+    }
+
+    // a failed realloc keeps the smaller size, which is all that is needed
+    _mem_realloc_node_heap(pool_mgr, total_nodes);
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_realloc_gap_ix(pool_mgr_pt pool_mgr, unsigned capacity) {
+    size_t *gap_size = realloc(pool_mgr->gap_size, capacity * sizeof(size_t));
+    uint32_t *gap_node = NULL;
+
+    // as for the node heap, a failure leaves the smaller of the two sizes
+    if (gap_size != NULL) {
+        pool_mgr->gap_size = gap_size;
+        gap_node = realloc(pool_mgr->gap_node, capacity * sizeof(uint32_t));
+    }
+    if (gap_node == NULL) {
+        if (capacity < pool_mgr->gap_ix_capacity)
+            pool_mgr->gap_ix_capacity = capacity;
+        return ALLOC_FAIL;
+    }
+    pool_mgr->gap_node = gap_node;
+    pool_mgr->gap_ix_capacity = capacity;
+
+    return ALLOC_OK;
+}
+
+// the config's factors where set, the defaults elsewhere, and an initial capacity which holds
+// entries within the fill factor; ALLOC_FAIL if the shrink and growth would chase each other
+static alloc_status _mem_tuning(const pool_config_t *config,
+                                const pool_tuning_t *defaults,
+                                double entries,
+                                pool_tuning_t *tuning) {
+    *tuning = *defaults;
+    if (config->fill_factor != 0)
+        tuning->fill_factor = config->fill_factor;
+    if (config->expand_factor != 0)
+        tuning->expand_factor = config->expand_factor;
+    if (config->shrink_factor != 0)
+        tuning->shrink_factor = (config->shrink_factor > 0) ? config->shrink_factor : 0;
+    else if (tuning->shrink_factor * tuning->expand_factor >= tuning->fill_factor)
+        tuning->shrink_factor = tuning->fill_factor / (2 * tuning->expand_factor);
+
+    if (!(tuning->fill_factor > 0 && tuning->fill_factor <= 1) || tuning->expand_factor < 2
+        || tuning->shrink_factor * tuning->expand_factor >= tuning->fill_factor)
+        return ALLOC_FAIL;
+
+    // node indices are 32-bit, and MEM_NODE_NONE is taken
+    double hinted = entries / tuning->fill_factor + 1;
+    if (hinted >= (double) MEM_NODE_NONE)
+        return ALLOC_FAIL;
+    if ((unsigned) hinted > tuning->init_capacity)
+        tuning->init_capacity = (unsigned) hinted;
+
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
+                                       size_t size,
+                                       unsigned node) {
+
+    // expand the gap index, if necessary (call the function)
+    // (not inside assert(), which compiles away with NDEBUG)
+    if (_mem_resize_gap_ix(pool_mgr) != ALLOC_OK)
+        return ALLOC_FAIL;
+
+    // add the entry at the end
+    pool_mgr->gap_size[pool_mgr->pool.num_gaps] = size;
+    pool_mgr->gap_node[pool_mgr->pool.num_gaps] = node;
+
+    // update metadata (num_gaps)
+    pool_mgr->pool.num_gaps += 1;
+
+    // sort the gap index (call the function)
+    // check success
+    return _mem_sort_gap_ix(pool_mgr);
+}
+
+static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
+                                            size_t size,
+                                            unsigned node) {
+    // find the position of the node in the gap index
+    int position = -1;
+    for (int i = 0; i < pool_mgr->pool.num_gaps; ++i) {
+        if (pool_mgr->gap_node[i] == node) {
+            position = i;
+            break;
+        }
+    }
+
+    if (position == -1)
+        return ALLOC_FAIL;
+
+    // loop from there to the end of the array:
+    //    pull the entries (i.e. copy over) one position up
+    //    this effectively deletes the chosen node
+    while ( position < (pool_mgr->pool.num_gaps - 1) ) {
+        pool_mgr->gap_size[position] = pool_mgr->gap_size[position+1];
+        pool_mgr->gap_node[position] = pool_mgr->gap_node[position+1];
+        ++position;
+    }
+
+    // update metadata (num_gaps)
+    pool_mgr->pool.num_gaps = pool_mgr->pool.num_gaps - 1;
+
+    // zero out the element at position num_gaps!
+    pool_mgr->gap_size[pool_mgr->pool.num_gaps] = 0;
+    pool_mgr->gap_node[pool_mgr->pool.num_gaps] = MEM_NODE_NONE;
+
+    return ALLOC_OK;
+}
+
+// note: only called by _mem_add_to_gap_ix, which appends a single entry
+static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
+    // the new entry is at the end, so "bubble it up"
+    // loop from num_gaps - 1 until but not including 0:
+
+    //zoot zoot bubble sort
+    for(int i = pool_mgr->pool.num_gaps -1; i > 0; --i) {
+        //    if the size of the current entry is less than the previous (u - 1)
+        if (pool_mgr->gap_size[i] <= pool_mgr->gap_size[i-1]) {
+            //    or if the sizes are the same but the current entry points to a
+            //    node with a lower index in the node heap
+            if (pool_mgr->gap_size[i] == pool_mgr->gap_size[i-1]) {
+                if (pool_mgr->gap_node[i] > pool_mgr->gap_node[i-1])
+                    break;
+            }
+            //       swap them (by copying) (remember to use a temporary variable)
+            uint32_t tmpNode = pool_mgr->gap_node[i-1];
+            size_t tmpSize = pool_mgr->gap_size[i-1];
+
+            pool_mgr->gap_node[i-1] = pool_mgr->gap_node[i];
+            pool_mgr->gap_size[i-1] = pool_mgr->gap_size[i];
+
+            pool_mgr->gap_node[i] = tmpNode;
+            pool_mgr->gap_size[i] = tmpSize;
+        }
+        else
+            break;
+    }
+
+    return ALLOC_OK;
+}
+
+static void _mem_tag_alloc(pool_mgr_pt pool_mgr, unsigned tag, size_t size) {
+    pool_tag_stats_pt stats = &pool_mgr->tags[tag];
+
+    stats->live_bytes += size;
+    stats->live_count += 1;
+    if (stats->live_bytes > stats->peak_bytes)
+        stats->peak_bytes = stats->live_bytes;
+}
+
+static void _mem_tag_del(pool_mgr_pt pool_mgr, unsigned tag, size_t size) {
+    pool_mgr->tags[tag].live_bytes -= size;
+    pool_mgr->tags[tag].live_count -= 1;
+}
+
+// live usage from the node flags, peaks from there on (a restored pool)
+static void _mem_tag_recount(pool_mgr_pt pool_mgr) {
+    memset(pool_mgr->tags, 0, sizeof(pool_mgr->tags));
+    for (unsigned node = 0; node < pool_mgr->node_hwm; ++node) {
+        uint8_t flags = pool_mgr->node_flags[node];
+        if ((flags & (MEM_NODE_USED | MEM_NODE_ALLOCATED)) != (MEM_NODE_USED | MEM_NODE_ALLOCATED))
+            continue;
+
+        size_t size = pool_mgr->node_records[node].size;
+        if (pool_mgr->pool.policy == BITMAP)
+            size = ((size > 0) ? (size + MEM_POOL_BITMAP_BLOCK - 1) / MEM_POOL_BITMAP_BLOCK : 1)
+                   * MEM_POOL_BITMAP_BLOCK;
+        _mem_tag_alloc(pool_mgr, MEM_NODE_TAG(flags), size);
+    }
+}
+
+static unsigned _mem_get_unused_node(pool_mgr_pt pool_mgr) {
+    unsigned node = MEM_NODE_NONE;
+
+    // reuse a released node first, otherwise take a fresh one off the top
+    if (pool_mgr->unused_nodes != MEM_NODE_NONE) {
+        node = pool_mgr->unused_nodes;
+        pool_mgr->unused_nodes = pool_mgr->node_next[node];
+    }
+    else if (pool_mgr->node_hwm < pool_mgr->total_nodes) {
+        node = pool_mgr->node_hwm;
+        pool_mgr->node_hwm += 1;
+    }
+    else {
+        return MEM_NODE_NONE;
+    }
+
+    pool_mgr->node_flags[node] = MEM_NODE_USED;
+    pool_mgr->node_next[node] = MEM_NODE_NONE;
+    pool_mgr->node_prev[node] = MEM_NODE_NONE;
+
+    // update metadata (used_nodes)
+    pool_mgr->used_nodes += 1;
+
+    return node;
+}
+
+static void _mem_put_unused_node(pool_mgr_pt pool_mgr, unsigned node) {
+    pool_mgr->node_flags[node] = 0;
+    pool_mgr->node_prev[node] = MEM_NODE_NONE;
+    pool_mgr->node_next[node] = pool_mgr->unused_nodes;
+    pool_mgr->unused_nodes = node;
+
+    // update metadata (used_nodes)
+    pool_mgr->used_nodes -= 1;
+}
+
+// note: expects pool.mem, pool.total_size and the heap/index capacities to be set
+static void _mem_init_pool_mgr(pool_mgr_pt pool_mgr) {
+    // the top node is a single gap spanning the whole pool
+    pool_mgr->node_records[0].mem = pool_mgr->pool.mem;
+    pool_mgr->node_records[0].size = pool_mgr->pool.total_size;
+    pool_mgr->node_flags[0] = MEM_NODE_USED;
+    pool_mgr->node_next[0] = MEM_NODE_NONE;
+    pool_mgr->node_prev[0] = MEM_NODE_NONE;
+    pool_mgr->head = 0;
+
+    pool_mgr->used_nodes = 1;
+    pool_mgr->node_hwm = 1;
+    pool_mgr->unused_nodes = MEM_NODE_NONE;
+
+    // the gap index holds just the top node
+    pool_mgr->gap_size[0] = pool_mgr->pool.total_size;
+    pool_mgr->gap_node[0] = 0;
+
+    pool_mgr->pool.alloc_size = 0;
+    pool_mgr->pool.num_allocs = 0;
+    pool_mgr->pool.num_gaps = 1;
+    pool_mgr->high_water = 0;
+    memset(pool_mgr->tags, 0, sizeof(pool_mgr->tags));
+
+    // a BITMAP pool keeps no gap nodes, its single gap is all clear bits
+    if (pool_mgr->pool.policy == BITMAP)
+        _mem_bitmap_init(pool_mgr);
+}
+
+static void _mem_release_pool_mgr(pool_mgr_pt pool_mgr) {
+    // free memory pool, or give the block of a sub-pool back to its parent
+    if (pool_mgr->parent == NULL) {
+        free(pool_mgr->pool.mem);
+    }
+    else {
+        pool_pt parent = &pool_mgr->parent->pool;
+        mem_del_alloc(parent, mem_alloc_from_id(parent, pool_mgr->parent_block));
+        pool_mgr->parent->num_subpools -= 1;
+    }
+    // free node heap
+    free(pool_mgr->node_records);
+    free(pool_mgr->node_next);
+    free(pool_mgr->node_prev);
+    free(pool_mgr->node_flags);
+    // free gap index
+    free(pool_mgr->gap_size);
+    free(pool_mgr->gap_node);
+    // free the bitmaps
+    free(pool_mgr->bitmap_used);
+    free(pool_mgr->bitmap_start);
+#ifdef MEM_POOL_LATENCY
+    free(pool_mgr->latency);
+#endif
+    // free the samples
+    mem_pool_profile_stop(&pool_mgr->pool);
+#ifdef MEM_POOL_GUARD
+    // free the guard slots, live or not
+    if (pool_mgr->guard != NULL) {
+        munmap(pool_mgr->guard->map, pool_mgr->guard->map_size);
+        free(pool_mgr->guard);
+        pool_mgr->guard = NULL;
+    }
+#endif
+    // free the slab metadata, the slabs went with the pool
+    if (pool_mgr->small != NULL) {
+        _mem_small_discard(pool_mgr);
+        free(pool_mgr->small->slabs);
+        free(pool_mgr->small->free_ix);
+        free(pool_mgr->small->by_addr);
+        free(pool_mgr->small);
+    }
+    // flush and free the trace ring
+    mem_pool_trace_stop(&pool_mgr->pool);
+    // find mgr in pool store and move the last pool into its slot
+    for (unsigned i = 0; i < pool_store_size; i++) {
+        if (pool_store[i] == pool_mgr) {
+            pool_store_size = pool_store_size - 1;
+            pool_store[i] = pool_store[pool_store_size];
+            pool_store[pool_store_size] = NULL;
+            break;
+        }
+    }
+    _mem_resize_pool_store();
+
+    // free mgr
+    free(pool_mgr);
+}
+
+// the node of a live allocation, or MEM_NODE_NONE if alloc is not one
+// (the handle points into the node records, so a bounds check is enough)
+static unsigned _mem_alloc_node(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    unsigned node = _mem_node_id(pool_mgr, alloc);
+
+    if (node != MEM_TRACE_NO_HANDLE
+        && (pool_mgr->node_flags[node] & (MEM_NODE_USED | MEM_NODE_ALLOCATED))
+           == (MEM_NODE_USED | MEM_NODE_ALLOCATED)) {
+        return node;
+    }
+
+    return MEM_NODE_NONE;
+}
+
+// note: node is a gap which is not in the gap index
+static alloc_status _mem_merge_next_gap(pool_mgr_pt pool_mgr, unsigned node) {
+    unsigned nextNode = pool_mgr->node_next[node];
+
+    if (nextNode == MEM_NODE_NONE || (pool_mgr->node_flags[nextNode] & MEM_NODE_ALLOCATED))
+        return ALLOC_OK;
+    STAT_INC(pool_mgr, num_coalesces);
+
+    // remove the next node from gap index
+    // check success
+    if (_mem_remove_from_gap_ix(pool_mgr, pool_mgr->node_records[nextNode].size, nextNode) != ALLOC_OK)
+        return ALLOC_FAIL;
+
+    // add the size to the node
+    pool_mgr->node_records[node].size += pool_mgr->node_records[nextNode].size;
+    POLICY_HOOK(pool_mgr, on_coalesce, pool_mgr->node_records[node].size);
+
+    // update linked list
+    pool_mgr->node_next[node] = pool_mgr->node_next[nextNode];
+    if (pool_mgr->node_next[nextNode] != MEM_NODE_NONE)
+        pool_mgr->node_prev[pool_mgr->node_next[nextNode]] = node;
+
+    // update next node as unused and metadata (used_nodes)
+    _mem_put_unused_node(pool_mgr, nextNode);
+
+    return ALLOC_OK;
+}
+
+// the first sufficient gap in address order
+// (walk the linked list, which is in address order, starting at the top node)
+static unsigned _mem_find_first_fit(pool_mgr_pt pool_mgr, size_t size, unsigned *visited) {
+    for (unsigned n = pool_mgr->head; n != MEM_NODE_NONE; n = pool_mgr->node_next[n]) {
+        ++*visited;
+        if (!(pool_mgr->node_flags[n] & MEM_NODE_ALLOCATED)
+            && pool_mgr->node_records[n].size >= size)
+            return n;
+    }
+
+    return MEM_NODE_NONE;
+}
+
+// the first sufficient gap in the gap index, found by binary search
+static unsigned _mem_find_best_fit(pool_mgr_pt pool_mgr, size_t size, unsigned *visited) {
+    unsigned lo = 0;
+    unsigned hi = pool_mgr->pool.num_gaps;
+
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        ++*visited;
+        if (pool_mgr->gap_size[mid] < size)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return (lo < pool_mgr->pool.num_gaps) ? pool_mgr->gap_node[lo] : MEM_NODE_NONE;
+}
+
+// the largest gap, last in the gap index
+static unsigned _mem_find_worst_fit(pool_mgr_pt pool_mgr, size_t size, unsigned *visited) {
+    unsigned last = pool_mgr->pool.num_gaps - 1;
+
+    ++*visited;
+    return (pool_mgr->gap_size[last] >= size) ? pool_mgr->gap_node[last] : MEM_NODE_NONE;
+}
+
+// a registered policy only gets to see the gap sizes
+static unsigned _mem_find_registered(pool_mgr_pt pool_mgr, size_t size, unsigned *visited) {
+    const pool_policy_ops_t *ops = &pool_mgr->policy_ops->ops;
+    unsigned num_gaps = pool_mgr->pool.num_gaps;
+    unsigned position = ops->find_gap(pool_mgr->gap_size, num_gaps, size, ops->ctx);
+
+    ++*visited;
+    if (position >= num_gaps || pool_mgr->gap_size[position] < size)
+        return MEM_NODE_NONE;
+
+    return pool_mgr->gap_node[position];
+}
+
+#ifdef MEM_POOL_STATS
+static void _mem_stat_search(pool_mgr_pt pool_mgr, unsigned visited) {
+    // bucket 0 is no visits, bucket b > 0 is [2^(b-1), 2^b), the last one is open
+    unsigned bucket = 0;
+    while (visited > 0 && bucket < MEM_POOL_SEARCH_BUCKETS - 1) {
+        visited >>= 1;
+        ++bucket;
+    }
+    pool_mgr->stats.search_hist[bucket] += 1;
+}
+#endif
+
+#ifdef MEM_POOL_LATENCY
+static int _mem_latency_sample(pool_mgr_pt pool_mgr) {
+    pool_latency_pt latency = pool_mgr->latency;
+
+    // time 1 in sample_every calls
+    if (latency == NULL || --latency->countdown > 0)
+        return 0;
+
+    latency->countdown = latency->sample_every;
+    return 1;
+}
+#endif
+
+#ifdef MEM_POOL_PROFILE
+// not inlined, so that it is the only frame of the profiler's own on the stack
+__attribute__((noinline))
+static void _mem_profile_sample(pool_mgr_pt pool_mgr, alloc_pt alloc, size_t size) {
+    pool_profile_pt profile = pool_mgr->profile;
+
+    profile->countdown = _mem_profile_interval(profile);
+
+    // keep the table at most half full, giving up on the sample if it cannot grow
+    if (2 * (profile->num_live + 1) > profile->capacity) {
+        unsigned capacity = (profile->capacity > 0) ? 2 * profile->capacity : 64;
+        pool_sample_pt *table = calloc(capacity, sizeof(pool_sample_pt));
+        if (table == NULL)
+            return;
+        for (unsigned i = 0; i < profile->capacity; ++i) {
+            pool_sample_pt moved = profile->table[i];
+            if (moved == NULL)
+                continue;
+            unsigned slot = (moved->id * 2654435761u) & (capacity - 1);
+            while (table[slot] != NULL)
+                slot = (slot + 1) & (capacity - 1);
+            table[slot] = moved;
+        }
+        free(profile->table);
+        profile->table = table;
+        profile->capacity = capacity;
+    }
+
+    pool_sample_pt sample = malloc(sizeof(pool_sample_t));
+    if (sample == NULL)
+        return;
+    sample->id = mem_alloc_id(&pool_mgr->pool, alloc);
+    sample->size = size;
+
+    // drop this frame
+    void *frames[MEM_PROFILE_DEPTH + 1];
+    int depth = backtrace(frames, MEM_PROFILE_DEPTH + 1);
+    sample->depth = (depth > 1) ? (unsigned) depth - 1 : 0;
+    memcpy(sample->frames, frames + 1, sample->depth * sizeof(void *));
+
+    unsigned slot = (sample->id * 2654435761u) & (profile->capacity - 1);
+    while (profile->table[slot] != NULL)
+        slot = (slot + 1) & (profile->capacity - 1);
+    profile->table[slot] = sample;
+    profile->num_live += 1;
+}
+
+static void _mem_profile_forget(pool_mgr_pt pool_mgr, alloc_pt alloc) {
+    pool_profile_pt profile = pool_mgr->profile;
+    unsigned id = mem_alloc_id(&pool_mgr->pool, alloc);
+    unsigned mask = profile->capacity - 1;
+
+    unsigned slot = (id * 2654435761u) & mask;
+    while (profile->table[slot] != NULL && profile->table[slot]->id != id)
+        slot = (slot + 1) & mask;
+    if (profile->table[slot] == NULL)
+        return;
+
+    free(profile->table[slot]);
+    profile->table[slot] = NULL;
+    profile->num_live -= 1;
+
+    // pull back the entries after it which would not be found past the hole
+    for (unsigned next = (slot + 1) & mask; profile->table[next] != NULL; next = (next + 1) & mask) {
+        unsigned home = (profile->table[next]->id * 2654435761u) & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            profile->table[slot] = profile->table[next];
+            profile->table[next] = NULL;
+            slot = next;
+        }
+    }
+}
+
+// stops at the last live sample, so an empty table costs nothing
+static void _mem_profile_clear(pool_profile_pt profile) {
+    for (unsigned i = 0; profile->num_live > 0 && i < profile->capacity; ++i) {
+        if (profile->table[i] != NULL) {
+            free(profile->table[i]);
+            profile->table[i] = NULL;
+            profile->num_live -= 1;
+        }
+    }
+}
+
+// exponentially distributed with mean sample_bytes, so that every byte is equally likely to be sampled
+static long long _mem_profile_interval(pool_profile_pt profile) {
+    profile->rng ^= profile->rng << 13;
+    profile->rng ^= profile->rng >> 7;
+    profile->rng ^= profile->rng << 17;
+
+    double u = ((double) (profile->rng >> 11) + 1) / 9007199254740992.0; // (0, 1]
+    return (long long) (-log(u) * (double) profile->sample_bytes) + 1;
+}
+
+// the allocations of this size that one sample stands for
+static double _mem_profile_weight(pool_profile_pt profile, size_t size) {
+    if (size == 0)
+        return 1;
+    return 1 / (1 - exp(-(double) size / (double) profile->sample_bytes));
+}
+
+static int _mem_profile_cmp(const void *a, const void *b) {
+    pool_sample_pt x = *(const pool_sample_pt *) a;
+    pool_sample_pt y = *(const pool_sample_pt *) b;
+
+    if (x->depth != y->depth)
+        return (x->depth < y->depth) ? -1 : 1;
+    return memcmp(x->frames, y->frames, x->depth * sizeof(void *));
+}
+#endif
+
+// the id of a live node is its index in the node heap, which survives heap resizes
+static unsigned _mem_node_id(pool_mgr_pt pool_mgr, const void *node) {
+    const char *base = (const char *) pool_mgr->node_records;
+    const char *ptr = (const char *) node;
+
+    if (ptr < base || ptr >= base + pool_mgr->node_hwm * sizeof(alloc_t)
+        || (size_t) (ptr - base) % sizeof(alloc_t) != 0)
+        return MEM_TRACE_NO_HANDLE;
+
+    return (unsigned) ((size_t) (ptr - base) / sizeof(alloc_t));
+}
+
+// single producer: only ever called on the pool's own thread
+static void _mem_trace_record(pool_mgr_pt pool_mgr,
+                              pool_trace_op op,
+                              size_t size,
+                              unsigned handle,
+                              unsigned result) {
+    pool_trace_pt trace = pool_mgr->trace;
+    unsigned long long head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+    unsigned long long tail = atomic_load_explicit(&trace->tail, memory_order_acquire);
+
+    // never block the pool on a slow flusher, count the loss instead
+    if (head - tail >= trace->capacity) {
+        atomic_fetch_add_explicit(&trace->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    pool_trace_record_t *record = &trace->records[head & (trace->capacity - 1)];
+    record->timestamp = mem_hist_clock_ns();
+    record->size = size;
+    record->handle = handle;
+    record->op = (uint8_t) op;
+    record->result = (uint8_t) result;
+    record->reserved = 0;
+
+    atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+// single consumer: write out everything recorded so far, in at most two chunks
+static alloc_status _mem_trace_drain(pool_mgr_pt pool_mgr) {
+    pool_trace_pt trace = pool_mgr->trace;
+    unsigned long long tail = atomic_load_explicit(&trace->tail, memory_order_relaxed);
+    unsigned long long head = atomic_load_explicit(&trace->head, memory_order_acquire);
+
+    while (tail < head) {
+        unsigned start = (unsigned) (tail & (trace->capacity - 1));
+        unsigned long long count = head - tail;
+        if (count > trace->capacity - start)
+            count = trace->capacity - start;
+
+        if (fwrite(&trace->records[start], sizeof(pool_trace_record_t), count, trace->sink) != count)
+            return ALLOC_FAIL;
+
+        tail += count;
+        atomic_store_explicit(&trace->tail, tail, memory_order_release);
+    }
+
+    return ALLOC_OK;
+}
+
+static alloc_pt _mem_small_alloc(pool_mgr_pt pool_mgr, size_t size) {
+    pool_small_pt small = pool_mgr->small;
+
+    // smallest class that fits (sizes are at most MEM_POOL_SMALL_MAX)
+    unsigned size_class = 0;
+    while (MEM_SMALL_CLASS_SIZES[size_class] < size)
+        ++size_class;
+
+    // take a slab with free objects, or carve a new one out of the pool
+    slab_pt slab = small->partial[size_class];
+    if (slab == NULL && (slab = _mem_small_new_slab(pool_mgr, size_class)) == NULL)
+        return NULL;
+
+    // lowest free object
+    unsigned object = (unsigned) __builtin_ctzll(slab->free_mask);
+    slab->free_mask &= ~(1ull << object);
+
+    // full slabs leave the class list
+    if (slab->free_mask == 0) {
+        small->partial[size_class] = slab->next;
+        if (slab->next != NULL)
+            slab->next->prev = NULL;
+        slab->next = NULL;
+    }
+
+    alloc_pt alloc = &slab->records[object];
+    alloc->size = size;
+    alloc->mem = slab->mem + object * MEM_SMALL_CLASS_SIZES[size_class];
+    STAT_INC(pool_mgr, small_allocs);
+
+    return alloc;
+}
+
+static alloc_status _mem_small_del(pool_mgr_pt pool_mgr, slab_pt slab, alloc_pt alloc) {
+    pool_small_pt small = pool_mgr->small;
+    unsigned object = (unsigned) (alloc - slab->records);
+    uint64_t full_mask = (MEM_SLAB_OBJECTS == 64) ? ~0ull : (1ull << MEM_SLAB_OBJECTS) - 1;
+
+    // must be a live object
+    if ((slab->free_mask >> object) & 1) {
+        STAT_INC(pool_mgr, num_failures);
+        return ALLOC_FAIL;
+    }
+    STAT_INC(pool_mgr, small_frees);
+
+    // a full slab has free objects again, back on the class list
+    if (slab->free_mask == 0) {
+        slab->prev = NULL;
+        slab->next = small->partial[slab->size_class];
+        if (slab->next != NULL)
+            slab->next->prev = slab;
+        small->partial[slab->size_class] = slab;
+    }
+    slab->free_mask |= 1ull << object;
+
+    // an empty slab goes back to the pool, unless it is the last one of its class
+    if (slab->free_mask == full_mask
+        && (slab->next != NULL || small->partial[slab->size_class] != slab))
+        _mem_small_release_slab(pool_mgr, slab);
+
+    return ALLOC_OK;
+}
+
+// the slab owning a small-object handle, NULL for anything else
+static slab_pt _mem_small_slab(pool_mgr_pt pool_mgr, const void *alloc) {
+    pool_small_pt small = pool_mgr->small;
+
+    if (small == NULL || alloc == NULL)
+        return NULL;
+
+    // node heap handles are never small objects
+    const char *ptr = alloc;
+    if (ptr >= (const char *) pool_mgr->node_records
+        && ptr < (const char *) (pool_mgr->node_records + pool_mgr->total_nodes))
+        return NULL;
+
+    // the slab metadata is aligned to its size, and on the same page as the handle;
+    // nothing is read from it before it is known to be one of the pool's slabs
+    slab_pt slab = (slab_pt) ((uintptr_t) alloc & ~(uintptr_t) (MEM_SLAB_META_SIZE - 1));
+    size_t offset = (size_t) (ptr - (const char *) slab);
+    if (offset < offsetof(slab_t, records)
+        || (offset - offsetof(slab_t, records)) % sizeof(alloc_t) != 0
+        || (offset - offsetof(slab_t, records)) / sizeof(alloc_t) >= MEM_SLAB_OBJECTS)
+        return NULL;
+
+    unsigned position = _mem_small_position(small, slab);
+    if (position == small->num_live || small->by_addr[position] != slab)
+        return NULL;
+
+    return slab;
+}
+
+// the index of slab in by_addr, or where it would go
+static unsigned _mem_small_position(pool_small_pt small, slab_pt slab) {
+    unsigned lo = 0, hi = small->num_live;
+
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        if ((uintptr_t) small->by_addr[mid] < (uintptr_t) slab)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static slab_pt _mem_small_new_slab(pool_mgr_pt pool_mgr, unsigned size_class) {
+    pool_small_pt small = pool_mgr->small;
+
+    // grow the slab table, if necessary, keeping the old one if it fails
+    if (small->num_free_ix == 0 && small->num_slabs == small->capacity) {
+        unsigned capacity = (small->capacity > 0)
+                            ? small->capacity * MEM_SMALL_EXPAND_FACTOR : MEM_SMALL_INIT_CAPACITY;
+        slab_pt *slabs = realloc(small->slabs, capacity * sizeof(slab_pt));
+        if (slabs == NULL)
+            return NULL;
+        small->slabs = slabs;
+        unsigned *free_ix = realloc(small->free_ix, capacity * sizeof(unsigned));
+        if (free_ix == NULL)
+            return NULL;
+        small->free_ix = free_ix;
+        slabs = realloc(small->by_addr, capacity * sizeof(slab_pt));
+        if (slabs == NULL)
+            return NULL;
+        small->by_addr = slabs;
+        small->capacity = capacity;
+    }
+
+    slab_pt slab = aligned_alloc(MEM_SLAB_META_SIZE, MEM_SLAB_META_SIZE);
+    if (slab == NULL)
+        return NULL;
+
+    // the objects are one pool allocation, pinned so that compaction leaves them alone
+    alloc_pt block = _mem_new_alloc(&pool_mgr->pool, MEM_SMALL_CLASS_SIZES[size_class] * MEM_SLAB_OBJECTS, 0);
+    if (block == NULL) {
+        free(slab);
+        return NULL;
+    }
+    slab->block_id = _mem_node_id(pool_mgr, block);
+    pool_mgr->node_flags[slab->block_id] |= MEM_NODE_PINNED;
+    STAT_INC(pool_mgr, num_slabs);
+
+    slab->free_mask = (MEM_SLAB_OBJECTS == 64) ? ~0ull : (1ull << MEM_SLAB_OBJECTS) - 1;
+    slab->mem = block->mem;
+    slab->size_class = size_class;
+    slab->ix = (small->num_free_ix > 0) ? small->free_ix[--small->num_free_ix] : small->num_slabs++;
+    small->slabs[slab->ix] = slab;
+    unsigned position = _mem_small_position(small, slab);
+    memmove(&small->by_addr[position + 1], &small->by_addr[position],
+            (small->num_live - position) * sizeof(slab_pt));
+    small->by_addr[position] = slab;
+    small->num_live += 1;
+
+    // on the front of the class list
+    slab->prev = NULL;
+    slab->next = small->partial[size_class];
+    if (slab->next != NULL)
+        slab->next->prev = slab;
+    small->partial[size_class] = slab;
+
+    return slab;
+}
+
+// note: the slab has free objects, so it is on its class list
+static void _mem_small_release_slab(pool_mgr_pt pool_mgr, slab_pt slab) {
+    pool_small_pt small = pool_mgr->small;
+
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        small->partial[slab->size_class] = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+
+    // the ids of node heap allocations survive the resizes since the slab was made
+    _mem_del_alloc(&pool_mgr->pool, mem_alloc_from_id(&pool_mgr->pool, slab->block_id));
+
+    small->slabs[slab->ix] = NULL;
+    small->free_ix[small->num_free_ix++] = slab->ix;
+    unsigned position = _mem_small_position(small, slab);
+    small->num_live -= 1;
+    memmove(&small->by_addr[position], &small->by_addr[position + 1],
+            (small->num_live - position) * sizeof(slab_pt));
+    free(slab);
+}
+
+// release the empty slabs kept for reuse
+static void _mem_small_trim(pool_mgr_pt pool_mgr) {
+    uint64_t full_mask = (MEM_SLAB_OBJECTS == 64) ? ~0ull : (1ull << MEM_SLAB_OBJECTS) - 1;
+
+    for (unsigned c = 0; c < MEM_SMALL_NUM_CLASSES; ++c) {
+        slab_pt slab = pool_mgr->small->partial[c];
+        while (slab != NULL) {
+            slab_pt next = slab->next;
+            if (slab->free_mask == full_mask)
+                _mem_small_release_slab(pool_mgr, slab);
+            slab = next;
+        }
+    }
+}
+
+// forget all slabs without giving their blocks back (the pool is being reset or freed)
+static void _mem_small_discard(pool_mgr_pt pool_mgr) {
+    pool_small_pt small = pool_mgr->small;
+
+    for (unsigned ix = 0; ix < small->num_slabs; ++ix)
+        free(small->slabs[ix]);
+    memset(small->partial, 0, sizeof(small->partial));
+    small->num_slabs = 0;
+    small->num_free_ix = 0;
+    small->num_live = 0;
+}
+
+#ifdef MEM_POOL_GUARD
+// note: resets the countdown whether or not the request is guarded
+static alloc_pt _mem_guard_alloc(pool_mgr_pt pool_mgr, size_t size, unsigned tag) {
+    pool_guard_pt guard = pool_mgr->guard;
+
+    guard->countdown = _mem_guard_interval(guard);
+
+    if (size == 0 || size > guard->page_size)
+        return NULL;
+
+    // a slot never used, else the one deleted longest ago, else none
+    unsigned slot = guard->free_slots;
+    if (slot != MEM_NODE_NONE) {
+        guard->free_slots = guard->slots[slot].next;
+    } else if ((slot = guard->quarantine_head) != MEM_NODE_NONE) {
+        guard->quarantine_head = guard->slots[slot].next;
+        if (guard->quarantine_head == MEM_NODE_NONE)
+            guard->quarantine_tail = MEM_NODE_NONE;
+    } else {
+        return NULL;
+    }
+
+    guard_slot_pt entry = &guard->slots[slot];
+    char *page = guard->map + (2 * (size_t) slot + 1) * guard->page_size;
+    if (mprotect(page, guard->page_size, PROT_READ | PROT_WRITE) != 0) {
+        entry->state = MEM_GUARD_FREE;
+        entry->next = guard->free_slots;
+        guard->free_slots = slot;
+        return NULL;
+    }
+
+    // flush with the guard page but for the alignment, which is filled to catch small overruns on deletion
+    size_t span = (size + MEM_GUARD_ALIGN - 1) & ~(size_t) (MEM_GUARD_ALIGN - 1);
+    entry->record.size = size;
+    entry->record.mem = page + guard->page_size - span;
+    memset(entry->record.mem + size, MEM_GUARD_FILL, span - size);
+    entry->state = MEM_GUARD_LIVE;
+    entry->tag = (uint8_t) tag;
+    entry->alloc_depth = (uint8_t) backtrace(entry->alloc_frames, MEM_GUARD_DEPTH);
+    entry->del_depth = 0;
+
+    guard->num_live += 1;
+    _mem_tag_alloc(pool_mgr, tag, size);
+    STAT_INC(pool_mgr, guarded_allocs);
+
+    return &entry->record;
+}
+
+static alloc_status _mem_guard_del(pool_mgr_pt pool_mgr, unsigned slot) {
+    pool_guard_pt guard = pool_mgr->guard;
+    guard_slot_pt entry = &guard->slots[slot];
+
+    // must be live; one still in quarantine was deleted before
+    if (entry->state != MEM_GUARD_LIVE) {
+        if (entry->state == MEM_GUARD_QUARANTINED)
+            _mem_guard_report(guard, slot, "double-free", NULL);
+        STAT_INC(pool_mgr, num_failures);
+        return ALLOC_FAIL;
+    }
+
+    entry->del_depth = (uint8_t) backtrace(entry->del_frames, MEM_GUARD_DEPTH);
+
+    // the memory is already corrupt, so go down as the guard page would have
+    size_t span = (entry->record.size + MEM_GUARD_ALIGN - 1) & ~(size_t) (MEM_GUARD_ALIGN - 1);
+    for (size_t i = entry->record.size; i < span; ++i) {
+        if ((unsigned char) entry->record.mem[i] != MEM_GUARD_FILL) {
+            _mem_guard_report(guard, slot, "heap-buffer-overflow", entry->record.mem + i);
+            abort();
+        }
+    }
+
+    // inaccessible until reused, the oldest first
+    mprotect(guard->map + (2 * (size_t) slot + 1) * guard->page_size, guard->page_size, PROT_NONE);
+    entry->state = MEM_GUARD_QUARANTINED;
+    entry->next = MEM_NODE_NONE;
+    if (guard->quarantine_tail != MEM_NODE_NONE)
+        guard->slots[guard->quarantine_tail].next = slot;
+    else
+        guard->quarantine_head = slot;
+    guard->quarantine_tail = slot;
+
+    guard->num_live -= 1;
+    _mem_tag_del(pool_mgr, entry->tag, entry->record.size);
+    STAT_INC(pool_mgr, guarded_frees);
+
+    return ALLOC_OK;
+}
+
+// the guard slot of a handle, MEM_NODE_NONE for anything else
+static unsigned _mem_guard_slot(pool_mgr_pt pool_mgr, const void *alloc) {
+    pool_guard_pt guard = pool_mgr->guard;
+    const char *base = (const char *) guard->slots;
+    const char *ptr = alloc;
+
+    if (ptr < base || ptr >= base + guard->num_slots * sizeof(guard_slot_t)
+        || (size_t) (ptr - base) % sizeof(guard_slot_t) != 0)
+        return MEM_NODE_NONE;
+
+    return (unsigned) ((size_t) (ptr - base) / sizeof(guard_slot_t));
+}
+
+// all slots free, lowest first, and none in quarantine
+static void _mem_guard_init(pool_guard_pt guard) {
+    for (unsigned i = 0; i < guard->num_slots; ++i) {
+        guard->slots[i].state = MEM_GUARD_FREE;
+        guard->slots[i].next = (i + 1 < guard->num_slots) ? i + 1 : MEM_NODE_NONE;
+    }
+    guard->free_slots = 0;
+    guard->quarantine_head = MEM_NODE_NONE;
+    guard->quarantine_tail = MEM_NODE_NONE;
+    guard->num_live = 0;
+}
+
+// uniform in [1, 2 * sample_every - 1], so that the guarded allocations do not follow a pattern in the workload
+static unsigned _mem_guard_interval(pool_guard_pt guard) {
+    guard->rng ^= guard->rng << 13;
+    guard->rng ^= guard->rng >> 7;
+    guard->rng ^= guard->rng << 17;
+
+    return 1 + (unsigned) (guard->rng % (2 * (uint64_t) guard->sample_every - 1));
+}
+
+// note: runs in the signal handler, so only async-signal-safe calls, and no locks
+static void _mem_guard_fault(int sig, siginfo_t *info, void *context) {
+    const char *addr = info->si_addr;
+    (void) sig;
+    (void) context;
+
+    for (unsigned i = 0; i < pool_store_size; ++i) {
+        pool_guard_pt guard = (pool_store[i] != NULL) ? pool_store[i]->guard : NULL;
+        if (guard == NULL || addr < guard->map || addr >= guard->map + guard->map_size)
+            continue;
+
+        // odd pages are the slots', even ones the guard pages between them
+        size_t page = (size_t) (addr - guard->map) / guard->page_size;
+        unsigned slot = (unsigned) (page / 2);
+        const char *what;
+        if (page % 2 == 1) {
+            what = (guard->slots[slot].state == MEM_GUARD_QUARANTINED) ? "use-after-free" : "invalid-access";
+        } else if (slot > 0 && guard->slots[slot - 1].state != MEM_GUARD_FREE) {
+            what = "heap-buffer-overflow";
+            slot -= 1;
+        } else {
+            what = "heap-buffer-underflow";
+        }
+        if (slot >= guard->num_slots)
+            slot = guard->num_slots - 1;
+
+        _mem_guard_report(guard, slot, what, addr);
+        break;
+    }
+
+    sigaction(SIGSEGV, &guard_prev_action, NULL);
+}
+
+static void _mem_guard_report(pool_guard_pt guard, unsigned slot, const char *what, const char *addr) {
+    guard_slot_pt entry = &guard->slots[slot];
+
+    _mem_guard_write("mem_pool: ");
+    _mem_guard_write(what);
+    if (addr != NULL) {
+        _mem_guard_write(" at ");
+        _mem_guard_write_num((uintptr_t) addr, 16);
+    }
+    _mem_guard_write(" on guarded allocation ");
+    _mem_guard_write_num(MEM_ALLOC_ID_GUARD | slot, 16);
+    if (entry->state != MEM_GUARD_FREE) {
+        _mem_guard_write(" (");
+        _mem_guard_write_num(entry->record.size, 10);
+        _mem_guard_write(" bytes at ");
+        _mem_guard_write_num((uintptr_t) entry->record.mem, 16);
+        _mem_guard_write(")");
+        if (addr != NULL && addr >= entry->record.mem + entry->record.size) {
+            _mem_guard_write(", ");
+            _mem_guard_write_num((uint64_t) (addr - entry->record.mem - entry->record.size), 10);
+            _mem_guard_write(" bytes past its end");
+        } else if (addr != NULL && addr < entry->record.mem) {
+            _mem_guard_write(", ");
+            _mem_guard_write_num((uint64_t) (entry->record.mem - addr), 10);
+            _mem_guard_write(" bytes before its start");
+        }
+    }
+    _mem_guard_write("\n");
+
+    if (entry->state != MEM_GUARD_FREE) {
+        _mem_guard_write_frames("allocated at:", entry->alloc_frames, entry->alloc_depth);
+        _mem_guard_write_frames("deleted at:", entry->del_frames, entry->del_depth);
+    }
+}
+
+static void _mem_guard_write(const char *str) {
+    ssize_t written = write(STDERR_FILENO, str, strlen(str));
+    (void) written;
+}
+
+static void _mem_guard_write_num(uint64_t value, unsigned base) {
+    char buffer[24];
+    unsigned i = sizeof(buffer);
+
+    do {
+        buffer[--i] = "0123456789abcdef"[value % base];
+        value /= base;
+    } while (value > 0);
+    if (base == 16) {
+        buffer[--i] = 'x';
+        buffer[--i] = '0';
+    }
+
+    ssize_t written = write(STDERR_FILENO, buffer + i, sizeof(buffer) - i);
+    (void) written;
+}
+
+static void _mem_guard_write_frames(const char *title, void *const *frames, unsigned depth) {
+    if (depth == 0)
+        return;
+
+    _mem_guard_write("  ");
+    _mem_guard_write(title);
+    _mem_guard_write("\n");
+    backtrace_symbols_fd(frames, (int) depth, STDERR_FILENO);
+}
+#endif
+
+static alloc_status _mem_write_all(int fd, const void *buf, size_t size) {
+    const char *ptr = buf;
+
+    while (size > 0) {
+        ssize_t written = write(fd, ptr, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return ALLOC_FAIL;
+        ptr += written;
+        size -= (size_t) written;
+    }
+
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_read_all(int fd, void *buf, size_t size) {
+    char *ptr = buf;
+
+    while (size > 0) {
+        ssize_t got = read(fd, ptr, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return ALLOC_FAIL;
+        ptr += got;
+        size -= (size_t) got;
+    }
+
+    return ALLOC_OK;
+}
+
+static alloc_status _mem_snapshot_metadata(pool_mgr_pt pool_mgr, int fd) {
+    uint64_t chunk[2 * MEM_SNAPSHOT_CHUNK];
+    unsigned hwm = pool_mgr->node_hwm;
+
+    // the records are the only pointers, they go out as offsets (0 for unused nodes)
+    for (unsigned base = 0; base < hwm; base += MEM_SNAPSHOT_CHUNK) {
+        unsigned count = (hwm - base < MEM_SNAPSHOT_CHUNK) ? hwm - base : MEM_SNAPSHOT_CHUNK;
+        for (unsigned u = 0; u < count; ++u) {
+            alloc_pt record = &pool_mgr->node_records[base + u];
+            int used = pool_mgr->node_flags[base + u] & MEM_NODE_USED;
+            chunk[2 * u] = used ? (uint64_t) (record->mem - pool_mgr->pool.mem) : 0;
+            chunk[2 * u + 1] = used ? record->size : 0;
+        }
+        if (_mem_write_all(fd, chunk, 2 * count * sizeof(uint64_t)) != ALLOC_OK)
+            return ALLOC_FAIL;
+    }
+
+    if (_mem_write_all(fd, pool_mgr->node_next, hwm * sizeof(uint32_t)) != ALLOC_OK
+        || _mem_write_all(fd, pool_mgr->node_prev, hwm * sizeof(uint32_t)) != ALLOC_OK
+        || _mem_write_all(fd, pool_mgr->node_flags, hwm * sizeof(uint8_t)) != ALLOC_OK)
+        return ALLOC_FAIL;
+
+    // a bitmap pool keeps no gap index, only its bitmaps
+    if (pool_mgr->pool.policy == BITMAP) {
+        if (_mem_write_all(fd, pool_mgr->bitmap_used, pool_mgr->bitmap_words * sizeof(uint64_t)) != ALLOC_OK
+            || _mem_write_all(fd, pool_mgr->bitmap_start, pool_mgr->bitmap_words * sizeof(uint64_t)) != ALLOC_OK)
+            return ALLOC_FAIL;
+    }
+    else if (_mem_write_all(fd, pool_mgr->gap_size, pool_mgr->pool.num_gaps * sizeof(size_t)) != ALLOC_OK
+             || _mem_write_all(fd, pool_mgr->gap_node, pool_mgr->pool.num_gaps * sizeof(uint32_t)) != ALLOC_OK) {
+        return ALLOC_FAIL;
+    }
+
+    return ALLOC_OK;
+}
+
+// note: the pool is freshly opened with the snapshot's size and policy
+static alloc_status _mem_restore_metadata(pool_mgr_pt pool_mgr, int fd, const pool_snapshot_header_t *header) {
+    uint64_t chunk[2 * MEM_SNAPSHOT_CHUNK];
+    unsigned hwm = header->node_hwm;
+
+    // the capacities the pool had, so that it doesn't resize right away
+    if (_mem_realloc_node_heap(pool_mgr, header->total_nodes) != ALLOC_OK
+        || _mem_realloc_gap_ix(pool_mgr, header->gap_ix_capacity) != ALLOC_OK)
+        return ALLOC_FAIL;
+
+    for (unsigned base = 0; base < hwm; base += MEM_SNAPSHOT_CHUNK) {
+        unsigned count = (hwm - base < MEM_SNAPSHOT_CHUNK) ? hwm - base : MEM_SNAPSHOT_CHUNK;
+        if (_mem_read_all(fd, chunk, 2 * count * sizeof(uint64_t)) != ALLOC_OK)
+            return ALLOC_FAIL;
+        for (unsigned u = 0; u < count; ++u) {
+            if (chunk[2 * u] + chunk[2 * u + 1] > pool_mgr->pool.total_size)
+                return ALLOC_FAIL;
+            pool_mgr->node_records[base + u].mem = pool_mgr->pool.mem + chunk[2 * u];
+            pool_mgr->node_records[base + u].size = (size_t) chunk[2 * u + 1];
+        }
+    }
+
+    if (_mem_read_all(fd, pool_mgr->node_next, hwm * sizeof(uint32_t)) != ALLOC_OK
+        || _mem_read_all(fd, pool_mgr->node_prev, hwm * sizeof(uint32_t)) != ALLOC_OK
+        || _mem_read_all(fd, pool_mgr->node_flags, hwm * sizeof(uint8_t)) != ALLOC_OK)
+        return ALLOC_FAIL;
+
+    if (pool_mgr->pool.policy == BITMAP) {
+        pool_mgr->bitmap_largest = MEM_BITMAP_NONE;
+        if (_mem_read_all(fd, pool_mgr->bitmap_used, pool_mgr->bitmap_words * sizeof(uint64_t)) != ALLOC_OK
+            || _mem_read_all(fd, pool_mgr->bitmap_start, pool_mgr->bitmap_words * sizeof(uint64_t)) != ALLOC_OK)
+            return ALLOC_FAIL;
+    }
+    else if (_mem_read_all(fd, pool_mgr->gap_size, header->num_gaps * sizeof(size_t)) != ALLOC_OK
+             || _mem_read_all(fd, pool_mgr->gap_node, header->num_gaps * sizeof(uint32_t)) != ALLOC_OK) {
+        return ALLOC_FAIL;
+    }
+
+    // every index has to name a node below the high-water mark (or none), and the
+    // gap index only gaps, or a corrupt file would have the pool walk off its heap
+    if ((header->head != MEM_NODE_NONE && header->head >= hwm)
+        || (header->unused_nodes != MEM_NODE_NONE && header->unused_nodes >= hwm))
+        return ALLOC_FAIL;
+    for (unsigned u = 0; u < hwm; ++u)
+        if ((pool_mgr->node_next[u] != MEM_NODE_NONE && pool_mgr->node_next[u] >= hwm)
+            || (pool_mgr->node_prev[u] != MEM_NODE_NONE && pool_mgr->node_prev[u] >= hwm))
+            return ALLOC_FAIL;
+    if (pool_mgr->pool.policy != BITMAP)
+        for (unsigned u = 0; u < header->num_gaps; ++u)
+            if (pool_mgr->gap_node[u] >= hwm
+                || (pool_mgr->node_flags[pool_mgr->gap_node[u]] & (MEM_NODE_USED | MEM_NODE_ALLOCATED)) != MEM_NODE_USED)
+                return ALLOC_FAIL;
+
+    pool_mgr->pool.alloc_size = (size_t) header->alloc_size;
+    pool_mgr->pool.num_allocs = header->num_allocs;
+    pool_mgr->pool.num_gaps = header->num_gaps;
+    pool_mgr->used_nodes = header->used_nodes;
+    pool_mgr->node_hwm = hwm;
+    pool_mgr->head = header->head;
+    pool_mgr->unused_nodes = header->unused_nodes;
+    pool_mgr->high_water = (size_t) header->high_water;
+    _mem_tag_recount(pool_mgr);
+
+    return ALLOC_OK;
+}
+
+static void _mem_bitmap_init(pool_mgr_pt pool_mgr) {
+    // no nodes, not even the top one
+    pool_mgr->used_nodes = 0;
+    pool_mgr->node_hwm = 0;
+    pool_mgr->head = MEM_NODE_NONE;
+
+    memset(pool_mgr->bitmap_used, 0, pool_mgr->bitmap_words * sizeof(uint64_t));
+    memset(pool_mgr->bitmap_start, 0, pool_mgr->bitmap_words * sizeof(uint64_t));
+
+    // the bits past the last block look allocated, so no run reaches them
+    if (pool_mgr->bitmap_blocks % 64 != 0)
+        pool_mgr->bitmap_used[pool_mgr->bitmap_words - 1] = ~0ull << (pool_mgr->bitmap_blocks % 64);
+
+    pool_mgr->bitmap_largest = pool_mgr->bitmap_blocks;
+    pool_mgr->bitmap_largest_at = 0;
+}
+
+static alloc_pt _mem_bitmap_alloc(pool_mgr_pt pool_mgr, size_t size, unsigned tag) {
+    size_t blocks = (size > 0) ? (size + MEM_POOL_BITMAP_BLOCK - 1) / MEM_POOL_BITMAP_BLOCK : 1;
+    unsigned visited = 0;
+
+    size_t start = _mem_bitmap_find(pool_mgr->bitmap_used, pool_mgr->bitmap_words, blocks, &visited);
+    STAT_SEARCH(pool_mgr, visited);
+    if (start == MEM_BITMAP_NONE) {
+        STAT_INC(pool_mgr, num_failures);
+        return NULL;
+    }
+
+    // the node only holds the allocation record, it is not linked anywhere
+    unsigned node = _mem_get_unused_node(pool_mgr);
+    if (node == MEM_NODE_NONE) {
+        STAT_INC(pool_mgr, num_failures);
+        return NULL;
+    }
+
+    // the run comes out of one gap, which leaves a gap on either side, or not
+    int left = start > 0 && !_mem_bitmap_test(pool_mgr->bitmap_used, start - 1);
+    int right = start + blocks < pool_mgr->bitmap_blocks
+                && !_mem_bitmap_test(pool_mgr->bitmap_used, start + blocks);
+    pool_mgr->pool.num_gaps = pool_mgr->pool.num_gaps - 1 + left + right;
+    if (left || right)
+        STAT_INC(pool_mgr, num_splits);
+
+    _mem_bitmap_fill(pool_mgr->bitmap_used, start, blocks, 1);
+    _mem_bitmap_fill(pool_mgr->bitmap_start, start, 1, 1);
+
+    // only carving up the largest run can shrink it; what is left of it is found on the next rescan
+    if (pool_mgr->bitmap_largest != MEM_BITMAP_NONE
+        && start < pool_mgr->bitmap_largest_at + pool_mgr->bitmap_largest
+        && start + blocks > pool_mgr->bitmap_largest_at)
+        pool_mgr->bitmap_largest = MEM_BITMAP_NONE;
+
+    // the record keeps the requested size, the pool accounts for whole blocks
+    pool_mgr->node_flags[node] |= MEM_NODE_ALLOCATED | (uint8_t) (tag << MEM_NODE_TAG_SHIFT);
+    pool_mgr->node_records[node].size = size;
+    pool_mgr->node_records[node].mem = pool_mgr->pool.mem + start * MEM_POOL_BITMAP_BLOCK;
+
+    STAT_INC(pool_mgr, num_allocs);
+    pool_mgr->pool.num_allocs += 1;
+    pool_mgr->pool.alloc_size += blocks * MEM_POOL_BITMAP_BLOCK;
+    _mem_tag_alloc(pool_mgr, tag, blocks * MEM_POOL_BITMAP_BLOCK);
+
+    size_t allocEnd = (start + blocks) * MEM_POOL_BITMAP_BLOCK;
+    if (allocEnd > pool_mgr->high_water)
+        pool_mgr->high_water = allocEnd;
+
+    return &pool_mgr->node_records[node];
+}
+
+static alloc_status _mem_bitmap_del(pool_mgr_pt pool_mgr, unsigned node) {
+    alloc_pt record = &pool_mgr->node_records[node];
+    size_t start = (size_t) (record->mem - pool_mgr->pool.mem) / MEM_POOL_BITMAP_BLOCK;
+    size_t blocks = (record->size > 0) ? (record->size + MEM_POOL_BITMAP_BLOCK - 1) / MEM_POOL_BITMAP_BLOCK : 1;
+
+    _mem_bitmap_fill(pool_mgr->bitmap_used, start, blocks, 0);
+    _mem_bitmap_fill(pool_mgr->bitmap_start, start, 1, 0);
+
+    // the freed run joins the gaps on either side, if any
+    size_t below = _mem_bitmap_clear_below(pool_mgr->bitmap_used, start);
+    size_t above = _mem_bitmap_clear_from(pool_mgr->bitmap_used, pool_mgr->bitmap_words, start + blocks);
+    int left = below > 0;
+    int right = above > 0;
+    pool_mgr->pool.num_gaps = pool_mgr->pool.num_gaps + 1 - left - right;
+
+    // runs only grow here, so the joined one is the largest if it beats it
+    if (pool_mgr->bitmap_largest != MEM_BITMAP_NONE && below + blocks + above > pool_mgr->bitmap_largest) {
+        pool_mgr->bitmap_largest = below + blocks + above;
+        pool_mgr->bitmap_largest_at = start - below;
+    }
+#ifdef MEM_POOL_STATS
+    pool_mgr->stats.num_coalesces += left + right;
+#endif
+
+    pool_mgr->pool.num_allocs -= 1;
+    pool_mgr->pool.alloc_size -= blocks * MEM_POOL_BITMAP_BLOCK;
+    _mem_tag_del(pool_mgr, MEM_NODE_TAG(pool_mgr->node_flags[node]), blocks * MEM_POOL_BITMAP_BLOCK);
+
+    _mem_put_unused_node(pool_mgr, node);
+
+    return ALLOC_OK;
+}
+
+// the first block of the lowest run of n clear bits, or MEM_BITMAP_NONE
+static size_t _mem_bitmap_find(const uint64_t *used, size_t num_words, size_t n, unsigned *visited) {
+    size_t run = 0;     // clear bits at the top of the words before i
+    size_t i = 0;
+
+    while (i < num_words) {
+        uint64_t w = used[i];
+
+        // nothing to find in full words, and a run can't span them
+        if (w == ~0ull) {
+            size_t j = _mem_bitmap_skip_full(used, i, num_words);
+            *visited += (unsigned) (j - i);
+            run = 0;
+            i = j;
+            continue;
+        }
+        ++*visited;
+
+        // the run carried in, extended by the clear bits at the bottom of the word
+        size_t low = (w == 0) ? 64 : (size_t) __builtin_ctzll(w);
+        if (run + low >= n)
+            return i * 64 - run;
+        if (w == 0) {
+            run += 64;
+            ++i;
+            continue;
+        }
+
+        // a run inside the word: bit j of g stays set while bits j..j+k-1 are all clear
+        if (n < 64) {
+            uint64_t g = ~w;
+            size_t k = 1;
+            while (k < n) {
+                size_t shift = (2 * k <= n) ? k : n - k;
+                g &= g >> shift;
+                k += shift;
+            }
+            if (g != 0)
+                return i * 64 + (size_t) __builtin_ctzll(g);
+        }
+
+        // the clear bits at the top of the word carry into the next one
+        run = (size_t) __builtin_clzll(w);
+        ++i;
+    }
+
+    return MEM_BITMAP_NONE;
+}
+
+// the first word at or after i with a clear bit, or num_words
+static size_t _mem_bitmap_skip_full(const uint64_t *used, size_t i, size_t num_words) {
+#if defined(__AVX2__)
+    const __m256i full = _mm256_set1_epi64x(-1);
+    for (; i + 4 <= num_words; i += 4) {
+        __m256i w = _mm256_loadu_si256((const __m256i *) (used + i));
+        if (!_mm256_testc_si256(w, full))
+            break;
+    }
+#elif defined(__SSE2__)
+    const __m128i full = _mm_set1_epi32(-1);
+    for (; i + 2 <= num_words; i += 2) {
+        __m128i w = _mm_loadu_si128((const __m128i *) (used + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(w, full)) != 0xFFFF)
+            break;
+    }
+#endif
+    // the rest, and the word the vector loop stopped in
+    while (i < num_words && used[i] == ~0ull)
+        ++i;
+
+    return i;
+}
+
+static void _mem_bitmap_fill(uint64_t *map, size_t start, size_t n, int set) {
+    while (n > 0) {
+        size_t bit = start % 64;
+        size_t len = (n < 64 - bit) ? n : 64 - bit;
+        uint64_t mask = ((len == 64) ? ~0ull : (1ull << len) - 1) << bit;
+
+        if (set)
+            map[start / 64] |= mask;
+        else
+            map[start / 64] &= ~mask;
+
+        start += len;
+        n -= len;
+    }
+}
+
+static int _mem_bitmap_test(const uint64_t *map, size_t i) {
+    return (int) ((map[i / 64] >> (i % 64)) & 1);
+}
+
+// the clear blocks right below block, up to the first set one
+static size_t _mem_bitmap_clear_below(const uint64_t *used, size_t block) {
+    size_t n = 0;
+
+    while (block > 0) {
+        size_t top = (block - 1) % 64;
+        uint64_t w = used[(block - 1) / 64] << (63 - top);   // bits top..0, moved to the top
+        if (w != 0)
+            return n + (size_t) __builtin_clzll(w);
+        n += top + 1;
+        block -= top + 1;
+    }
+
+    return n;
+}
+
+// the clear blocks from block on, up to the first set one (the bits past the last block are set)
+static size_t _mem_bitmap_clear_from(const uint64_t *used, size_t num_words, size_t block) {
+    size_t n = 0;
+
+    while (block / 64 < num_words) {
+        size_t bit = block % 64;
+        uint64_t w = used[block / 64] >> bit;
+        if (w != 0)
+            return n + (size_t) __builtin_ctzll(w);
+        n += 64 - bit;
+        block += 64 - bit;
+    }
+
+    return n;
+}
+
+// in blocks; cached between the allocations which carve up the largest run, else a rescan a word at a time
+static size_t _mem_bitmap_largest_run(pool_mgr_pt pool_mgr) {
+    if (pool_mgr->bitmap_largest != MEM_BITMAP_NONE)
+        return pool_mgr->bitmap_largest;
+
+    size_t largest = 0;
+    size_t largest_at = 0;
+    size_t run = 0;     // clear bits at the top of the words before i
+
+    for (size_t i = 0; i < pool_mgr->bitmap_words; ++i) {
+        uint64_t w = pool_mgr->bitmap_used[i];
+
+        if (w == 0) {
+            run += 64;
+            continue;
+        }
+        // from one set bit to the next clear run, the first one extending the run carried in
+        size_t bit = 0;
+        while (bit < 64) {
+            uint64_t rest = w >> bit;
+            if (rest == 0) {
+                run = 64 - bit;
+                break;
+            }
+            size_t zeros = (size_t) __builtin_ctzll(rest);
+            run += zeros;
+            if (run > largest) {
+                largest = run;
+                largest_at = i * 64 + bit + zeros - run;
+            }
+            run = 0;
+            bit += zeros;
+
+            uint64_t ones = ~(w >> bit);
+            bit += (ones == 0) ? 64 - bit : (size_t) __builtin_ctzll(ones);
+        }
+    }
+    if (run > largest) {
+        largest = run;
+        largest_at = pool_mgr->bitmap_words * 64 - run;
+    }
+
+    pool_mgr->bitmap_largest = largest;
+    pool_mgr->bitmap_largest_at = largest_at;
+    return largest;
+}
+
+// the first block of the segment (allocation or gap) holding block
+static size_t _mem_bitmap_segment_start(pool_mgr_pt pool_mgr, size_t block) {
+    if (_mem_bitmap_test(pool_mgr->bitmap_used, block)) {
+        while (!_mem_bitmap_test(pool_mgr->bitmap_start, block))
+            --block;
+    }
+    else {
+        while (block > 0 && !_mem_bitmap_test(pool_mgr->bitmap_used, block - 1))
+            --block;
+    }
+
+    return block;
+}
@@ -6,10 +6,20 @@
 #define DENVER_OS_PA_C_MEM_POOL_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mem_hist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /* type declarations */
 
-typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
+typedef enum _alloc_policy { FIRST_FIT, BEST_FIT, BITMAP, WORST_FIT } alloc_policy; // registered policies follow
+
+#define MEM_POOL_BITMAP_BLOCK 64    // BITMAP pools hand out whole blocks of this size
 
 typedef struct _pool {
     char *mem;
@@ -30,13 +40,121 @@ typedef struct _pool_segment {
     unsigned long allocated; // 1-allocation, 0-gap (note: 8 bytes)
 } pool_segment_t, *pool_segment_pt;
 
+typedef struct _pool_frag_stats {
+    size_t largest_gap;
+    size_t free_size;
+    unsigned num_gaps;
+    double ext_frag;    // 1 - largest_gap / free_size (0-no fragmentation)
+    size_t high_water;  // peak offset from mem of the end of any allocation
+} pool_frag_stats_t, *pool_frag_stats_pt;
+
+#define MEM_POOL_SEARCH_BUCKETS 16
+
+#define MEM_POOL_TAGS 32    // allocation tags, 0 (untagged) to MEM_POOL_TAGS - 1
+
+typedef struct _pool_tag_stats {
+    size_t live_bytes;          // as counted in alloc_size
+    size_t peak_bytes;
+    unsigned long live_count;
+} pool_tag_stats_t, *pool_tag_stats_pt;
+
+#define MEM_POOL_SMALL_MAX 512  // largest request served by the small-object layer
+#define MEM_ALLOC_ID_SMALL 0x80000000u  // set in the ids of small objects (slab index << 6 | object)
+#define MEM_ALLOC_ID_GUARD 0x40000000u  // set in the ids of guarded allocations (slot index)
+
+typedef struct _pool_stats {
+    unsigned long num_allocs;
+    unsigned long num_frees;
+    unsigned long num_failures;     // failed allocations and deletions
+    unsigned long num_splits;       // allocations which left a remaining gap
+    unsigned long num_coalesces;    // gaps merged on deletion
+    unsigned long node_heap_resizes;
+    unsigned long gap_ix_resizes;
+    unsigned long num_moves;        // allocations moved by compaction
+    unsigned long bytes_moved;
+    unsigned long small_allocs;     // served from slabs (a new slab counts in num_allocs)
+    unsigned long small_frees;
+    unsigned long num_slabs;        // slabs carved out of the pool
+    unsigned long guarded_allocs;   // served from guard slots outside the pool
+    unsigned long guarded_frees;
+    unsigned long search_hist[MEM_POOL_SEARCH_BUCKETS]; // nodes visited per search, log2 buckets
+} pool_stats_t, *pool_stats_pt;
+
+typedef enum _pool_latency_op {
+    MEM_LAT_ALLOC,
+    MEM_LAT_DEL,
+    MEM_LAT_NODE_HEAP_RESIZE,
+    MEM_LAT_GAP_IX_RESIZE,
+    MEM_LAT_NUM_OPS
+} pool_latency_op;
+
+#define MEM_TRACE_NO_HANDLE 0xFFFFFFFFu
+
+typedef enum _pool_trace_op {
+    MEM_TRACE_OPEN,     // size-total_size, handle-policy
+    MEM_TRACE_ALLOC,    // size-requested size, handle-id of the new allocation
+    MEM_TRACE_DEL,      // size-allocation size, handle-id of the deleted allocation
+    MEM_TRACE_RESET,
+    MEM_TRACE_CLOSE,    // size-live allocations discarded by a forced close
+    MEM_TRACE_COMPACT   // size-budget
+} pool_trace_op;
+
+// binary trace record, written to the trace sink as is (host byte order)
+typedef struct _pool_trace_record {
+    uint64_t timestamp; // ns, CLOCK_MONOTONIC
+    uint64_t size;
+    uint32_t handle;
+    uint8_t op;         // pool_trace_op
+    uint8_t result;     // alloc_status
+    uint16_t reserved;
+} pool_trace_record_t, *pool_trace_record_pt;
+
+typedef enum _pool_profile_format {
+    MEM_PROFILE_FOLDED, // "root;...;leaf bytes" per stack, estimated live bytes, for flame graphs
+    MEM_PROFILE_PPROF   // legacy pprof heap profile (heap_v2) with the raw samples and the mappings
+} pool_profile_format;
+
+typedef struct _pool_cursor {
+    pool_pt pool;
+    unsigned next;      // opaque, the next segment to visit
+    size_t offset;      // offset from pool->mem of the last segment returned
+    size_t end;         // segments starting at or past this offset are not returned
+} pool_cursor_t, *pool_cursor_pt;
+
 typedef enum _alloc_status {
     ALLOC_OK,
     ALLOC_FAIL,
     ALLOC_CALLED_AGAIN,
-    ALLOC_NOT_FREED
+    ALLOC_NOT_FREED,
+    ALLOC_PARTIAL       // more work left, call again
 } alloc_status;
 
+// called for each allocation moved by mem_pool_compact, after alloc->mem is updated
+typedef void (*mem_move_fn)(alloc_pt alloc, char *old_mem, void *ctx);
+
+#define MEM_POLICY_MAX 16   // built-in and registered policies
+
+// a placement strategy over the gap index; all hooks but find_gap may be NULL
+typedef struct _pool_policy_ops {
+    const char *name;
+    // the position in gap_sizes (ascending, ties in address order) to allocate from, num_gaps if none
+    unsigned (*find_gap)(const size_t *gap_sizes, unsigned num_gaps, size_t size, void *ctx);
+    void (*on_split)(pool_pt pool, alloc_pt alloc, size_t remaining, void *ctx); // a gap is left after alloc
+    void (*on_free)(pool_pt pool, alloc_pt alloc, void *ctx);   // before alloc becomes a gap
+    void (*on_coalesce)(pool_pt pool, size_t size, void *ctx);  // two gaps merged into one of size
+    void *ctx;
+} pool_policy_ops_t;
+
+// options for mem_pool_open_ex; zero fields take the defaults
+typedef struct _pool_config {
+    unsigned expected_allocs;   // the node heap and gap index are sized for these up front
+    unsigned expected_gaps;
+    float fill_factor;          // the node heap and gap index grow past this usage
+    unsigned expand_factor;     // ... by this factor, and shrink by it
+    float shrink_factor;        // below this usage, negative-never shrink
+    int small_objects;          // see mem_pool_small_enable
+} pool_config_t, *pool_config_pt;
+
 /* function declarations */
 
 alloc_status
@@ -48,16 +166,160 @@ mem_free();
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+pool_pt
+mem_pool_open_ex(size_t size, alloc_policy policy, const pool_config_t *config); // NULL config-the defaults
+
+pool_pt
+mem_subpool_open(pool_pt parent, size_t size, alloc_policy policy); // a pool in a pinned allocation of parent
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
+alloc_status
+mem_pool_close_force(pool_pt pool); // closes the pool even with live allocations, not with open sub-pools
+
+/* reset discards all allocations, the pool is a single gap again; O(1), except that it is linear in
+ * the bitmaps of a BITMAP pool (a memset of 2 bits per block), the slabs of the small-object layer
+ * (their metadata is freed), the sample table of the heap profiler up to its last live sample, and
+ * the slots of guarded sampling (their free list is rebuilt, after one mprotect of the whole map) */
+
+alloc_status
+mem_pool_reset(pool_pt pool);
+
+alloc_status
+mem_pool_shrink_metadata(pool_pt pool); // gives back unused metadata capacity, records may move
+
+size_t
+mem_pool_metadata_size(pool_pt pool); // bytes of bookkeeping, not counting the pool itself
+
 alloc_pt
 mem_new_alloc(pool_pt pool, size_t size);
 
+alloc_pt
+mem_new_alloc_tagged(pool_pt pool, size_t size, unsigned tag); // NULL for a tag past MEM_POOL_TAGS
+
 alloc_status
 mem_del_alloc(pool_pt pool, alloc_pt alloc);
 
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
+void
+mem_pool_frag_stats(pool_pt pool, pool_frag_stats_pt stats); // O(1); for BITMAP, a rescan a word at a time after an allocation cut into the largest run
+
+alloc_status
+mem_pool_stats(pool_pt pool, pool_stats_pt stats); // ALLOC_FAIL unless built with MEM_POOL_STATS
+
+alloc_status
+mem_pool_tag_stats(pool_pt pool, unsigned tag, pool_tag_stats_pt stats); // O(1), always on
+
+/* latency histograms, in ticks of mem_hist_ticks(); ALLOC_FAIL/NULL unless built with MEM_POOL_LATENCY */
+
+alloc_status
+mem_pool_latency_enable(pool_pt pool, unsigned sample_every); // time 1 in sample_every calls
+
+alloc_status
+mem_pool_latency_disable(pool_pt pool);
+
+const mem_hist_t *
+mem_pool_latency(pool_pt pool, pool_latency_op op); // NULL if not enabled
+
+void
+mem_pool_latency_dump(pool_pt pool, FILE *out); // p50/p99/p999/max in ns
+
+/* sampling heap profiler: about one allocation per sample_bytes allocated keeps its stack;
+ * ALLOC_FAIL unless built with MEM_POOL_PROFILE */
+
+alloc_status
+mem_pool_profile_start(pool_pt pool, size_t sample_bytes);
+
+alloc_status
+mem_pool_profile_stop(pool_pt pool); // forgets the samples, also done by mem_pool_close*
+
+alloc_status
+mem_pool_profile_dump(pool_pt pool, FILE *out, pool_profile_format format); // the live samples by stack
+
+/* guarded sampling: about 1 in sample_every allocations of up to a page get a page of their own outside the pool,
+ * ending at an inaccessible page and made inaccessible on deletion, so that overflows and use after free fault
+ * with a report on stderr; ALLOC_FAIL unless built with MEM_POOL_GUARD */
+
+alloc_status
+mem_pool_guard_enable(pool_pt pool, unsigned sample_every, unsigned num_slots);
+
+alloc_status
+mem_pool_guard_disable(pool_pt pool); // ALLOC_NOT_FREED while guarded allocations are live
+
+const char *
+mem_policy_name(alloc_policy policy); // NULL past the last policy
+
+alloc_status
+mem_policy_from_name(const char *name, alloc_policy *policy);
+
+alloc_status
+mem_policy_register(const pool_policy_ops_t *ops, alloc_policy *policy); // not thread-safe, ops are copied
+
+/* stable allocation ids (node heap index), valid while the allocation is live */
+
+unsigned
+mem_alloc_id(pool_pt pool, alloc_pt alloc); // MEM_TRACE_NO_HANDLE if not a valid handle
+
+alloc_pt
+mem_alloc_from_id(pool_pt pool, unsigned id); // NULL if no live allocation has the id
+
+/* small-object layer: requests up to MEM_POOL_SMALL_MAX come from size-class slabs carved out of the pool */
+
+alloc_status
+mem_pool_small_enable(pool_pt pool);
+
+/* compaction: slides movable allocations toward the start of the pool, merging the gaps */
+
+alloc_status
+mem_alloc_pin(pool_pt pool, alloc_pt alloc); // never moved until unpinned or deleted
+
+alloc_status
+mem_alloc_unpin(pool_pt pool, alloc_pt alloc);
+
+alloc_status
+mem_pool_compact(pool_pt pool, mem_move_fn move_cb, void *ctx, size_t budget); // ALLOC_PARTIAL if out of budget, ALLOC_FAIL for BITMAP
+
+/* snapshots: the pool's metadata, and optionally its contents, as one pointer-free stream */
+
+alloc_status
+mem_pool_snapshot(pool_pt pool, int fd, int with_data); // ALLOC_FAIL with the small-object layer on
+
+pool_pt
+mem_pool_restore(int fd); // a new pool, NULL on a bad or short stream
+
+/* event tracing into a lock-free ring, flushed to sink (single producer, single flusher) */
+
+alloc_status
+mem_pool_trace_start(pool_pt pool, unsigned capacity, FILE *sink); // capacity a power of two
+
+alloc_status
+mem_pool_trace_flush(pool_pt pool);
+
+alloc_status
+mem_pool_trace_stop(pool_pt pool); // flushes, also done by mem_pool_close*
+
+unsigned long long
+mem_pool_trace_dropped(pool_pt pool);
+
+/* allocation-free inspection; a cursor is invalidated by any alloc/del on its pool */
+
+void
+mem_pool_cursor(pool_pt pool, pool_cursor_pt cursor);
+
+void
+mem_pool_cursor_range(pool_pt pool, pool_cursor_pt cursor, size_t start, size_t end);
+
+int
+mem_pool_cursor_next(pool_cursor_pt cursor, pool_segment_pt segment);
+
+unsigned
+mem_pool_cursor_fill(pool_cursor_pt cursor, pool_segment_pt segments, unsigned capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif //DENVER_OS_PA_C_MEM_POOL_H
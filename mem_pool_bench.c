@@ -0,0 +1,456 @@
+/*
+ * Synthetic throughput benchmark for the memory pool.
+ *
+ * Every combination of size distribution, free order and fill level is run
+ * against every allocation policy: the pool is filled to the fill level, then
+ * churned (free one, allocate one) at that level, then drained. Results are
+ * written one row per run as CSV or JSON.
+ *
+ * usage: mem_pool_bench [-s pool_size] [-n churn_ops] [-l fill,...] [-d dist,...]
+ *                       [-o order,...] [-p policy,...] [-r seed] [-F csv|json] [-S]
+ *                       [-P sample_bytes]
+ */
+
+#define _POSIX_C_SOURCE 200809L // for getopt()
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mem_pool.h"
+#include "mem_hist.h"
+
+
+
+/*************/
+/*           */
+/* Constants */
+/*           */
+/*************/
+static const size_t         BENCH_DEFAULT_POOL_SIZE     = 16 * 1024 * 1024;
+static const unsigned long  BENCH_DEFAULT_CHURN_OPS     = 100000;
+static const char *         BENCH_DEFAULT_FILLS         = "0.5,0.8,0.95";
+
+static const size_t         BENCH_UNIFORM_MIN           = 16;
+static const size_t         BENCH_UNIFORM_MAX           = 1024;
+static const size_t         BENCH_POWERLAW_MIN          = 16;
+static const size_t         BENCH_POWERLAW_MAX          = 64 * 1024;
+static const double         BENCH_POWERLAW_ALPHA        = 1.2;
+static const size_t         BENCH_BIMODAL_SMALL_MAX     = 64;
+static const size_t         BENCH_BIMODAL_LARGE_MIN     = 4096;
+static const size_t         BENCH_BIMODAL_LARGE_MAX     = 16384;
+static const double         BENCH_BIMODAL_LARGE_RATIO   = 0.1;
+
+#define BENCH_MAX_FILLS 16
+
+
+
+/*********************/
+/*                   */
+/* Type declarations */
+/*                   */
+/*********************/
+typedef enum _bench_dist { DIST_UNIFORM, DIST_POWERLAW, DIST_BIMODAL, NUM_DISTS } bench_dist;
+typedef enum _bench_order { ORDER_LIFO, ORDER_FIFO, ORDER_RANDOM, NUM_ORDERS } bench_order;
+typedef enum _bench_format { FORMAT_CSV, FORMAT_JSON } bench_format;
+
+static const char *dist_names[NUM_DISTS] = { "uniform", "powerlaw", "bimodal" };
+static const char *order_names[NUM_ORDERS] = { "lifo", "fifo", "random" };
+
+// live allocations, as a ring so that both ends can be popped
+typedef struct _bench_live {
+    unsigned *ids;
+    size_t *sizes;
+    size_t capacity;
+    size_t head;    // oldest
+    size_t count;
+    size_t bytes;
+} bench_live_t, *bench_live_pt;
+
+typedef struct _bench_result {
+    unsigned long ops;
+    unsigned long failures;
+    unsigned long long elapsed_ns;
+    mem_hist_t alloc_hist;
+    mem_hist_t del_hist;
+    pool_frag_stats_t churn_frag;   // at the end of the churn phase
+} bench_result_t, *bench_result_pt;
+
+
+
+/***************************/
+/*                         */
+/* Static global variables */
+/*                         */
+/***************************/
+static unsigned long long bench_rng_state = 0x9E3779B97F4A7C15ull;
+static int bench_small = 0; // serve small requests from slabs (mem_pool_small_enable)
+static size_t bench_profile = 0; // sampling interval in bytes, 0-no profiling (mem_pool_profile_start)
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+// xorshift64*
+static unsigned long long bench_rand() {
+    bench_rng_state ^= bench_rng_state >> 12;
+    bench_rng_state ^= bench_rng_state << 25;
+    bench_rng_state ^= bench_rng_state >> 27;
+    return bench_rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+// uniform in [0, 1)
+static double bench_rand_unit() {
+    return (double) (bench_rand() >> 11) / (double) (1ull << 53);
+}
+
+static size_t bench_rand_range(size_t min, size_t max) {
+    return min + (size_t) (bench_rand() % (max - min + 1));
+}
+
+static size_t bench_size(bench_dist dist) {
+    switch (dist) {
+        case DIST_UNIFORM:
+            return bench_rand_range(BENCH_UNIFORM_MIN, BENCH_UNIFORM_MAX);
+        case DIST_POWERLAW: {
+            // Pareto by inverse transform, capped
+            double size = (double) BENCH_POWERLAW_MIN
+                          * pow(1.0 - bench_rand_unit(), -1.0 / BENCH_POWERLAW_ALPHA);
+            return (size < (double) BENCH_POWERLAW_MAX) ? (size_t) size : BENCH_POWERLAW_MAX;
+        }
+        case DIST_BIMODAL:
+        default:
+            if (bench_rand_unit() < BENCH_BIMODAL_LARGE_RATIO)
+                return bench_rand_range(BENCH_BIMODAL_LARGE_MIN, BENCH_BIMODAL_LARGE_MAX);
+            return bench_rand_range(BENCH_UNIFORM_MIN, BENCH_BIMODAL_SMALL_MAX);
+    }
+}
+
+static int bench_live_init(bench_live_pt live, size_t capacity) {
+    live->ids = malloc(capacity * sizeof(unsigned));
+    live->sizes = malloc(capacity * sizeof(size_t));
+    live->capacity = capacity;
+    live->head = 0;
+    live->count = 0;
+    live->bytes = 0;
+    return (live->ids != NULL && live->sizes != NULL) ? 0 : -1;
+}
+
+static void bench_live_free(bench_live_pt live) {
+    free(live->ids);
+    free(live->sizes);
+}
+
+static void bench_live_push(bench_live_pt live, unsigned id, size_t size) {
+    size_t slot = (live->head + live->count) % live->capacity;
+    live->ids[slot] = id;
+    live->sizes[slot] = size;
+    live->count += 1;
+    live->bytes += size;
+}
+
+static unsigned bench_live_pop(bench_live_pt live, bench_order order) {
+    size_t slot;
+
+    if (order == ORDER_FIFO) {
+        slot = live->head;
+        live->head = (live->head + 1) % live->capacity;
+    }
+    else {
+        // LIFO takes the newest; random swaps a random one into the newest slot first
+        slot = (live->head + live->count - 1) % live->capacity;
+        if (order == ORDER_RANDOM) {
+            size_t pick = (live->head + (size_t) (bench_rand() % live->count)) % live->capacity;
+            unsigned id = live->ids[pick];
+            size_t size = live->sizes[pick];
+            live->ids[pick] = live->ids[slot];
+            live->sizes[pick] = live->sizes[slot];
+            live->ids[slot] = id;
+            live->sizes[slot] = size;
+        }
+    }
+
+    live->count -= 1;
+    live->bytes -= live->sizes[slot];
+    return live->ids[slot];
+}
+
+static int bench_alloc(pool_pt pool, bench_live_pt live, bench_dist dist, bench_result_pt result) {
+    size_t size = bench_size(dist);
+
+    if (live->count == live->capacity) {
+        result->failures += 1;
+        return -1;
+    }
+
+    unsigned long long t0 = mem_hist_ticks();
+    alloc_pt alloc = mem_new_alloc(pool, size);
+    mem_hist_record(&result->alloc_hist, mem_hist_ticks() - t0);
+    result->ops += 1;
+
+    if (alloc == NULL) {
+        result->failures += 1;
+        return -1;
+    }
+
+    bench_live_push(live, mem_alloc_id(pool, alloc), size);
+    return 0;
+}
+
+static void bench_del(pool_pt pool, bench_live_pt live, bench_order order, bench_result_pt result) {
+    alloc_pt alloc = mem_alloc_from_id(pool, bench_live_pop(live, order));
+
+    unsigned long long t0 = mem_hist_ticks();
+    mem_del_alloc(pool, alloc);
+    mem_hist_record(&result->del_hist, mem_hist_ticks() - t0);
+    result->ops += 1;
+}
+
+static int bench_run(alloc_policy policy, bench_dist dist, bench_order order, double fill,
+                     size_t pool_size, unsigned long churn_ops, bench_result_pt result) {
+    bench_live_t live;
+    size_t target = (size_t) (fill * (double) pool_size);
+
+    memset(result, 0, sizeof(bench_result_t));
+    mem_hist_reset(&result->alloc_hist);
+    mem_hist_reset(&result->del_hist);
+
+    // no allocation is smaller than the smallest size, so this bounds the live set
+    if (bench_live_init(&live, pool_size / BENCH_UNIFORM_MIN + 1) != 0)
+        return -1;
+
+    pool_pt pool = mem_pool_open(pool_size, policy);
+    if (pool == NULL) {
+        bench_live_free(&live);
+        return -1;
+    }
+    if (bench_small)
+        mem_pool_small_enable(pool);
+    if (bench_profile)
+        mem_pool_profile_start(pool, bench_profile);
+
+    unsigned long long start = mem_hist_clock_ns();
+
+    // fill
+    while (live.bytes < target) {
+        if (bench_alloc(pool, &live, dist, result) != 0)
+            break;
+    }
+
+    // churn around the fill level
+    for (unsigned long op = 0; op < churn_ops; ++op) {
+        if (live.count > 0 && live.bytes >= target)
+            bench_del(pool, &live, order, result);
+        else
+            bench_alloc(pool, &live, dist, result);
+    }
+    mem_pool_frag_stats(pool, &result->churn_frag);
+
+    // drain
+    while (live.count > 0)
+        bench_del(pool, &live, order, result);
+
+    result->elapsed_ns = mem_hist_clock_ns() - start;
+
+    mem_pool_close(pool);
+    bench_live_free(&live);
+
+    return 0;
+}
+
+static void bench_print(bench_format format, int first, alloc_policy policy, bench_dist dist,
+                        bench_order order, double fill, const bench_result_t *result) {
+    double ns_per_tick = mem_hist_ns_per_tick();
+    double secs = (double) result->elapsed_ns / 1e9;
+    double ops_per_sec = (secs > 0.0) ? (double) result->ops / secs : 0.0;
+
+    if (format == FORMAT_CSV) {
+        printf("%s,%s,%s,%.2f,%lu,%lu,%.3f,%.0f,%.1f,%.1f,%.1f,%.1f,%.6f,%u,%zu\n",
+               mem_policy_name(policy), dist_names[dist], order_names[order], fill,
+               result->ops, result->failures, secs, ops_per_sec,
+               (double) mem_hist_percentile(&result->alloc_hist, 0.50) * ns_per_tick,
+               (double) mem_hist_percentile(&result->alloc_hist, 0.99) * ns_per_tick,
+               (double) mem_hist_percentile(&result->del_hist, 0.50) * ns_per_tick,
+               (double) mem_hist_percentile(&result->del_hist, 0.99) * ns_per_tick,
+               result->churn_frag.ext_frag, result->churn_frag.num_gaps,
+               result->churn_frag.high_water);
+    }
+    else {
+        printf("%s\n  {\"policy\": \"%s\", \"dist\": \"%s\", \"order\": \"%s\", \"fill\": %.2f, "
+               "\"ops\": %lu, \"failures\": %lu, \"secs\": %.3f, \"ops_per_sec\": %.0f, "
+               "\"alloc_p50_ns\": %.1f, \"alloc_p99_ns\": %.1f, "
+               "\"del_p50_ns\": %.1f, \"del_p99_ns\": %.1f, "
+               "\"ext_frag\": %.6f, \"num_gaps\": %u, \"high_water\": %zu}",
+               first ? "" : ",",
+               mem_policy_name(policy), dist_names[dist], order_names[order], fill,
+               result->ops, result->failures, secs, ops_per_sec,
+               (double) mem_hist_percentile(&result->alloc_hist, 0.50) * ns_per_tick,
+               (double) mem_hist_percentile(&result->alloc_hist, 0.99) * ns_per_tick,
+               (double) mem_hist_percentile(&result->del_hist, 0.50) * ns_per_tick,
+               (double) mem_hist_percentile(&result->del_hist, 0.99) * ns_per_tick,
+               result->churn_frag.ext_frag, result->churn_frag.num_gaps,
+               result->churn_frag.high_water);
+    }
+    fflush(stdout);
+}
+
+// is name in the comma-separated list (NULL matches everything)
+static int bench_selected(const char *list, const char *name) {
+    if (list == NULL)
+        return 1;
+
+    size_t len = strlen(name);
+    for (const char *p = list; *p != '\0'; ) {
+        const char *comma = strchr(p, ',');
+        size_t n = (comma != NULL) ? (size_t) (comma - p) : strlen(p);
+        if (n == len && strncmp(p, name, n) == 0)
+            return 1;
+        if (comma == NULL)
+            break;
+        p = comma + 1;
+    }
+    return 0;
+}
+
+static void bench_usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-s pool_size] [-n churn_ops] [-l fill,...] [-d dist,...]\n"
+            "          [-o order,...] [-p policy,...] [-r seed] [-F csv|json] [-S]\n"
+            "          [-P sample_bytes]\n"
+            "  -s  pool size in bytes (default: %zu)\n"
+            "  -n  churn operations per run (default: %lu)\n"
+            "  -l  fill levels as fractions of the pool (default: %s)\n"
+            "  -d  size distributions: uniform, powerlaw, bimodal (default: all)\n"
+            "  -o  free orders: lifo, fifo, random (default: all)\n"
+            "  -p  allocation policies (default: all)\n"
+            "  -r  random seed\n"
+            "  -F  output format (default: csv)\n"
+            "  -S  serve requests up to %d bytes from size-class slabs\n"
+            "  -P  sample about one allocation per sample_bytes with the heap profiler\n",
+            prog, BENCH_DEFAULT_POOL_SIZE, BENCH_DEFAULT_CHURN_OPS, BENCH_DEFAULT_FILLS,
+            MEM_POOL_SMALL_MAX);
+}
+
+
+
+/********/
+/*      */
+/* main */
+/*      */
+/********/
+int main(int argc, char *argv[]) {
+    size_t pool_size = BENCH_DEFAULT_POOL_SIZE;
+    unsigned long churn_ops = BENCH_DEFAULT_CHURN_OPS;
+    const char *fill_list = BENCH_DEFAULT_FILLS;
+    const char *dist_list = NULL;
+    const char *order_list = NULL;
+    const char *policy_list = NULL;
+    bench_format format = FORMAT_CSV;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:l:d:o:p:r:F:SP:h")) != -1) {
+        switch (opt) {
+            case 's':
+                pool_size = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                churn_ops = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                fill_list = optarg;
+                break;
+            case 'd':
+                dist_list = optarg;
+                break;
+            case 'o':
+                order_list = optarg;
+                break;
+            case 'p':
+                policy_list = optarg;
+                break;
+            case 'r':
+                bench_rng_state = strtoull(optarg, NULL, 0) | 1;
+                break;
+            case 'S':
+                bench_small = 1;
+                break;
+            case 'P':
+                bench_profile = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            case 'F':
+                if (strcmp(optarg, "json") == 0)
+                    format = FORMAT_JSON;
+                else if (strcmp(optarg, "csv") == 0)
+                    format = FORMAT_CSV;
+                else {
+                    bench_usage(argv[0]);
+                    return 2;
+                }
+                break;
+            default:
+                bench_usage(argv[0]);
+                return 2;
+        }
+    }
+
+    double fills[BENCH_MAX_FILLS];
+    unsigned num_fills = 0;
+    for (char *p = (char *) fill_list; *p != '\0' && num_fills < BENCH_MAX_FILLS; ) {
+        char *end;
+        double fill = strtod(p, &end);
+        if (end == p || fill <= 0.0 || fill > 1.0) {
+            fprintf(stderr, "bad fill level list: %s\n", fill_list);
+            return 2;
+        }
+        fills[num_fills++] = fill;
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    if (format == FORMAT_CSV)
+        printf("policy,dist,order,fill,ops,failures,secs,ops_per_sec,"
+               "alloc_p50_ns,alloc_p99_ns,del_p50_ns,del_p99_ns,ext_frag,num_gaps,high_water\n");
+    else
+        printf("[");
+
+    int first = 1;
+    int status = 0;
+    for (int d = 0; d < NUM_DISTS; ++d) {
+        if (!bench_selected(dist_list, dist_names[d]))
+            continue;
+        for (int o = 0; o < NUM_ORDERS; ++o) {
+            if (!bench_selected(order_list, order_names[o]))
+                continue;
+            for (unsigned f = 0; f < num_fills; ++f) {
+                for (int p = 0; mem_policy_name((alloc_policy) p) != NULL; ++p) {
+                    if (!bench_selected(policy_list, mem_policy_name((alloc_policy) p)))
+                        continue;
+
+                    bench_result_t result;
+                    mem_init();
+                    if (bench_run((alloc_policy) p, (bench_dist) d, (bench_order) o, fills[f],
+                                  pool_size, churn_ops, &result) != 0) {
+                        fprintf(stderr, "run failed: %s %s %s %.2f\n", mem_policy_name((alloc_policy) p),
+                                dist_names[d], order_names[o], fills[f]);
+                        status = 1;
+                    }
+                    else {
+                        bench_print(format, first, (alloc_policy) p, (bench_dist) d,
+                                    (bench_order) o, fills[f], &result);
+                        first = 0;
+                    }
+                    mem_free();
+                }
+            }
+        }
+    }
+
+    if (format == FORMAT_JSON)
+        printf("\n]\n");
+
+    return status;
+}
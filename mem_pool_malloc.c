@@ -0,0 +1,285 @@
+/*
+ * malloc/free interposition shim backed by a single memory pool.
+ *
+ *   LD_PRELOAD=./libmem_pool_malloc.so program ...
+ *
+ * Environment:
+ *   MEM_POOL_SHIM_SIZE     pool size in bytes (default 1 GiB, reserved lazily by the OS)
+ *   MEM_POOL_SHIM_POLICY   allocation policy name (default best_fit)
+ *   MEM_POOL_SHIM_SMALL    1 to serve small requests from size-class slabs
+ *
+ * The pool library itself calls malloc/realloc/free for its metadata, so
+ * every call into it is made with a thread-local depth counter raised, and
+ * nested calls are passed straight to glibc's __libc_* entry points. The
+ * same happens when the pool is full. free() tells pool blocks from glibc
+ * blocks by address, so both can be freed through it.
+ */
+
+#define _GNU_SOURCE // for RTLD_NEXT
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem_pool.h"
+
+
+
+/*************/
+/*           */
+/* Constants */
+/*           */
+/*************/
+static const size_t     SHIM_DEFAULT_POOL_SIZE  = (size_t) 1 << 30;
+static const size_t     SHIM_ALIGNMENT          = 16;   // what malloc() guarantees on x86-64
+
+
+
+/*********************/
+/*                   */
+/* Type declarations */
+/*                   */
+/*********************/
+// sits right before every pointer handed out from the pool, keeps it 16-aligned
+typedef struct _shim_header {
+    uint32_t id;        // mem_alloc_id() of the allocation
+    uint32_t offset;    // from the start of the allocation to the user pointer
+    uint64_t usable;    // bytes usable from the user pointer
+} shim_header_t, *shim_header_pt;
+
+_Static_assert(sizeof(shim_header_t) == 16, "shim header must preserve 16-byte alignment");
+
+
+
+/*****************************************/
+/*                                       */
+/* glibc entry points (never interposed) */
+/*                                       */
+/*****************************************/
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+
+
+/***************************/
+/*                         */
+/* Static global variables */
+/*                         */
+/***************************/
+static pthread_mutex_t shim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pool_pt shim_pool = NULL;
+static int shim_failed = 0;             // the pool could not be opened, glibc only
+static char *shim_mem_begin = NULL;     // pool.mem range, read without the lock
+static char *shim_mem_end = NULL;
+// initial-exec: the first touch of a dynamic TLS block may itself call malloc
+static _Thread_local int shim_depth __attribute__((tls_model("initial-exec"))) = 0;
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+static void shim_atfork_prepare() { pthread_mutex_lock(&shim_lock); }
+static void shim_atfork_release() { pthread_mutex_unlock(&shim_lock); }
+
+// called with the lock held and shim_depth raised
+static void shim_init() {
+    size_t size = SHIM_DEFAULT_POOL_SIZE;
+    alloc_policy policy = BEST_FIT;
+    const char *env;
+
+    if ((env = getenv("MEM_POOL_SHIM_SIZE")) != NULL && strtoull(env, NULL, 0) > 0)
+        size = (size_t) strtoull(env, NULL, 0);
+    if ((env = getenv("MEM_POOL_SHIM_POLICY")) != NULL)
+        mem_policy_from_name(env, &policy);
+
+    if (mem_init() != ALLOC_OK || (shim_pool = mem_pool_open(size, policy)) == NULL) {
+        shim_failed = 1;
+        return;
+    }
+
+    if ((env = getenv("MEM_POOL_SHIM_SMALL")) != NULL && strcmp(env, "1") == 0)
+        mem_pool_small_enable(shim_pool);
+
+    shim_mem_begin = shim_pool->mem;
+    shim_mem_end = shim_pool->mem + shim_pool->total_size;
+    pthread_atfork(shim_atfork_prepare, shim_atfork_release, shim_atfork_release);
+}
+
+static int shim_owns(const void *ptr) {
+    return (const char *) ptr >= shim_mem_begin && (const char *) ptr < shim_mem_end;
+}
+
+static shim_header_pt shim_header(void *ptr) {
+    return (shim_header_pt) ((char *) ptr - sizeof(shim_header_t));
+}
+
+// alignment is a power of two, at least SHIM_ALIGNMENT; NULL if the pool can't serve it
+static void *shim_pool_alloc(size_t size, size_t alignment) {
+    void *ptr = NULL;
+
+    // room for the header, the alignment slack, and a 16-byte multiple overall
+    size_t slack = alignment - SHIM_ALIGNMENT;
+    if (size > SIZE_MAX - sizeof(shim_header_t) - slack - SHIM_ALIGNMENT)
+        return NULL;
+    size_t total = (sizeof(shim_header_t) + slack + size + SHIM_ALIGNMENT - 1) & ~(SHIM_ALIGNMENT - 1);
+
+    pthread_mutex_lock(&shim_lock);
+    shim_depth += 1;
+
+    if (shim_pool == NULL && !shim_failed)
+        shim_init();
+
+    if (shim_pool != NULL) {
+        alloc_pt alloc = mem_new_alloc(shim_pool, total);
+        if (alloc != NULL) {
+            uintptr_t user = ((uintptr_t) alloc->mem + sizeof(shim_header_t) + alignment - 1)
+                             & ~((uintptr_t) alignment - 1);
+            ptr = (void *) user;
+
+            shim_header_pt header = shim_header(ptr);
+            header->id = mem_alloc_id(shim_pool, alloc);
+            header->offset = (uint32_t) (user - (uintptr_t) alloc->mem);
+            header->usable = total - header->offset;
+        }
+    }
+
+    shim_depth -= 1;
+    pthread_mutex_unlock(&shim_lock);
+
+    return ptr;
+}
+
+static void shim_pool_free(void *ptr) {
+    uint32_t id = shim_header(ptr)->id;
+
+    pthread_mutex_lock(&shim_lock);
+    shim_depth += 1;
+
+    mem_del_alloc(shim_pool, mem_alloc_from_id(shim_pool, id));
+
+    shim_depth -= 1;
+    pthread_mutex_unlock(&shim_lock);
+}
+
+static void *shim_alloc(size_t size, size_t alignment) {
+    if (shim_depth > 0)
+        return (alignment > SHIM_ALIGNMENT) ? __libc_memalign(alignment, size) : __libc_malloc(size);
+
+    void *ptr = shim_pool_alloc(size, alignment);
+    if (ptr == NULL)
+        ptr = (alignment > SHIM_ALIGNMENT) ? __libc_memalign(alignment, size) : __libc_malloc(size);
+
+    return ptr;
+}
+
+
+
+/***************************************/
+/*                                     */
+/* Definitions of interposed functions */
+/*                                     */
+/***************************************/
+void *malloc(size_t size) {
+    void *ptr = shim_alloc(size, SHIM_ALIGNMENT);
+
+    if (ptr == NULL)
+        errno = ENOMEM;
+    return ptr;
+}
+
+void free(void *ptr) {
+    if (ptr == NULL)
+        return;
+
+    if (shim_owns(ptr))
+        shim_pool_free(ptr);
+    else
+        __libc_free(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (shim_depth > 0)
+        return __libc_calloc(nmemb, size);
+
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // pool memory is recycled, so it has to be cleared
+    void *ptr = shim_pool_alloc(nmemb * size, SHIM_ALIGNMENT);
+    if (ptr != NULL)
+        memset(ptr, 0, nmemb * size);
+    else
+        ptr = __libc_calloc(nmemb, size);
+
+    if (ptr == NULL)
+        errno = ENOMEM;
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL)
+        return malloc(size);
+
+    if (!shim_owns(ptr))
+        return __libc_realloc(ptr, size);
+
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    // shrinking, or growing within the rounding slack, stays in place
+    size_t usable = (size_t) shim_header(ptr)->usable;
+    if (size <= usable)
+        return ptr;
+
+    void *moved = malloc(size);
+    if (moved == NULL)
+        return NULL;
+    memcpy(moved, ptr, usable);
+    free(ptr);
+
+    return moved;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+
+    void *ptr = shim_alloc(size, (alignment > SHIM_ALIGNMENT) ? alignment : SHIM_ALIGNMENT);
+    if (ptr == NULL)
+        return ENOMEM;
+
+    *memptr = ptr;
+    return 0;
+}
+
+size_t malloc_usable_size(void *ptr) {
+    static size_t (*libc_usable_size)(void *) = NULL;
+
+    if (ptr == NULL)
+        return 0;
+
+    if (shim_owns(ptr))
+        return (size_t) shim_header(ptr)->usable;
+
+    // glibc has no __libc_ alias for this one
+    if (libc_usable_size == NULL) {
+        shim_depth += 1;
+        libc_usable_size = (size_t (*)(void *)) dlsym(RTLD_NEXT, "malloc_usable_size");
+        shim_depth -= 1;
+    }
+
+    return (libc_usable_size != NULL) ? libc_usable_size(ptr) : 0;
+}
@@ -0,0 +1,438 @@
+/*
+ * Multi-threaded scaling benchmark for the memory pool.
+ *
+ * For 1, 2, 4, ... up to the maximum number of threads, three patterns:
+ *   private   each thread allocates and frees on a pool of its own
+ *   shared    all threads share one pool behind a mutex
+ *   prodcons  producer threads allocate, consumer threads free what they
+ *             receive through a lock-free queue (cross-thread free),
+ *             all on one pool behind a mutex
+ * and report throughput, the time spent waiting for the pool lock, and
+ * the cache misses counted by perf_event_open (n/a where it is not allowed).
+ *
+ * usage: mem_pool_mt_bench [-t max_threads] [-n ops_per_thread] [-p policy] [-s pool_size]
+ */
+
+#define _GNU_SOURCE // for syscall()
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "mem_pool.h"
+#include "mem_hist.h"
+
+
+
+/*************/
+/*           */
+/* Constants */
+/*           */
+/*************/
+static const unsigned long  MT_DEFAULT_OPS          = 200000;   // per thread
+static const size_t         MT_DEFAULT_POOL_SIZE    = 64 * 1024 * 1024;
+static const unsigned       MT_WINDOW               = 1024;     // live allocations per thread
+static const size_t         MT_MIN_SIZE             = 16;
+static const size_t         MT_MAX_SIZE             = 512;
+
+#define MT_QUEUE_CAPACITY 4096 // per producer/consumer pair, a power of two
+
+
+
+/*********************/
+/*                   */
+/* Type declarations */
+/*                   */
+/*********************/
+typedef enum _mt_pattern { MT_PRIVATE, MT_SHARED, MT_PRODCONS, MT_NUM_PATTERNS } mt_pattern;
+
+static const char *pattern_names[MT_NUM_PATTERNS] = { "private", "shared", "prodcons" };
+
+// single-producer single-consumer queue of allocation ids
+typedef struct _mt_queue {
+    atomic_ulong head;
+    char pad0[64 - sizeof(atomic_ulong)];
+    atomic_ulong tail;
+    char pad1[64 - sizeof(atomic_ulong)];
+    unsigned ids[MT_QUEUE_CAPACITY];
+} mt_queue_t, *mt_queue_pt;
+
+typedef struct _mt_thread {
+    pthread_t thread;
+    mt_pattern pattern;
+    int producer;                   // prodcons only
+    pool_pt pool;
+    pthread_mutex_t *lock;          // NULL for private pools
+    mt_queue_pt queue;              // prodcons only
+    unsigned long ops_target;
+    unsigned long long rng;
+    // results
+    unsigned long ops;
+    unsigned long failures;
+    unsigned long long lock_wait_ticks;
+    long long cache_misses;         // -1 if not available
+} mt_thread_t, *mt_thread_pt;
+
+
+
+/***************************/
+/*                         */
+/* Static global variables */
+/*                         */
+/***************************/
+static atomic_int mt_start = 0;
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+static unsigned long long mt_rand(mt_thread_pt t) {
+    t->rng ^= t->rng >> 12;
+    t->rng ^= t->rng << 25;
+    t->rng ^= t->rng >> 27;
+    return t->rng * 0x2545F4914F6CDD1Dull;
+}
+
+static size_t mt_size(mt_thread_pt t) {
+    return MT_MIN_SIZE + (size_t) (mt_rand(t) % (MT_MAX_SIZE - MT_MIN_SIZE + 1));
+}
+
+static int mt_perf_open() {
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    // this thread, any cpu
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void mt_perf_start(int fd) {
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    (void) fd;
+#endif
+}
+
+static long long mt_perf_stop(int fd) {
+    long long count = -1;
+
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+            count = -1;
+        close(fd);
+    }
+#else
+    (void) fd;
+#endif
+
+    return count;
+}
+
+static void mt_lock(mt_thread_pt t) {
+    if (t->lock == NULL)
+        return;
+
+    unsigned long long t0 = mem_hist_ticks();
+    pthread_mutex_lock(t->lock);
+    t->lock_wait_ticks += mem_hist_ticks() - t0;
+}
+
+static void mt_unlock(mt_thread_pt t) {
+    if (t->lock != NULL)
+        pthread_mutex_unlock(t->lock);
+}
+
+static unsigned mt_alloc(mt_thread_pt t) {
+    size_t size = mt_size(t);
+    unsigned id = MEM_TRACE_NO_HANDLE;
+
+    mt_lock(t);
+    alloc_pt alloc = mem_new_alloc(t->pool, size);
+    if (alloc != NULL)
+        id = mem_alloc_id(t->pool, alloc);
+    mt_unlock(t);
+
+    t->ops += 1;
+    if (id == MEM_TRACE_NO_HANDLE)
+        t->failures += 1;
+    return id;
+}
+
+static void mt_free(mt_thread_pt t, unsigned id) {
+    mt_lock(t);
+    mem_del_alloc(t->pool, mem_alloc_from_id(t->pool, id));
+    mt_unlock(t);
+
+    t->ops += 1;
+}
+
+// private and shared: a window of live allocations, replaced at random
+static void mt_run_window(mt_thread_pt t) {
+    unsigned window[MT_WINDOW];
+
+    for (unsigned w = 0; w < MT_WINDOW; ++w)
+        window[w] = mt_alloc(t);
+
+    while (t->ops < t->ops_target) {
+        unsigned w = (unsigned) (mt_rand(t) % MT_WINDOW);
+        if (window[w] != MEM_TRACE_NO_HANDLE)
+            mt_free(t, window[w]);
+        window[w] = mt_alloc(t);
+    }
+
+    for (unsigned w = 0; w < MT_WINDOW; ++w) {
+        if (window[w] != MEM_TRACE_NO_HANDLE)
+            mt_free(t, window[w]);
+    }
+}
+
+static void mt_run_producer(mt_thread_pt t) {
+    mt_queue_pt q = t->queue;
+
+    while (t->ops < t->ops_target) {
+        unsigned long head = atomic_load_explicit(&q->head, memory_order_relaxed);
+        while (head - atomic_load_explicit(&q->tail, memory_order_acquire) >= MT_QUEUE_CAPACITY)
+            sched_yield();
+
+        unsigned id = mt_alloc(t);
+        if (id == MEM_TRACE_NO_HANDLE)
+            continue;
+
+        q->ids[head & (MT_QUEUE_CAPACITY - 1)] = id;
+        atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    }
+
+    // tell the consumer we are done
+    unsigned long head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&q->tail, memory_order_acquire) >= MT_QUEUE_CAPACITY)
+        sched_yield();
+    q->ids[head & (MT_QUEUE_CAPACITY - 1)] = MEM_TRACE_NO_HANDLE;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+}
+
+static void mt_run_consumer(mt_thread_pt t) {
+    mt_queue_pt q = t->queue;
+
+    for (;;) {
+        unsigned long tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        while (atomic_load_explicit(&q->head, memory_order_acquire) == tail)
+            sched_yield();
+
+        unsigned id = q->ids[tail & (MT_QUEUE_CAPACITY - 1)];
+        atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+        if (id == MEM_TRACE_NO_HANDLE)
+            break;
+        mt_free(t, id);
+    }
+}
+
+static void *mt_thread_main(void *arg) {
+    mt_thread_pt t = arg;
+    int perf_fd = mt_perf_open();
+
+    while (!atomic_load(&mt_start))
+        ;
+
+    mt_perf_start(perf_fd);
+    if (t->pattern != MT_PRODCONS)
+        mt_run_window(t);
+    else if (t->producer)
+        mt_run_producer(t);
+    else
+        mt_run_consumer(t);
+    t->cache_misses = mt_perf_stop(perf_fd);
+
+    return NULL;
+}
+
+static int mt_run(mt_pattern pattern, unsigned num_threads, unsigned long ops,
+                  alloc_policy policy, size_t pool_size) {
+    mt_thread_pt threads = calloc(num_threads, sizeof(mt_thread_t));
+    pool_pt *pools = calloc(num_threads, sizeof(pool_pt));
+    mt_queue_pt queues = NULL;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    int status = 0;
+
+    if (threads == NULL || pools == NULL)
+        return -1;
+    if (pattern == MT_PRODCONS) {
+        queues = aligned_alloc(64, (num_threads / 2) * sizeof(mt_queue_t));
+        if (queues == NULL)
+            return -1;
+    }
+
+    // the pool store is not thread-safe, so all pools are opened up front
+    unsigned num_pools = (pattern == MT_PRIVATE) ? num_threads : 1;
+    mem_init();
+    for (unsigned p = 0; p < num_pools; ++p) {
+        pools[p] = mem_pool_open(pool_size, policy);
+        if (pools[p] == NULL)
+            status = -1;
+    }
+
+    for (unsigned i = 0; i < num_threads && status == 0; ++i) {
+        mt_thread_pt t = &threads[i];
+        t->pattern = pattern;
+        t->pool = pools[(pattern == MT_PRIVATE) ? i : 0];
+        t->lock = (pattern == MT_PRIVATE) ? NULL : &lock;
+        t->ops_target = ops;
+        t->rng = 0x9E3779B97F4A7C15ull * (i + 1);
+        if (pattern == MT_PRODCONS) {
+            // thread 2k produces for thread 2k+1
+            t->producer = (i % 2 == 0);
+            t->queue = &queues[i / 2];
+            atomic_init(&t->queue->head, 0);
+            atomic_init(&t->queue->tail, 0);
+        }
+    }
+
+    atomic_store(&mt_start, 0);
+    for (unsigned i = 0; i < num_threads && status == 0; ++i)
+        pthread_create(&threads[i].thread, NULL, mt_thread_main, &threads[i]);
+
+    unsigned long long start = mem_hist_clock_ns();
+    atomic_store(&mt_start, 1);
+    for (unsigned i = 0; i < num_threads && status == 0; ++i)
+        pthread_join(threads[i].thread, NULL);
+    unsigned long long elapsed = mem_hist_clock_ns() - start;
+
+    if (status == 0) {
+        unsigned long total_ops = 0, failures = 0;
+        unsigned long long lock_wait = 0;
+        long long cache_misses = 0;
+        for (unsigned i = 0; i < num_threads; ++i) {
+            total_ops += threads[i].ops;
+            failures += threads[i].failures;
+            lock_wait += threads[i].lock_wait_ticks;
+            cache_misses = (threads[i].cache_misses < 0 || cache_misses < 0)
+                           ? -1 : cache_misses + threads[i].cache_misses;
+        }
+
+        double secs = (double) elapsed / 1e9;
+        double ops_per_sec = (double) total_ops / secs;
+        double lock_wait_ns = (double) lock_wait * mem_hist_ns_per_tick();
+
+        printf("%s,%s,%u,%lu,%lu,%.3f,%.0f,%.0f,%.0f,%.1f,",
+               pattern_names[pattern], mem_policy_name(policy), num_threads, total_ops, failures,
+               secs, ops_per_sec, ops_per_sec / num_threads,
+               lock_wait_ns / 1e3, 100.0 * lock_wait_ns / (1e9 * secs * num_threads));
+        if (cache_misses >= 0)
+            printf("%lld\n", cache_misses);
+        else
+            printf("n/a\n");
+        fflush(stdout);
+    }
+
+    for (unsigned p = 0; p < num_pools; ++p) {
+        if (pools[p] != NULL)
+            mem_pool_close_force(pools[p]);
+    }
+    mem_free();
+
+    free(queues);
+    free(pools);
+    free(threads);
+
+    return status;
+}
+
+static void mt_usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-t max_threads] [-n ops_per_thread] [-p policy] [-s pool_size]\n"
+            "  -t  maximum thread count, runs 1, 2, 4, ... up to it (default: online cpus)\n"
+            "  -n  operations per thread (default: %lu)\n"
+            "  -p  allocation policy (default: best_fit)\n"
+            "  -s  size of each pool in bytes (default: %zu)\n",
+            prog, MT_DEFAULT_OPS, MT_DEFAULT_POOL_SIZE);
+}
+
+
+
+/********/
+/*      */
+/* main */
+/*      */
+/********/
+int main(int argc, char *argv[]) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned max_threads = (cpus > 0) ? (unsigned) cpus : 1;
+    unsigned long ops = MT_DEFAULT_OPS;
+    alloc_policy policy = BEST_FIT;
+    size_t pool_size = MT_DEFAULT_POOL_SIZE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:p:s:h")) != -1) {
+        switch (opt) {
+            case 't':
+                max_threads = (unsigned) strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                ops = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                if (mem_policy_from_name(optarg, &policy) != ALLOC_OK) {
+                    fprintf(stderr, "unknown policy: %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 's':
+                pool_size = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            default:
+                mt_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (max_threads == 0) {
+        mt_usage(argv[0]);
+        return 2;
+    }
+
+    printf("pattern,policy,threads,ops,failures,secs,ops_per_sec,ops_per_sec_per_thread,"
+           "lock_wait_us,lock_wait_pct,cache_misses\n");
+
+    int status = 0;
+    for (int pattern = 0; pattern < MT_NUM_PATTERNS; ++pattern) {
+        for (unsigned n = 1; n <= max_threads; n *= 2) {
+            // producer/consumer needs pairs
+            if (pattern == MT_PRODCONS && n < 2)
+                continue;
+            if (mt_run((mt_pattern) pattern, n, ops, policy, pool_size) != 0) {
+                fprintf(stderr, "run failed: %s with %u threads\n", pattern_names[pattern], n);
+                status = 1;
+            }
+        }
+    }
+
+    return status;
+}
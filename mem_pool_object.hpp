@@ -0,0 +1,210 @@
+/*
+ * Typed object pools and an STL allocator over a memory pool (C++17, header only).
+ *
+ *   mem_pool::object_pool<node> nodes(pool);
+ *   auto n = nodes.make(1, 2);     // object_pool<node>::handle, deleted when it goes
+ *
+ *   std::vector<int, mem_pool::pool_allocator<int>> v(mem_pool::pool_allocator<int>(pool));
+ *
+ * An object_pool<T> with sizeof(T) up to MEM_POOL_SMALL_MAX keeps a free
+ * list of T-sized slots of its own, in slabs of slab_objects carved out of
+ * the pool with one pinned mem_new_alloc() each, so that make() and the
+ * handle's deletion are a few inlined instructions. Larger types get one
+ * pinned allocation per object, deleted through mem_del_alloc(). Sizes,
+ * alignments and the choice of path are all compile-time constants.
+ *
+ * Slabs are given back to the pool when the object_pool is destroyed, which
+ * must outlive its handles. Like the pool, none of this is thread-safe.
+ */
+
+#ifndef DENVER_OS_PA_C_MEM_POOL_OBJECT_HPP
+#define DENVER_OS_PA_C_MEM_POOL_OBJECT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <utility>
+
+#include "mem_pool.h"
+#include "mem_pool_resource.hpp"
+
+namespace mem_pool {
+
+template <typename T>
+class object_pool {
+public:
+    static constexpr bool slab_path = sizeof(T) <= MEM_POOL_SMALL_MAX;
+    // a free slot holds the next free slot
+    static constexpr std::size_t slot_align = alignof(T) > alignof(void *) ? alignof(T) : alignof(void *);
+    static constexpr std::size_t slot_size = ((sizeof(T) > sizeof(void *) ? sizeof(T) : sizeof(void *))
+                                              + slot_align - 1) / slot_align * slot_align;
+    static constexpr std::size_t slab_objects = slot_size < 4096 / 8 ? 4096 / slot_size : 8;  // about a page
+
+    // owns one object, like std::unique_ptr, and deletes it back into its pool
+    class handle {
+    public:
+        handle() noexcept = default;
+        handle(handle &&other) noexcept : pool_(other.pool_), object_(other.release()) {}
+        handle &operator=(handle &&other) noexcept {
+            if (this != &other) {
+                reset();
+                pool_ = other.pool_;
+                object_ = other.release();
+            }
+            return *this;
+        }
+        handle(const handle &) = delete;
+        handle &operator=(const handle &) = delete;
+        ~handle() { reset(); }
+
+        T *get() const noexcept { return object_; }
+        T &operator*() const noexcept { return *object_; }
+        T *operator->() const noexcept { return object_; }
+        explicit operator bool() const noexcept { return object_ != nullptr; }
+
+        // the object is then the caller's, to give to object_pool::destroy()
+        T *release() noexcept {
+            T *object = object_;
+            object_ = nullptr;
+            return object;
+        }
+
+        void reset() noexcept {
+            if (object_ != nullptr)
+                pool_->destroy(release());
+        }
+
+    private:
+        friend class object_pool;
+        handle(object_pool *pool, T *object) noexcept : pool_(pool), object_(object) {}
+
+        object_pool *pool_ = nullptr;
+        T *object_ = nullptr;
+    };
+
+    explicit object_pool(pool_pt pool) noexcept : pool_(pool) {}
+    object_pool(const object_pool &) = delete;
+    object_pool &operator=(const object_pool &) = delete;
+
+    ~object_pool() {
+        for (slab_header *slab = slabs_; slab != nullptr; ) {
+            slab_header *next = slab->next;
+            mem_del_alloc(pool_, mem_alloc_from_id(pool_, slab->id));
+            slab = next;
+        }
+    }
+
+    pool_pt pool() const noexcept { return pool_; }
+
+    // throws std::bad_alloc if the pool is full, and whatever T's constructor throws
+    template <typename... Args>
+    handle make(Args &&... args) {
+        void *slot = allocate();
+        if (slot == nullptr)
+            throw std::bad_alloc();
+        try {
+            return handle(this, ::new (slot) T(std::forward<Args>(args)...));
+        } catch (...) {
+            deallocate(slot);
+            throw;
+        }
+    }
+
+    void destroy(T *object) noexcept {
+        object->~T();
+        deallocate(object);
+    }
+
+private:
+    // at the start of a slab, then the slots
+    struct slab_header {
+        slab_header *next;
+        std::uint32_t id;       // of the slab's pool allocation
+    };
+
+    static constexpr std::size_t slab_header_size = (sizeof(slab_header) + slot_align - 1) / slot_align * slot_align;
+
+    void *allocate() noexcept {
+        if constexpr (slab_path) {
+            if (free_ == nullptr && !refill())
+                return nullptr;
+            void *slot = free_;
+            free_ = *static_cast<void **>(slot);
+            return slot;
+        } else {
+            return detail::allocate_block(pool_, sizeof(T), alignof(T));
+        }
+    }
+
+    void deallocate(void *slot) noexcept {
+        if constexpr (slab_path) {
+            *static_cast<void **>(slot) = free_;
+            free_ = slot;
+        } else {
+            detail::deallocate_block(pool_, slot);
+        }
+    }
+
+    // a new slab, pinned since the handles point into it, its slots onto the free list
+    bool refill() noexcept {
+        alloc_pt record = mem_new_alloc(pool_, slot_align - 1 + slab_header_size + slab_objects * slot_size);
+        if (record == nullptr)
+            return false;
+        mem_alloc_pin(pool_, record);
+
+        std::uintptr_t base = (reinterpret_cast<std::uintptr_t>(record->mem) + slot_align - 1)
+                              & ~static_cast<std::uintptr_t>(slot_align - 1);
+        slab_header *slab = ::new (reinterpret_cast<void *>(base)) slab_header{slabs_, mem_alloc_id(pool_, record)};
+        slabs_ = slab;
+
+        char *slots = reinterpret_cast<char *>(base) + slab_header_size;
+        for (std::size_t i = slab_objects; i-- > 0; ) {
+            *reinterpret_cast<void **>(slots + i * slot_size) = free_;
+            free_ = slots + i * slot_size;
+        }
+        return true;
+    }
+
+    pool_pt pool_;
+    void *free_ = nullptr;          // the free slots, lowest address first in a new slab
+    slab_header *slabs_ = nullptr;
+};
+
+// for the standard containers: one pinned pool allocation per allocate(), as for pool_resource
+template <typename T>
+class pool_allocator {
+public:
+    using value_type = T;
+
+    explicit pool_allocator(pool_pt pool) noexcept : pool_(pool) {}
+    template <typename U>
+    pool_allocator(const pool_allocator<U> &other) noexcept : pool_(other.pool()) {}
+
+    pool_pt pool() const noexcept { return pool_; }
+
+    T *allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+        void *ptr = detail::allocate_block(pool_, n * sizeof(T), alignof(T));
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, std::size_t) noexcept {
+        detail::deallocate_block(pool_, ptr);
+    }
+
+    template <typename U>
+    bool operator==(const pool_allocator<U> &other) const noexcept { return pool_ == other.pool(); }
+    template <typename U>
+    bool operator!=(const pool_allocator<U> &other) const noexcept { return pool_ != other.pool(); }
+
+private:
+    pool_pt pool_;
+};
+
+} // namespace mem_pool
+
+#endif //DENVER_OS_PA_C_MEM_POOL_OBJECT_HPP
@@ -0,0 +1,346 @@
+/*
+ * Replays a binary allocation trace (see mem_pool_trace_start) against
+ * one or all allocation policies and reports throughput, latency,
+ * the pool size actually needed, and fragmentation over time.
+ *
+ * usage: mem_pool_replay [-p policy|all] [-s pool_size] [-i interval] [-f frag.csv] trace
+ */
+
+#define _POSIX_C_SOURCE 200809L // for getopt()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mem_pool.h"
+#include "mem_hist.h"
+
+
+
+/*************/
+/*           */
+/* Constants */
+/*           */
+/*************/
+static const unsigned long REPLAY_DEFAULT_INTERVAL = 10000; // ops between fragmentation samples
+
+
+
+/*********************/
+/*                   */
+/* Type declarations */
+/*                   */
+/*********************/
+typedef struct _replay_trace {
+    pool_trace_record_pt records;
+    size_t num_records;
+    size_t pool_size;       // from the first MEM_TRACE_OPEN record
+    unsigned max_handle;        // of the node heap allocations
+    unsigned max_small_handle;  // of the small objects, without MEM_ALLOC_ID_SMALL
+    unsigned max_guard_handle;  // of the guarded allocations, without MEM_ALLOC_ID_GUARD
+} replay_trace_t, *replay_trace_pt;
+
+typedef struct _replay_result {
+    unsigned long ops;
+    unsigned long failures;     // allocations that succeeded in the trace but not here
+    unsigned long skipped;      // records without an effect (failed in the trace, etc.)
+    unsigned long long elapsed_ns;
+    mem_hist_t alloc_hist;
+    mem_hist_t del_hist;
+    pool_frag_stats_t final;
+    size_t high_water;
+    double peak_ext_frag;
+} replay_result_t, *replay_result_pt;
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+static int replay_load(const char *path, replay_trace_pt trace) {
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    // read the whole trace, growing the array as needed
+    size_t capacity = 1024;
+    trace->records = malloc(capacity * sizeof(pool_trace_record_t));
+    trace->num_records = 0;
+    trace->pool_size = 0;
+    trace->max_handle = 0;
+    trace->max_small_handle = 0;
+    trace->max_guard_handle = 0;
+
+    while (trace->records != NULL) {
+        size_t n = fread(&trace->records[trace->num_records], sizeof(pool_trace_record_t),
+                         capacity - trace->num_records, in);
+        trace->num_records += n;
+        if (trace->num_records < capacity)
+            break;
+        capacity *= 2;
+        pool_trace_record_pt records = realloc(trace->records, capacity * sizeof(pool_trace_record_t));
+        if (records == NULL)
+            free(trace->records);
+        trace->records = records;
+    }
+    fclose(in);
+
+    if (trace->records == NULL) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        return -1;
+    }
+
+    for (size_t r = 0; r < trace->num_records; ++r) {
+        const pool_trace_record_t *rec = &trace->records[r];
+        if (rec->op == MEM_TRACE_OPEN && trace->pool_size == 0)
+            trace->pool_size = (size_t) rec->size;
+        if (rec->handle == MEM_TRACE_NO_HANDLE
+            || (rec->op != MEM_TRACE_ALLOC && rec->op != MEM_TRACE_DEL))
+            continue;
+        unsigned index = rec->handle & ~(MEM_ALLOC_ID_SMALL | MEM_ALLOC_ID_GUARD);
+        if (rec->handle & MEM_ALLOC_ID_SMALL) {
+            if (index > trace->max_small_handle)
+                trace->max_small_handle = index;
+        }
+        else if (rec->handle & MEM_ALLOC_ID_GUARD) {
+            if (index > trace->max_guard_handle)
+                trace->max_guard_handle = index;
+        }
+        else if (index > trace->max_handle)
+            trace->max_handle = index;
+    }
+
+    return 0;
+}
+
+// small-object ids go after the node heap ids, and guard slot ids after those
+static size_t replay_slot(const replay_trace_t *trace, unsigned handle) {
+    if (handle & MEM_ALLOC_ID_SMALL)
+        return (size_t) trace->max_handle + 1 + (handle & ~MEM_ALLOC_ID_SMALL);
+    if (handle & MEM_ALLOC_ID_GUARD)
+        return (size_t) trace->max_handle + 1 + (size_t) trace->max_small_handle + 1
+               + (handle & ~MEM_ALLOC_ID_GUARD);
+    return handle;
+}
+
+static void replay_sample(FILE *frag_out, alloc_policy policy, unsigned long op,
+                          pool_pt pool, replay_result_pt result) {
+    pool_frag_stats_t stats;
+
+    mem_pool_frag_stats(pool, &stats);
+    if (stats.ext_frag > result->peak_ext_frag)
+        result->peak_ext_frag = stats.ext_frag;
+
+    if (frag_out != NULL)
+        fprintf(frag_out, "%s,%lu,%u,%zu,%zu,%.6f,%zu\n",
+                mem_policy_name(policy), op, stats.num_gaps, stats.largest_gap,
+                stats.free_size, stats.ext_frag, stats.high_water);
+}
+
+static int replay_run(const replay_trace_t *trace, alloc_policy policy, size_t pool_size,
+                      unsigned long interval, FILE *frag_out, replay_result_pt result) {
+    // trace handle -> id of the allocation standing in for it in this replay
+    size_t num_slots = (size_t) trace->max_handle + 1 + (size_t) trace->max_small_handle + 1
+                       + (size_t) trace->max_guard_handle + 1;
+    unsigned *live = malloc(num_slots * sizeof(unsigned));
+    if (live == NULL)
+        return -1;
+    for (size_t h = 0; h < num_slots; ++h)
+        live[h] = MEM_TRACE_NO_HANDLE;
+
+    memset(result, 0, sizeof(replay_result_t));
+    mem_hist_reset(&result->alloc_hist);
+    mem_hist_reset(&result->del_hist);
+
+    pool_pt pool = mem_pool_open(pool_size, policy);
+    if (pool == NULL) {
+        free(live);
+        return -1;
+    }
+
+    unsigned long long start = mem_hist_clock_ns();
+
+    for (size_t r = 0; r < trace->num_records; ++r) {
+        const pool_trace_record_t *rec = &trace->records[r];
+
+        if (rec->op == MEM_TRACE_ALLOC) {
+            // only what the traced program actually got has a matching delete
+            if (rec->result != ALLOC_OK) {
+                result->skipped += 1;
+                continue;
+            }
+            unsigned long long t0 = mem_hist_ticks();
+            alloc_pt alloc = mem_new_alloc(pool, (size_t) rec->size);
+            mem_hist_record(&result->alloc_hist, mem_hist_ticks() - t0);
+
+            if (alloc != NULL)
+                live[replay_slot(trace, rec->handle)] = mem_alloc_id(pool, alloc);
+            else
+                result->failures += 1;
+        }
+        else if (rec->op == MEM_TRACE_DEL) {
+            size_t slot = replay_slot(trace, rec->handle);
+            if (rec->result != ALLOC_OK || live[slot] == MEM_TRACE_NO_HANDLE) {
+                result->skipped += 1;
+                continue;
+            }
+            alloc_pt alloc = mem_alloc_from_id(pool, live[slot]);
+            live[slot] = MEM_TRACE_NO_HANDLE;
+
+            unsigned long long t0 = mem_hist_ticks();
+            mem_del_alloc(pool, alloc);
+            mem_hist_record(&result->del_hist, mem_hist_ticks() - t0);
+        }
+        else if (rec->op == MEM_TRACE_COMPACT) {
+            // ids survive compaction, so the handle map stays as it is
+            mem_pool_compact(pool, NULL, NULL, (size_t) rec->size);
+        }
+        else if (rec->op == MEM_TRACE_RESET) {
+            mem_pool_reset(pool);
+            for (size_t h = 0; h < num_slots; ++h)
+                live[h] = MEM_TRACE_NO_HANDLE;
+        }
+        else {
+            // open and close records frame the trace
+            result->skipped += 1;
+            continue;
+        }
+
+        result->ops += 1;
+        if (interval > 0 && result->ops % interval == 0)
+            replay_sample(frag_out, policy, result->ops, pool, result);
+    }
+
+    result->elapsed_ns = mem_hist_clock_ns() - start;
+
+    replay_sample(frag_out, policy, result->ops, pool, result);
+    mem_pool_frag_stats(pool, &result->final);
+    result->high_water = result->final.high_water;
+
+    mem_pool_close_force(pool);
+    free(live);
+
+    return 0;
+}
+
+static void replay_report(alloc_policy policy, const replay_result_t *result) {
+    double ns_per_tick = mem_hist_ns_per_tick();
+    double secs = (double) result->elapsed_ns / 1e9;
+
+    printf("policy %s\n", mem_policy_name(policy));
+    printf("  ops              %lu (%lu failed, %lu skipped)\n",
+           result->ops, result->failures, result->skipped);
+    printf("  throughput       %.0f ops/sec\n", (secs > 0.0) ? (double) result->ops / secs : 0.0);
+    printf("  peak pool size   %zu bytes\n", result->high_water);
+    printf("  fragmentation    final %.4f, peak %.4f, %u gaps, largest %zu of %zu free\n",
+           result->final.ext_frag, result->peak_ext_frag, result->final.num_gaps,
+           result->final.largest_gap, result->final.free_size);
+    printf("  latency (ns)\n");
+    mem_hist_print(&result->alloc_hist, stdout, "    alloc", ns_per_tick);
+    mem_hist_print(&result->del_hist, stdout, "    del", ns_per_tick);
+}
+
+static void replay_usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-p policy|all] [-s pool_size] [-i interval] [-f frag.csv] trace\n"
+            "  -p  allocation policy to replay against (default: all)\n"
+            "  -s  pool size in bytes (default: the size in the trace)\n"
+            "  -i  ops between fragmentation samples (default: %lu, 0: only at the end)\n"
+            "  -f  write the fragmentation time series as CSV\n",
+            prog, REPLAY_DEFAULT_INTERVAL);
+}
+
+
+
+/********/
+/*      */
+/* main */
+/*      */
+/********/
+int main(int argc, char *argv[]) {
+    const char *policy_name = "all";
+    const char *frag_path = NULL;
+    size_t pool_size = 0;
+    unsigned long interval = REPLAY_DEFAULT_INTERVAL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:s:i:f:h")) != -1) {
+        switch (opt) {
+            case 'p':
+                policy_name = optarg;
+                break;
+            case 's':
+                pool_size = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            case 'i':
+                interval = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                frag_path = optarg;
+                break;
+            default:
+                replay_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        replay_usage(argv[0]);
+        return 2;
+    }
+
+    alloc_policy only = FIRST_FIT;
+    int all = (strcmp(policy_name, "all") == 0);
+    if (!all && mem_policy_from_name(policy_name, &only) != ALLOC_OK) {
+        fprintf(stderr, "unknown policy: %s\n", policy_name);
+        return 2;
+    }
+
+    replay_trace_t trace;
+    if (replay_load(argv[optind], &trace) != 0)
+        return 1;
+    if (pool_size == 0)
+        pool_size = trace.pool_size;
+    if (pool_size == 0) {
+        fprintf(stderr, "%s: no open record, pass the pool size with -s\n", argv[optind]);
+        return 1;
+    }
+
+    FILE *frag_out = NULL;
+    if (frag_path != NULL) {
+        frag_out = fopen(frag_path, "w");
+        if (frag_out == NULL) {
+            perror(frag_path);
+            return 1;
+        }
+        fprintf(frag_out, "policy,op,num_gaps,largest_gap,free_size,ext_frag,high_water\n");
+    }
+
+    printf("trace %s: %zu records, pool size %zu\n", argv[optind], trace.num_records, pool_size);
+
+    mem_init();
+    int status = 0;
+    for (int p = 0; mem_policy_name((alloc_policy) p) != NULL; ++p) {
+        if (!all && p != (int) only)
+            continue;
+
+        replay_result_t result;
+        if (replay_run(&trace, (alloc_policy) p, pool_size, interval, frag_out, &result) != 0) {
+            fprintf(stderr, "replay against %s failed\n", mem_policy_name((alloc_policy) p));
+            status = 1;
+            continue;
+        }
+        replay_report((alloc_policy) p, &result);
+    }
+    mem_free();
+
+    if (frag_out != NULL)
+        fclose(frag_out);
+    free(trace.records);
+
+    return status;
+}
@@ -0,0 +1,94 @@
+/*
+ * std::pmr::memory_resource over a memory pool (C++17, header only).
+ *
+ *   pool_pt pool = mem_pool_open(1 << 20, BEST_FIT);
+ *   mem_pool::pool_resource resource(pool);
+ *   std::pmr::vector<int> v(&resource);
+ *
+ * Every block carries the allocation id in the 4 bytes right before the
+ * pointer handed out, so deallocation finds the record in O(1) with
+ * mem_alloc_from_id(). Blocks are pinned, since the containers hold raw
+ * pointers into them, so mem_pool_compact() leaves them where they are.
+ * The resource does not own the pool, and like the
+ * pool it is not thread-safe. A pool with containers still on it may be
+ * torn down in one go with mem_pool_close_force() or mem_pool_reset(), as
+ * long as the containers are not destroyed (or deallocate) afterwards.
+ */
+
+#ifndef DENVER_OS_PA_C_MEM_POOL_RESOURCE_HPP
+#define DENVER_OS_PA_C_MEM_POOL_RESOURCE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <new>
+
+#include "mem_pool.h"
+
+namespace mem_pool {
+
+namespace detail {
+
+// one pinned pool allocation holding bytes at alignment, with the id right before the pointer
+// returned; nullptr if the pool cannot serve it
+inline void *allocate_block(pool_pt pool, std::size_t bytes, std::size_t alignment) noexcept {
+    // room for the id in front, and for aligning the pointer after it
+    if (bytes > SIZE_MAX - sizeof(std::uint32_t) - alignment)
+        return nullptr;
+    alloc_pt alloc = mem_new_alloc(pool, bytes + sizeof(std::uint32_t) + alignment - 1);
+    if (alloc == nullptr)
+        return nullptr;
+    // fails for small objects and guarded blocks, which never move anyway
+    mem_alloc_pin(pool, alloc);
+
+    std::uintptr_t user = (reinterpret_cast<std::uintptr_t>(alloc->mem) + sizeof(std::uint32_t) + alignment - 1)
+                          & ~static_cast<std::uintptr_t>(alignment - 1);
+    char *ptr = reinterpret_cast<char *>(user);
+
+    // the id may be unaligned for alignments below 4
+    std::uint32_t id = mem_alloc_id(pool, alloc);
+    std::memcpy(ptr - sizeof(id), &id, sizeof(id));
+
+    return ptr;
+}
+
+inline void deallocate_block(pool_pt pool, void *ptr) noexcept {
+    std::uint32_t id;
+    std::memcpy(&id, static_cast<char *>(ptr) - sizeof(id), sizeof(id));
+    mem_del_alloc(pool, mem_alloc_from_id(pool, id));
+}
+
+} // namespace detail
+
+class pool_resource : public std::pmr::memory_resource {
+public:
+    explicit pool_resource(pool_pt pool) noexcept : pool_(pool) {}
+
+    pool_pt pool() const noexcept { return pool_; }
+
+protected:
+    // throws std::bad_alloc if the pool cannot serve the request
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        void *ptr = detail::allocate_block(pool_, bytes, alignment);
+        if (ptr == nullptr)
+            throw std::bad_alloc();
+        return ptr;
+    }
+
+    void do_deallocate(void *ptr, std::size_t, std::size_t) override {
+        detail::deallocate_block(pool_, ptr);
+    }
+
+    // blocks can be freed through any resource over the same pool
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        const pool_resource *resource = dynamic_cast<const pool_resource *>(&other);
+        return resource != nullptr && resource->pool_ == pool_;
+    }
+
+private:
+    pool_pt pool_;
+};
+
+} // namespace mem_pool
+
+#endif //DENVER_OS_PA_C_MEM_POOL_RESOURCE_HPP
@@ -0,0 +1,400 @@
+/*
+ * Fragmentation soak test for the memory pool.
+ *
+ * Runs millions of randomized alloc/free steps against one or all policies,
+ * holding the live bytes around a fill level. Most allocations are short-lived
+ * but a fraction lives much longer, which is what pins gaps in place over time.
+ * Every interval steps, the fragmentation of the pool and the failure rate
+ * since the previous sample are written as a CSV row.
+ *
+ * usage: mem_pool_soak [-p policy|all] [-s pool_size] [-n steps] [-i interval]
+ *                      [-l fill] [-L long_ratio] [-d dist] [-r seed] [-o out.csv]
+ */
+
+#define _POSIX_C_SOURCE 200809L // for getopt()
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mem_pool.h"
+#include "mem_hist.h"
+
+
+
+/*************/
+/*           */
+/* Constants */
+/*           */
+/*************/
+static const size_t         SOAK_DEFAULT_POOL_SIZE      = 1024 * 1024;
+static const unsigned long  SOAK_DEFAULT_STEPS          = 10000000;
+static const unsigned long  SOAK_DEFAULT_INTERVAL       = 100000;
+static const double         SOAK_DEFAULT_FILL           = 0.75;
+static const double         SOAK_DEFAULT_LONG_RATIO     = 0.05;
+static const double         SOAK_LONG_FREE_RATIO        = 0.01; // of the frees, how many hit long-lived
+
+static const size_t         SOAK_UNIFORM_MIN            = 16;
+static const size_t         SOAK_UNIFORM_MAX            = 1024;
+static const size_t         SOAK_POWERLAW_MIN           = 16;
+static const size_t         SOAK_POWERLAW_MAX           = 64 * 1024;
+static const double         SOAK_POWERLAW_ALPHA         = 1.2;
+static const size_t         SOAK_BIMODAL_SMALL_MAX      = 64;
+static const size_t         SOAK_BIMODAL_LARGE_MIN      = 4096;
+static const size_t         SOAK_BIMODAL_LARGE_MAX      = 16384;
+static const double         SOAK_BIMODAL_LARGE_RATIO    = 0.1;
+
+
+
+/*********************/
+/*                   */
+/* Type declarations */
+/*                   */
+/*********************/
+typedef enum _soak_dist { DIST_UNIFORM, DIST_POWERLAW, DIST_BIMODAL, NUM_DISTS } soak_dist;
+
+static const char *dist_names[NUM_DISTS] = { "uniform", "powerlaw", "bimodal" };
+
+// live allocations of one lifetime class, freed in random order
+typedef struct _soak_live {
+    unsigned *ids;
+    size_t *sizes;
+    size_t count;
+    size_t capacity;
+} soak_live_t, *soak_live_pt;
+
+typedef struct _soak_params {
+    size_t pool_size;
+    unsigned long steps;
+    unsigned long interval;
+    double fill;
+    double long_ratio;
+    soak_dist dist;
+    unsigned long long seed;
+} soak_params_t, *soak_params_pt;
+
+typedef struct _soak_result {
+    unsigned long allocs;
+    unsigned long failures;
+    unsigned long long elapsed_ns;
+    double worst_largest_over_free;     // lowest largest_gap / free_size seen
+    double peak_ext_frag;
+    unsigned peak_num_gaps;
+    pool_frag_stats_t final;
+} soak_result_t, *soak_result_pt;
+
+
+
+/***************************/
+/*                         */
+/* Static global variables */
+/*                         */
+/***************************/
+static unsigned long long soak_rng_state = 0x9E3779B97F4A7C15ull;
+
+
+
+/***********************************/
+/*                                 */
+/* Definitions of static functions */
+/*                                 */
+/***********************************/
+// xorshift64*
+static unsigned long long soak_rand() {
+    soak_rng_state ^= soak_rng_state >> 12;
+    soak_rng_state ^= soak_rng_state << 25;
+    soak_rng_state ^= soak_rng_state >> 27;
+    return soak_rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+// uniform in [0, 1)
+static double soak_rand_unit() {
+    return (double) (soak_rand() >> 11) / (double) (1ull << 53);
+}
+
+static size_t soak_rand_range(size_t min, size_t max) {
+    return min + (size_t) (soak_rand() % (max - min + 1));
+}
+
+static size_t soak_size(soak_dist dist) {
+    switch (dist) {
+        case DIST_UNIFORM:
+            return soak_rand_range(SOAK_UNIFORM_MIN, SOAK_UNIFORM_MAX);
+        case DIST_POWERLAW: {
+            // Pareto by inverse transform, capped
+            double size = (double) SOAK_POWERLAW_MIN
+                          * pow(1.0 - soak_rand_unit(), -1.0 / SOAK_POWERLAW_ALPHA);
+            return (size < (double) SOAK_POWERLAW_MAX) ? (size_t) size : SOAK_POWERLAW_MAX;
+        }
+        case DIST_BIMODAL:
+        default:
+            if (soak_rand_unit() < SOAK_BIMODAL_LARGE_RATIO)
+                return soak_rand_range(SOAK_BIMODAL_LARGE_MIN, SOAK_BIMODAL_LARGE_MAX);
+            return soak_rand_range(SOAK_UNIFORM_MIN, SOAK_BIMODAL_SMALL_MAX);
+    }
+}
+
+static int soak_live_push(soak_live_pt live, unsigned id, size_t size) {
+    if (live->count == live->capacity) {
+        size_t capacity = (live->capacity > 0) ? live->capacity * 2 : 1024;
+        unsigned *ids = realloc(live->ids, capacity * sizeof(unsigned));
+        if (ids == NULL)
+            return -1;
+        live->ids = ids;
+        size_t *sizes = realloc(live->sizes, capacity * sizeof(size_t));
+        if (sizes == NULL)
+            return -1;
+        live->sizes = sizes;
+        live->capacity = capacity;
+    }
+
+    live->ids[live->count] = id;
+    live->sizes[live->count] = size;
+    live->count += 1;
+    return 0;
+}
+
+// removes a random one, returning its id and size
+static unsigned soak_live_pop(soak_live_pt live, size_t *size) {
+    size_t pick = (size_t) (soak_rand() % live->count);
+    unsigned id = live->ids[pick];
+
+    *size = live->sizes[pick];
+    live->count -= 1;
+    live->ids[pick] = live->ids[live->count];
+    live->sizes[pick] = live->sizes[live->count];
+    return id;
+}
+
+static void soak_sample(FILE *out, alloc_policy policy, unsigned long step, pool_pt pool,
+                        const soak_live_t live[2], size_t live_bytes,
+                        unsigned long window_allocs, unsigned long window_failures,
+                        soak_result_pt result) {
+    pool_frag_stats_t stats;
+
+    mem_pool_frag_stats(pool, &stats);
+
+    double largest_over_free = (stats.free_size > 0)
+                               ? (double) stats.largest_gap / (double) stats.free_size : 1.0;
+    double failure_rate = (window_allocs > 0) ? (double) window_failures / (double) window_allocs : 0.0;
+
+    if (largest_over_free < result->worst_largest_over_free)
+        result->worst_largest_over_free = largest_over_free;
+    if (stats.ext_frag > result->peak_ext_frag)
+        result->peak_ext_frag = stats.ext_frag;
+    if (stats.num_gaps > result->peak_num_gaps)
+        result->peak_num_gaps = stats.num_gaps;
+
+    fprintf(out, "%s,%lu,%zu,%zu,%zu,%zu,%.6f,%u,%.6f,%lu,%lu,%.6f\n",
+            mem_policy_name(policy), step, live[0].count + live[1].count, live_bytes,
+            stats.free_size, stats.largest_gap, largest_over_free, stats.num_gaps,
+            stats.ext_frag, window_allocs, window_failures, failure_rate);
+}
+
+static int soak_run(const soak_params_t *params, alloc_policy policy, FILE *out,
+                    soak_result_pt result) {
+    soak_live_t live[2];    // short-lived, long-lived
+    size_t live_bytes = 0;
+    size_t target = (size_t) (params->fill * (double) params->pool_size);
+    unsigned long window_allocs = 0, window_failures = 0;
+    int status = 0;
+
+    memset(live, 0, sizeof(live));
+    memset(result, 0, sizeof(soak_result_t));
+    result->worst_largest_over_free = 1.0;
+
+    // every policy sees the same sequence of decisions until their failures differ
+    soak_rng_state = params->seed;
+
+    pool_pt pool = mem_pool_open(params->pool_size, policy);
+    if (pool == NULL)
+        return -1;
+
+    unsigned long long start = mem_hist_clock_ns();
+
+    for (unsigned long step = 1; step <= params->steps && status == 0; ++step) {
+        // allocate with probability 1 - live/(2 target), so the live bytes hover around the target
+        size_t count = live[0].count + live[1].count;
+        int do_alloc = (count == 0) || (soak_rand_unit() * 2.0 * (double) target > (double) live_bytes);
+
+        if (do_alloc) {
+            size_t size = soak_size(params->dist);
+            alloc_pt alloc = mem_new_alloc(pool, size);
+
+            result->allocs += 1;
+            window_allocs += 1;
+            if (alloc == NULL) {
+                result->failures += 1;
+                window_failures += 1;
+            }
+            else {
+                int lifetime = (soak_rand_unit() < params->long_ratio);
+                if (soak_live_push(&live[lifetime], mem_alloc_id(pool, alloc), size) != 0)
+                    status = -1;
+                live_bytes += size;
+            }
+        }
+        else {
+            // long-lived allocations are only rarely the ones to go
+            int lifetime = (live[0].count == 0)
+                           || (live[1].count > 0 && soak_rand_unit() < SOAK_LONG_FREE_RATIO);
+            size_t size;
+            unsigned id = soak_live_pop(&live[lifetime], &size);
+
+            mem_del_alloc(pool, mem_alloc_from_id(pool, id));
+            live_bytes -= size;
+        }
+
+        if (params->interval > 0 && step % params->interval == 0) {
+            soak_sample(out, policy, step, pool, live, live_bytes, window_allocs, window_failures, result);
+            window_allocs = 0;
+            window_failures = 0;
+        }
+    }
+
+    result->elapsed_ns = mem_hist_clock_ns() - start;
+    mem_pool_frag_stats(pool, &result->final);
+
+    mem_pool_close_force(pool);
+    for (int l = 0; l < 2; ++l) {
+        free(live[l].ids);
+        free(live[l].sizes);
+    }
+
+    return status;
+}
+
+static void soak_report(alloc_policy policy, const soak_result_t *result) {
+    double secs = (double) result->elapsed_ns / 1e9;
+
+    fprintf(stderr, "policy %s\n", mem_policy_name(policy));
+    fprintf(stderr, "  allocs           %lu (%lu failed, %.6f)\n", result->allocs, result->failures,
+            (result->allocs > 0) ? (double) result->failures / (double) result->allocs : 0.0);
+    fprintf(stderr, "  elapsed          %.3f s\n", secs);
+    fprintf(stderr, "  final            %u gaps, largest %zu of %zu free, ext_frag %.4f\n",
+            result->final.num_gaps, result->final.largest_gap, result->final.free_size,
+            result->final.ext_frag);
+    fprintf(stderr, "  worst            largest/free %.4f, ext_frag %.4f, %u gaps\n",
+            result->worst_largest_over_free, result->peak_ext_frag, result->peak_num_gaps);
+}
+
+static void soak_usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-p policy|all] [-s pool_size] [-n steps] [-i interval]\n"
+            "          [-l fill] [-L long_ratio] [-d dist] [-r seed] [-o out.csv]\n"
+            "  -p  allocation policy (default: all)\n"
+            "  -s  pool size in bytes (default: %zu)\n"
+            "  -n  alloc/free steps per policy (default: %lu)\n"
+            "  -i  steps between samples (default: %lu, 0: only the summary)\n"
+            "  -l  live bytes to hold, as a fraction of the pool (default: %.2f)\n"
+            "  -L  fraction of allocations which are long-lived (default: %.2f)\n"
+            "  -d  size distribution: uniform, powerlaw, bimodal (default: powerlaw)\n"
+            "  -r  random seed\n"
+            "  -o  write the time series here instead of stdout\n",
+            prog, SOAK_DEFAULT_POOL_SIZE, SOAK_DEFAULT_STEPS, SOAK_DEFAULT_INTERVAL,
+            SOAK_DEFAULT_FILL, SOAK_DEFAULT_LONG_RATIO);
+}
+
+
+
+/********/
+/*      */
+/* main */
+/*      */
+/********/
+int main(int argc, char *argv[]) {
+    soak_params_t params = {
+        SOAK_DEFAULT_POOL_SIZE, SOAK_DEFAULT_STEPS, SOAK_DEFAULT_INTERVAL,
+        SOAK_DEFAULT_FILL, SOAK_DEFAULT_LONG_RATIO, DIST_POWERLAW, soak_rng_state
+    };
+    const char *policy_name = "all";
+    const char *out_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:s:n:i:l:L:d:r:o:h")) != -1) {
+        switch (opt) {
+            case 'p':
+                policy_name = optarg;
+                break;
+            case 's':
+                params.pool_size = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                params.steps = strtoul(optarg, NULL, 0);
+                break;
+            case 'i':
+                params.interval = strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                params.fill = strtod(optarg, NULL);
+                break;
+            case 'L':
+                params.long_ratio = strtod(optarg, NULL);
+                break;
+            case 'd': {
+                int d = 0;
+                while (d < NUM_DISTS && strcmp(optarg, dist_names[d]) != 0)
+                    ++d;
+                if (d == NUM_DISTS) {
+                    fprintf(stderr, "unknown distribution: %s\n", optarg);
+                    return 2;
+                }
+                params.dist = (soak_dist) d;
+                break;
+            }
+            case 'r':
+                params.seed = strtoull(optarg, NULL, 0) | 1;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            default:
+                soak_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc || params.fill <= 0.0 || params.fill > 1.0
+        || params.long_ratio < 0.0 || params.long_ratio > 1.0) {
+        soak_usage(argv[0]);
+        return 2;
+    }
+
+    alloc_policy only = FIRST_FIT;
+    int all = (strcmp(policy_name, "all") == 0);
+    if (!all && mem_policy_from_name(policy_name, &only) != ALLOC_OK) {
+        fprintf(stderr, "unknown policy: %s\n", policy_name);
+        return 2;
+    }
+
+    FILE *out = stdout;
+    if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+        perror(out_path);
+        return 1;
+    }
+    fprintf(out, "policy,step,live_allocs,live_bytes,free_size,largest_gap,largest_over_free,"
+                 "num_gaps,ext_frag,window_allocs,window_failures,failure_rate\n");
+
+    mem_init();
+    int status = 0;
+    for (int p = 0; mem_policy_name((alloc_policy) p) != NULL; ++p) {
+        if (!all && p != (int) only)
+            continue;
+
+        soak_result_t result;
+        if (soak_run(&params, (alloc_policy) p, out, &result) != 0) {
+            fprintf(stderr, "soak against %s failed\n", mem_policy_name((alloc_policy) p));
+            status = 1;
+            continue;
+        }
+        fflush(out);
+        soak_report((alloc_policy) p, &result);
+    }
+    mem_free();
+
+    if (out != stdout)
+        fclose(out);
+
+    return status;
+}
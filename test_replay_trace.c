@@ -0,0 +1,72 @@
+/*
+ * Writes a trace for the mem_pool_replay test: node heap allocations,
+ * small objects and guarded allocations, all deleted again, so that the
+ * replay sees every kind of allocation id.
+ *
+ * usage: test_replay_trace trace
+ */
+
+#include <stdio.h>
+
+#include "mem_pool.h"
+
+
+
+/*************/
+/*           */
+/* Constants */
+/*           */
+/*************/
+static const size_t   TRACE_POOL_SIZE     = 1024 * 1024;
+static const unsigned TRACE_GUARD_SLOTS   = 8;
+static const unsigned TRACE_ALLOCS        = 300;   // of each size, the first ones guarded
+static const unsigned TRACE_CAPACITY      = 4096;  // records, more than are written
+
+
+
+/********/
+/*      */
+/* main */
+/*      */
+/********/
+int main(int argc, char *argv[]) {
+    static const size_t sizes[] = { 1000, 64 };   // node heap, small objects
+    unsigned ids[2][TRACE_ALLOCS];  // records move as the node heap grows, ids stay
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s trace\n", argv[0]);
+        return 2;
+    }
+
+    FILE *sink = fopen(argv[1], "wb");
+    if (sink == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    mem_init();
+    pool_pt pool = mem_pool_open(TRACE_POOL_SIZE, BEST_FIT);
+    if (pool == NULL
+        || mem_pool_small_enable(pool) != ALLOC_OK
+        || mem_pool_guard_enable(pool, 1, TRACE_GUARD_SLOTS) != ALLOC_OK
+        || mem_pool_trace_start(pool, TRACE_CAPACITY, sink) != ALLOC_OK) {
+        fprintf(stderr, "%s: cannot set up the pool\n", argv[0]);
+        return 1;
+    }
+
+    // every allocation is sampled, so the first ones take all the guard slots
+    for (unsigned s = 0; s < 2; ++s)
+        for (unsigned i = 0; i < TRACE_ALLOCS; ++i)
+            ids[s][i] = mem_alloc_id(pool, mem_new_alloc(pool, sizes[s]));
+    for (unsigned s = 0; s < 2; ++s)
+        for (unsigned i = 0; i < TRACE_ALLOCS; ++i)
+            if (ids[s][i] != MEM_TRACE_NO_HANDLE)
+                mem_del_alloc(pool, mem_alloc_from_id(pool, ids[s][i]));
+
+    int status = (mem_pool_trace_dropped(pool) == 0) ? 0 : 1;
+    mem_pool_close(pool);
+    mem_free();
+    fclose(sink);
+
+    return status;
+}
@@ -2,8 +2,14 @@
 // Created by Ivo Georgiev on 3/3/16.
 //
 
+#define _POSIX_C_SOURCE 200809L // for fileno(), lseek(), ftruncate(), fork()
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -153,6 +159,57 @@ static void test_pool_store_smoketest(void **state) {
     }
 }
 
+static void test_pool_store_growth(void **state) {
+    (void) state; /* unused */
+
+    // many more pools than the store starts with room for (20)
+    pool_pt pools[100];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    for (unsigned i = 0; i < 100; i++) {
+        pools[i] = mem_pool_open(1000, FIRST_FIT);
+        assert_non_null(pools[i]);
+        assert_non_null(mem_new_alloc(pools[i], 100));
+    }
+
+    // every pool is still there, and closes
+    for (unsigned i = 0; i < 100; i++) {
+        assert_int_equal(pools[i]->num_allocs, 1);
+        assert_int_equal(mem_pool_close_force(pools[i]), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_gap_ix_growth(void **state) {
+    (void) state; /* unused */
+
+    // more gaps than the gap index starts with room for (40)
+    alloc_pt allocs[900];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(900 * 100, FIRST_FIT);
+    assert_non_null(pool);
+
+    // the node heap last grows at about 480 nodes, and the records
+    // handed out before that have moved, so only the later ones are used
+    for (unsigned i = 0; i < 900; i++) {
+        allocs[i] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(pool->num_gaps, 0);
+
+    // every other one of the last 400 leaves 200 gaps
+    for (unsigned i = 500; i < 900; i += 2)
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 200);
+    assert_int_equal(pool->num_allocs, 700);
+
+    assert_int_equal(mem_pool_close_force(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
 static void test_pool_smoketest(void **state) {
     (void) state; /* unused */
 
@@ -2316,7 +2373,1457 @@ static void test_pool_scenario19(void **state) {
 }
 
 /*******************************************/
-/***          5. STRESS TEST             ***/
+/***        5. POOL MANAGEMENT           ***/
+/*******************************************/
+
+static void test_pool_reset(void **state) {
+    alloc_status status;
+    pool_pt pool = *state;
+
+    /*
+     * Reset:
+     *
+     * 1. Allocate and deallocate to leave several gaps.
+     * 2. Reset. Pool is a single gap again, with no allocations.
+     * 3. The pool is fully usable after the reset.
+     */
+
+    alloc_pt allocs[12];
+    for (unsigned u = 0; u < 12; ++u) {
+        allocs[u] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[u]);
+    }
+    for (unsigned u = 0; u < 12; u += 2) {
+        status = mem_del_alloc(pool, allocs[u]);
+        assert_int_equal(status, ALLOC_OK);
+    }
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 600, 6, 7);
+
+    status = mem_pool_reset(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_segment_t exp0[1] =
+            {
+                    {POOL_SIZE, 0}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    assert_ptr_equal(alloc0->mem, pool->mem);
+
+    pool_segment_t exp1[2] =
+            {
+                    {100, 1},
+                    {POOL_SIZE - 100, 0}
+            };
+    check_pool(pool, exp1);
+
+    status = mem_del_alloc(pool, alloc0);
+    assert_int_equal(status, ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+static void test_pool_cursor(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Cursors:
+     *
+     * 1. Allocate 100, 200, 300 and delete the 200, for 4 segments.
+     * 2. Walk the whole pool one segment at a time.
+     * 3. Fill a small caller buffer in batches.
+     * 4. Walk an address range which covers only the middle segments.
+     */
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    pool_segment_t exp[4] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {300, 1},
+                    {POOL_SIZE - 600, 0}
+            };
+
+    pool_cursor_t cursor;
+    pool_segment_t seg;
+    unsigned num = 0;
+
+    mem_pool_cursor(pool, &cursor);
+    while (mem_pool_cursor_next(&cursor, &seg)) {
+        assert_in_range(num, 0, 3);
+        assert_memory_equal(&exp[num], &seg, sizeof(pool_segment_t));
+        ++num;
+    }
+    assert_int_equal(num, 4);
+
+    pool_segment_t segs[3];
+    mem_pool_cursor(pool, &cursor);
+    assert_int_equal(mem_pool_cursor_fill(&cursor, segs, 3), 3);
+    assert_memory_equal(exp, segs, 3 * sizeof(pool_segment_t));
+    assert_int_equal(mem_pool_cursor_fill(&cursor, segs, 3), 1);
+    assert_memory_equal(&exp[3], segs, sizeof(pool_segment_t));
+    assert_int_equal(mem_pool_cursor_fill(&cursor, segs, 3), 0);
+
+    mem_pool_cursor_range(pool, &cursor, 150, 400);
+    assert_int_equal(mem_pool_cursor_fill(&cursor, segs, 3), 2);
+    assert_memory_equal(&exp[1], segs, 2 * sizeof(pool_segment_t));
+    assert_int_equal(cursor.offset, 300);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+}
+
+static void test_pool_frag_stats(void **state) {
+    pool_pt pool = *state;
+    pool_frag_stats_t stats;
+
+    /*
+     * Fragmentation metrics:
+     *
+     * 1. Fresh pool: one gap, no fragmentation.
+     * 2. Allocate 100, 200, 300, 400 and delete the 100 and the 300.
+     * 3. Free space is split over three gaps, largest at the bottom.
+     */
+
+    mem_pool_frag_stats(pool, &stats);
+    assert_int_equal(stats.num_gaps, 1);
+    assert_int_equal(stats.largest_gap, POOL_SIZE);
+    assert_int_equal(stats.free_size, POOL_SIZE);
+    assert_true(stats.ext_frag == 0.0);
+    assert_int_equal(stats.high_water, 0);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    alloc_pt alloc3 = mem_new_alloc(pool, 400);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    mem_pool_frag_stats(pool, &stats);
+    assert_int_equal(stats.num_gaps, 3);
+    assert_int_equal(stats.largest_gap, POOL_SIZE - 1000);
+    assert_int_equal(stats.free_size, POOL_SIZE - 600);
+    assert_true(stats.ext_frag > 0.0 && stats.ext_frag < 0.001);
+    assert_int_equal(stats.high_water, 1000);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    mem_pool_frag_stats(pool, &stats);
+    assert_int_equal(stats.num_gaps, 1);
+    assert_true(stats.ext_frag == 0.0);
+    assert_int_equal(stats.high_water, 1000);
+}
+
+static void test_pool_stats(void **state) {
+    pool_pt pool = *state;
+    pool_stats_t stats;
+
+    /*
+     * Operation counters:
+     *
+     * 1. Allocate 100 and 200 (two splits), fail one oversized allocation.
+     * 2. Delete both, the first merging with nothing, the second with both neighbors.
+     */
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_null(mem_new_alloc(pool, POOL_SIZE));
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+#ifdef MEM_POOL_STATS
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.num_allocs, 2);
+    assert_int_equal(stats.num_frees, 2);
+    assert_int_equal(stats.num_failures, 1);
+    assert_int_equal(stats.num_splits, 2);
+    assert_int_equal(stats.num_coalesces, 2);
+    assert_int_equal(stats.node_heap_resizes, 0);
+    assert_int_equal(stats.gap_ix_resizes, 0);
+
+    // every search visited a single gap-index entry
+    assert_int_equal(stats.search_hist[1], 3);
+#else
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_FAIL);
+#endif
+}
+
+static void test_pool_latency(void **state) {
+    pool_pt pool = *state;
+    alloc_pt allocs[10];
+
+    /*
+     * Latency histograms:
+     *
+     * 1. Time every call, then 1 in 4 calls.
+     * 2. Histograms count exactly the sampled calls.
+     */
+
+#ifdef MEM_POOL_LATENCY
+    assert_int_equal(mem_pool_latency_enable(pool, 1), ALLOC_OK);
+
+    for (unsigned u = 0; u < 10; ++u) {
+        allocs[u] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[u]);
+    }
+    for (unsigned u = 0; u < 10; ++u) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+
+    const mem_hist_t *alloc_hist = mem_pool_latency(pool, MEM_LAT_ALLOC);
+    const mem_hist_t *del_hist = mem_pool_latency(pool, MEM_LAT_DEL);
+    assert_non_null(alloc_hist);
+    assert_non_null(del_hist);
+    assert_int_equal(alloc_hist->count, 10);
+    assert_int_equal(del_hist->count, 10);
+    assert_true(mem_hist_percentile(alloc_hist, 0.5) <= alloc_hist->max);
+
+    assert_int_equal(mem_pool_latency_enable(pool, 4), ALLOC_OK);
+    for (unsigned u = 0; u < 8; ++u) {
+        allocs[u] = mem_new_alloc(pool, 100);
+        assert_non_null(allocs[u]);
+    }
+    assert_int_equal(alloc_hist->count, 12);
+
+#ifdef INSPECT_POOL
+    mem_pool_latency_dump(pool, stdout);
+#endif
+
+    for (unsigned u = 0; u < 8; ++u) {
+        assert_int_equal(mem_del_alloc(pool, allocs[u]), ALLOC_OK);
+    }
+
+    assert_int_equal(mem_pool_latency_disable(pool), ALLOC_OK);
+    assert_null(mem_pool_latency(pool, MEM_LAT_ALLOC));
+#else
+    (void) allocs;
+    assert_int_equal(mem_pool_latency_enable(pool, 1), ALLOC_FAIL);
+#endif
+}
+
+static void count_moves(alloc_pt alloc, char *old_mem, void *ctx) {
+    (void) alloc;
+    (void) old_mem;
+    *(unsigned *) ctx += 1;
+}
+
+static void test_pool_compact(void **state) {
+    pool_pt pool = *state;
+    unsigned moves = 0;
+
+    /*
+     * Compaction:
+     *
+     * 1. Allocate 100, 200, 300, 400 and delete the 100 and the 300.
+     * 2. Compact on a budget of 200 bytes: only the 200 moves.
+     * 3. Compact the rest: the 400 follows, one gap at the end, data intact.
+     * 4. A pinned allocation stays put, and so does the gap in front of it.
+     */
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    alloc_pt alloc3 = mem_new_alloc(pool, 400);
+    memset(alloc1->mem, 'a', 200);
+    memset(alloc3->mem, 'b', 400);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_alloc_pin(pool, alloc0), ALLOC_FAIL);
+
+    assert_int_equal(mem_pool_compact(pool, count_moves, &moves, 200), ALLOC_PARTIAL);
+    assert_int_equal(moves, 1);
+    assert_ptr_equal(alloc1->mem, pool->mem);
+
+    assert_int_equal(mem_pool_compact(pool, count_moves, &moves, 0), ALLOC_OK);
+    assert_int_equal(moves, 2);
+    assert_ptr_equal(alloc3->mem, pool->mem + 200);
+    for (unsigned u = 0; u < 200; ++u)
+        assert_int_equal(alloc1->mem[u], 'a');
+    for (unsigned u = 0; u < 400; ++u)
+        assert_int_equal(alloc3->mem[u], 'b');
+
+    pool_segment_t compacted[] = {
+            {200, 1},
+            {400, 1},
+            {POOL_SIZE - 600, 0}
+    };
+    check_pool(pool, compacted);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 600, 2, 1);
+
+    // pin the 400 behind a gap
+    alloc_pt alloc4 = mem_new_alloc(pool, 50);
+    assert_ptr_equal(alloc4->mem, pool->mem + 600);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_alloc_pin(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_pool_compact(pool, NULL, NULL, 0), ALLOC_OK);
+    assert_ptr_equal(alloc3->mem, pool->mem + 200);
+    assert_ptr_equal(alloc4->mem, pool->mem + 600);
+    assert_int_equal(pool->num_gaps, 2);
+
+    assert_int_equal(mem_alloc_unpin(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_pool_compact(pool, NULL, NULL, 0), ALLOC_OK);
+    assert_ptr_equal(alloc3->mem, pool->mem);
+    assert_ptr_equal(alloc4->mem, pool->mem + 400);
+    assert_int_equal(pool->num_gaps, 1);
+
+    // the pool still works normally
+    alloc_pt alloc5 = mem_new_alloc(pool, 100);
+    assert_ptr_equal(alloc5->mem, pool->mem + 450);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+}
+
+static void test_pool_small(void **state) {
+    (void) state; /* unused */
+    alloc_pt small[100];
+
+    /*
+     * Small-object layer:
+     *
+     * 1. 100 allocations of 24 bytes share two slabs, i.e. two pool allocations.
+     * 2. Their ids round-trip, and larger requests take the normal path.
+     * 3. Deleting all of them keeps one empty slab, which closing the pool releases.
+     * 4. Records outside both the node heap and the slabs are refused, even on a
+     *    slab-sized boundary (where the slab metadata would be).
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_small_enable(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_small_enable(pool), ALLOC_CALLED_AGAIN);
+
+    for (unsigned u = 0; u < 100; ++u) {
+        small[u] = mem_new_alloc(pool, 24);
+        assert_non_null(small[u]);
+        assert_int_equal(small[u]->size, 24);
+        assert_true(small[u]->mem >= pool->mem && small[u]->mem + 24 <= pool->mem + POOL_SIZE);
+        memset(small[u]->mem, (int) u, 24);
+
+        unsigned id = mem_alloc_id(pool, small[u]);
+        assert_true(id & MEM_ALLOC_ID_SMALL);
+        assert_ptr_equal(mem_alloc_from_id(pool, id), small[u]);
+    }
+    assert_int_equal(pool->num_allocs, 2);
+    for (unsigned u = 0; u < 100; ++u)
+        assert_int_equal(small[u]->mem[23], (char) u);
+
+    alloc_pt large = mem_new_alloc(pool, MEM_POOL_SMALL_MAX + 1);
+    assert_non_null(large);
+    assert_false(mem_alloc_id(pool, large) & MEM_ALLOC_ID_SMALL);
+    assert_int_equal(pool->num_allocs, 3);
+
+    alloc_t stray = {0, NULL};
+    char *fake = aligned_alloc(1024, 1024);
+    assert_non_null(fake);
+    memset(fake, 0, 1024);
+    alloc_pt fakes[] = {&stray, (alloc_pt) (fake + 1024 - sizeof(alloc_t)), (alloc_pt) fake};
+    for (unsigned u = 0; u < 3; ++u) {
+        assert_int_equal(mem_alloc_id(pool, fakes[u]), MEM_TRACE_NO_HANDLE);
+        assert_int_equal(mem_del_alloc(pool, fakes[u]), ALLOC_FAIL);
+    }
+    free(fake);
+    assert_int_equal(pool->num_allocs, 3);
+
+    unsigned id = mem_alloc_id(pool, small[0]);
+    for (unsigned u = 0; u < 100; ++u)
+        assert_int_equal(mem_del_alloc(pool, small[u]), ALLOC_OK);
+    assert_null(mem_alloc_from_id(pool, id));
+    assert_int_equal(pool->num_allocs, 2);
+
+    assert_int_equal(mem_del_alloc(pool, large), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_bitmap(void **state) {
+    (void) state; /* unused */
+    const size_t block = MEM_POOL_BITMAP_BLOCK;
+    const size_t total = 130 * block;
+    alloc_policy policy;
+    pool_frag_stats_t frag;
+
+    /*
+     * Bitmap policy:
+     *
+     * 1. The pool is cut down to whole blocks, and allocations are rounded up to them.
+     * 2. A freed run coalesces with its neighbors without any nodes.
+     * 3. A run spans words of the bitmap, and fails if no run is long enough.
+     * 4. Compaction is not supported.
+     * 5. Fragmentation stats with more free runs than a gap index would hold.
+     * 6. The largest run, kept between the calls, matches the segments after random allocs and dels.
+     */
+
+    assert_int_equal(mem_policy_from_name("bitmap", &policy), ALLOC_OK);
+    assert_int_equal(policy, BITMAP);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(total + 10, BITMAP);
+    assert_non_null(pool);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, block);
+    alloc_pt alloc2 = mem_new_alloc(pool, 1);
+    assert_ptr_equal(alloc0->mem, pool->mem);
+    assert_ptr_equal(alloc1->mem, pool->mem + 2 * block);
+    assert_ptr_equal(alloc2->mem, pool->mem + 3 * block);
+    assert_int_equal(alloc0->size, 100);
+
+    pool_segment_t exp0[] = {
+            {2 * block, 1},
+            {block, 1},
+            {block, 1},
+            {total - 4 * block, 0}
+    };
+    check_pool(pool, exp0);
+    check_metadata(pool, BITMAP, total, 4 * block, 3, 1);
+
+    // the hole is reused, and the gaps merge on either side
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 2);
+    alloc_pt alloc3 = mem_new_alloc(pool, 50);
+    assert_ptr_equal(alloc3->mem, alloc1->mem);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_FAIL);
+
+    pool_segment_t exp1[] = {
+            {3 * block, 0},
+            {block, 1},
+            {total - 4 * block, 0}
+    };
+    check_pool(pool, exp1);
+    check_metadata(pool, BITMAP, total, block, 1, 2);
+
+    // 70 blocks don't fit in front, and cross into the second word
+    alloc_pt alloc4 = mem_new_alloc(pool, 70 * block);
+    assert_ptr_equal(alloc4->mem, pool->mem + 4 * block);
+    assert_null(mem_new_alloc(pool, 57 * block));
+    alloc_pt alloc5 = mem_new_alloc(pool, 56 * block);
+    assert_ptr_equal(alloc5->mem, pool->mem + 74 * block);
+    assert_int_equal(pool->num_gaps, 1);
+
+    mem_pool_frag_stats(pool, &frag);
+    assert_int_equal(frag.largest_gap, 3 * block);
+    assert_int_equal(frag.high_water, total);
+
+    assert_int_equal(mem_pool_compact(pool, NULL, NULL, 0), ALLOC_FAIL);
+
+    assert_int_equal(mem_del_alloc(pool, alloc4), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    check_metadata(pool, BITMAP, total, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // many more free runs than a gap index starts with room for, which bitmap pools don't keep
+    uint32_t ids[200];
+    pool = mem_pool_open(200 * block, BITMAP);
+    assert_non_null(pool);
+    for (unsigned i = 0; i < 200; i++) {
+        alloc_pt alloc = mem_new_alloc(pool, block);
+        assert_non_null(alloc);
+        ids[i] = mem_alloc_id(pool, alloc);
+    }
+    for (unsigned i = 0; i < 200; i += 2)
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, ids[i])), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 100);
+
+    mem_pool_frag_stats(pool, &frag);
+    assert_int_equal(frag.num_gaps, 100);
+    assert_int_equal(frag.largest_gap, block);
+    assert_int_equal(frag.free_size, 100 * block);
+
+    for (unsigned i = 1; i < 200; i += 2)
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, ids[i])), ALLOC_OK);
+    mem_pool_frag_stats(pool, &frag);
+    assert_int_equal(frag.num_gaps, 1);
+    assert_int_equal(frag.largest_gap, 200 * block);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // not a whole number of words, so the last run ends at the bits past the last block
+    unsigned live = 0;
+    unsigned rng = 12345;
+    pool = mem_pool_open(1000 * block, BITMAP);
+    assert_non_null(pool);
+    for (unsigned step = 0; step < 3000; step++) {
+        rng = rng * 1103515245u + 12345u;
+        if (live < 200 && (live == 0 || (rng >> 16) % 3 != 0)) {
+            alloc_pt alloc = mem_new_alloc(pool, (1 + (rng >> 8) % 40) * block);
+            if (alloc != NULL)
+                ids[live++] = mem_alloc_id(pool, alloc);
+        }
+        else {
+            unsigned victim = (rng >> 16) % live;
+            assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, ids[victim])), ALLOC_OK);
+            ids[victim] = ids[--live];
+        }
+
+        pool_segment_pt segments;
+        unsigned num_segments;
+        size_t largest = 0;
+        mem_inspect_pool(pool, &segments, &num_segments);
+        for (unsigned u = 0; u < num_segments; u++)
+            if (!segments[u].allocated && segments[u].size > largest)
+                largest = segments[u].size;
+        free(segments);
+
+        mem_pool_frag_stats(pool, &frag);
+        assert_int_equal(frag.largest_gap, largest);
+    }
+    for (unsigned i = 0; i < live; i++)
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, ids[i])), ALLOC_OK);
+    mem_pool_frag_stats(pool, &frag);
+    assert_int_equal(frag.largest_gap, 1000 * block);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+typedef struct _policy_calls {
+    unsigned splits;
+    unsigned frees;
+    unsigned coalesces;
+    size_t last_coalesced;
+} policy_calls_t;
+
+// the first gap with room for four of the request, else the best fit
+static unsigned roomy_fit(const size_t *gap_sizes, unsigned num_gaps, size_t size, void *ctx) {
+    (void) ctx; /* unused */
+    for (unsigned u = 0; u < num_gaps; ++u)
+        if (gap_sizes[u] >= 4 * size)
+            return u;
+    for (unsigned u = 0; u < num_gaps; ++u)
+        if (gap_sizes[u] >= size)
+            return u;
+    return num_gaps;
+}
+
+static void count_split(pool_pt pool, alloc_pt alloc, size_t remaining, void *ctx) {
+    (void) pool; (void) alloc; (void) remaining; /* unused */
+    ((policy_calls_t *) ctx)->splits += 1;
+}
+
+static void count_free(pool_pt pool, alloc_pt alloc, void *ctx) {
+    (void) pool; (void) alloc; /* unused */
+    ((policy_calls_t *) ctx)->frees += 1;
+}
+
+static void count_coalesce(pool_pt pool, size_t size, void *ctx) {
+    (void) pool; /* unused */
+    ((policy_calls_t *) ctx)->coalesces += 1;
+    ((policy_calls_t *) ctx)->last_coalesced = size;
+}
+
+static void test_pool_policy(void **state) {
+    (void) state; /* unused */
+    policy_calls_t calls = {0, 0, 0, 0};
+    pool_policy_ops_t ops = {"roomy_fit", roomy_fit, count_split, count_free, count_coalesce, &calls};
+    alloc_policy roomy, policy;
+
+    /*
+     * Registered policies:
+     *
+     * 1. A policy is registered once by name, and unknown policies don't open.
+     * 2. Its find_gap decides the placement, where best fit would choose otherwise.
+     * 3. Its hooks see every split, free and coalesce.
+     * 4. The built-in worst fit takes the largest gap.
+     */
+
+    assert_int_equal(mem_policy_register(&ops, &roomy), ALLOC_OK);
+    assert_int_equal(mem_policy_register(&ops, &policy), ALLOC_FAIL);
+    assert_true(roomy > WORST_FIT);
+    assert_int_equal(mem_policy_from_name("roomy_fit", &policy), ALLOC_OK);
+    assert_int_equal(policy, roomy);
+    assert_string_equal(mem_policy_name(roomy), "roomy_fit");
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    assert_null(mem_pool_open(1000, (alloc_policy) (roomy + 1)));
+
+    alloc_policy policies[] = {roomy, WORST_FIT};
+    for (unsigned p = 0; p < 2; ++p) {
+        pool_pt pool = mem_pool_open(1000, policies[p]);
+        assert_non_null(pool);
+
+        alloc_pt alloc0 = mem_new_alloc(pool, 100);
+        alloc_pt alloc1 = mem_new_alloc(pool, 100);
+        alloc_pt alloc2 = mem_new_alloc(pool, 100);
+        assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+        // best fit would take the 100 at the start
+        alloc_pt alloc3 = mem_new_alloc(pool, 50);
+        assert_ptr_equal(alloc3->mem, pool->mem + 300);
+
+        assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+    assert_int_equal(mem_free(), ALLOC_OK);
+
+    assert_int_equal(calls.splits, 4);
+    assert_int_equal(calls.frees, 4);
+    assert_int_equal(calls.coalesces, 4);
+    assert_int_equal(calls.last_coalesced, 1000);
+}
+
+// the snapshot, with one 32-bit field at offset overwritten, is refused
+static void check_corrupt_snapshot(int fd, const char *snapshot, size_t length, off_t offset, uint32_t value) {
+    assert_int_equal(pwrite(fd, snapshot, length, 0), length);
+    assert_int_equal(pwrite(fd, &value, sizeof(value), offset), sizeof(value));
+    assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+    assert_null(mem_pool_restore(fd));
+}
+
+static void test_pool_snapshot(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Snapshot and restore:
+     *
+     * 1. A pool with a hole in it is saved with its contents and restored as a new pool.
+     * 2. The copy has the same segments, ids and data, and keeps working on its own.
+     * 3. BITMAP pools round-trip without their contents, also with many free runs.
+     * 4. A truncated stream is refused, and so is one with a node index out of range,
+     *    and a pool with the small-object layer on.
+     */
+
+    FILE *file = tmpfile();
+    assert_non_null(file);
+    int fd = fileno(file);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(1000, FIRST_FIT);
+    assert_non_null(pool);
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    memset(alloc0->mem, 'a', 100);
+    memset(alloc2->mem, 'c', 300);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    assert_int_equal(mem_pool_snapshot(pool, fd, 1), ALLOC_OK);
+    off_t length = lseek(fd, 0, SEEK_CUR);
+    assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+    pool_pt copy = mem_pool_restore(fd);
+    assert_non_null(copy);
+    assert_ptr_not_equal(copy->mem, pool->mem);
+
+    pool_segment_t exp[] = {
+            {100, 1},
+            {200, 0},
+            {300, 1},
+            {400, 0}
+    };
+    check_pool(copy, exp);
+    check_metadata(copy, FIRST_FIT, 1000, 400, 2, 2);
+
+    alloc_pt copy0 = mem_alloc_from_id(copy, mem_alloc_id(pool, alloc0));
+    alloc_pt copy2 = mem_alloc_from_id(copy, mem_alloc_id(pool, alloc2));
+    assert_non_null(copy0);
+    assert_non_null(copy2);
+    assert_ptr_equal(copy2->mem, copy->mem + 300);
+    assert_memory_equal(copy0->mem, alloc0->mem, 100);
+    assert_memory_equal(copy2->mem, alloc2->mem, 300);
+
+    // first fit still finds the hole, and the original is untouched
+    alloc_pt copy1 = mem_new_alloc(copy, 150);
+    assert_ptr_equal(copy1->mem, copy->mem + 100);
+    check_pool(pool, exp);
+    assert_int_equal(mem_del_alloc(copy, copy0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(copy, copy1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(copy, copy2), ALLOC_OK);
+    assert_int_equal(mem_pool_close(copy), ALLOC_OK);
+
+    // node indices past the high-water mark: the header is 104 bytes, with the
+    // high-water mark at 80, the gap count at 68 and the list head at 84, followed
+    // by 16 bytes per record, then next, prev, flags, the gap sizes and gap nodes
+    char *snapshot = malloc((size_t) length);
+    uint32_t num_gaps, hwm;
+    assert_non_null(snapshot);
+    assert_int_equal(pread(fd, snapshot, (size_t) length, 0), length);
+    memcpy(&num_gaps, snapshot + 68, sizeof(num_gaps));
+    memcpy(&hwm, snapshot + 80, sizeof(hwm));
+    assert_int_equal(num_gaps, 2);
+    off_t next = 104 + 16 * hwm;
+    off_t gap_node = next + 9 * hwm + 8 * num_gaps;
+    check_corrupt_snapshot(fd, snapshot, (size_t) length, 84, hwm);
+    check_corrupt_snapshot(fd, snapshot, (size_t) length, next, 1000000);
+    check_corrupt_snapshot(fd, snapshot, (size_t) length, next + 4 * hwm + 4, hwm);
+    check_corrupt_snapshot(fd, snapshot, (size_t) length, gap_node, hwm);
+    free(snapshot);
+
+    // a short stream
+    assert_int_equal(ftruncate(fd, length / 2), 0);
+    assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+    assert_null(mem_pool_restore(fd));
+
+    // a bitmap pool, without the contents
+    pool_pt bitmap = mem_pool_open(64 * 100, BITMAP);
+    alloc_pt alloc3 = mem_new_alloc(bitmap, 100);
+    alloc_pt alloc4 = mem_new_alloc(bitmap, 1000);
+    assert_int_equal(mem_del_alloc(bitmap, alloc3), ALLOC_OK);
+    assert_int_equal(ftruncate(fd, 0), 0);
+    assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+    assert_int_equal(mem_pool_snapshot(bitmap, fd, 0), ALLOC_OK);
+    assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+    copy = mem_pool_restore(fd);
+    assert_non_null(copy);
+
+    pool_segment_t exp_bitmap[] = {
+            {128, 0},
+            {1024, 1},
+            {64 * 100 - 1152, 0}
+    };
+    check_pool(copy, exp_bitmap);
+    check_metadata(copy, BITMAP, 64 * 100, 1024, 1, 2);
+    assert_int_equal(mem_del_alloc(copy, mem_alloc_from_id(copy, mem_alloc_id(bitmap, alloc4))), ALLOC_OK);
+    assert_int_equal(mem_pool_close(copy), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(bitmap, alloc4), ALLOC_OK);
+    assert_int_equal(mem_pool_close(bitmap), ALLOC_OK);
+
+    // and one with more free runs than a gap index starts with room for
+    uint32_t ids[100];
+    bitmap = mem_pool_open(100 * MEM_POOL_BITMAP_BLOCK, BITMAP);
+    assert_non_null(bitmap);
+    for (unsigned i = 0; i < 100; i++) {
+        alloc_pt alloc = mem_new_alloc(bitmap, MEM_POOL_BITMAP_BLOCK);
+        assert_non_null(alloc);
+        ids[i] = mem_alloc_id(bitmap, alloc);
+    }
+    for (unsigned i = 0; i < 100; i += 2)
+        assert_int_equal(mem_del_alloc(bitmap, mem_alloc_from_id(bitmap, ids[i])), ALLOC_OK);
+    assert_int_equal(ftruncate(fd, 0), 0);
+    assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+    assert_int_equal(mem_pool_snapshot(bitmap, fd, 0), ALLOC_OK);
+    assert_int_equal(lseek(fd, 0, SEEK_SET), 0);
+    copy = mem_pool_restore(fd);
+    assert_non_null(copy);
+
+    pool_frag_stats_t frag;
+    check_metadata(copy, BITMAP, 100 * MEM_POOL_BITMAP_BLOCK, 50 * MEM_POOL_BITMAP_BLOCK, 50, 50);
+    mem_pool_frag_stats(copy, &frag);
+    assert_int_equal(frag.largest_gap, MEM_POOL_BITMAP_BLOCK);
+    for (unsigned i = 1; i < 100; i += 2)
+        assert_int_equal(mem_del_alloc(copy, mem_alloc_from_id(copy, ids[i])), ALLOC_OK);
+    check_metadata(copy, BITMAP, 100 * MEM_POOL_BITMAP_BLOCK, 0, 0, 1);
+    assert_int_equal(mem_pool_close(copy), ALLOC_OK);
+    assert_int_equal(mem_pool_close_force(bitmap), ALLOC_OK);
+
+    // the slabs are not part of the node heap
+    assert_int_equal(mem_pool_small_enable(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_snapshot(pool, fd, 0), ALLOC_FAIL);
+
+    assert_int_equal(mem_pool_close_force(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+    fclose(file);
+}
+
+static void test_pool_shrink(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Metadata shrink:
+     *
+     * 1. A peak of allocations, then of gaps, grows the node heap and the gap index.
+     * 2. As they are deleted, the gap index shrinks back, and the node heap shrinks
+     *    on the next allocation, down to the highest node still in use.
+     * 3. An explicit shrink gets back to the size of a fresh pool, and ids stay valid throughout.
+     * 4. Pools closed in any order leave the pool store consistent.
+     */
+
+    const unsigned num_allocs = 1000;
+    unsigned ids[1000];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(100000, FIRST_FIT);
+    assert_non_null(pool);
+    size_t fresh = mem_pool_metadata_size(pool);
+    assert_true(fresh > 0);
+
+    for (unsigned i = 0; i < num_allocs; ++i) {
+        alloc_pt alloc = mem_new_alloc(pool, 10);
+        assert_non_null(alloc);
+        ids[i] = mem_alloc_id(pool, alloc);
+    }
+    // every other one, for a gap index as big as the node heap
+    for (unsigned i = 0; i < num_allocs; i += 2)
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, ids[i])), ALLOC_OK);
+    size_t peak = mem_pool_metadata_size(pool);
+    assert_true(peak > fresh);
+
+    // the gap index shrinks as the gaps merge
+    for (unsigned i = 1; i < num_allocs - 1; i += 2)
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, ids[i])), ALLOC_OK);
+    size_t drained = mem_pool_metadata_size(pool);
+    assert_true(drained < peak);
+
+    // the last allocation holds up the top of the node heap, and keeps its id
+    assert_int_equal(mem_pool_shrink_metadata(pool), ALLOC_OK);
+    alloc_pt last = mem_alloc_from_id(pool, ids[num_allocs - 1]);
+    assert_non_null(last);
+    assert_ptr_equal(last->mem, pool->mem + 10 * (num_allocs - 1));
+    assert_int_equal(last->size, 10);
+    assert_true(mem_pool_metadata_size(pool) <= drained);
+    assert_true(mem_pool_metadata_size(pool) > fresh);
+    assert_int_equal(mem_del_alloc(pool, last), ALLOC_OK);
+
+    // the node heap halves on the next allocation, and the explicit shrink does the rest
+    size_t before = mem_pool_metadata_size(pool);
+    alloc_pt alloc0 = mem_new_alloc(pool, 10);
+    assert_true(mem_pool_metadata_size(pool) < before);
+    assert_int_equal(mem_pool_shrink_metadata(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_metadata_size(pool), fresh);
+
+    // and the pool still works
+    alloc0 = mem_alloc_from_id(pool, 0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 20);
+    alloc_pt alloc2 = mem_new_alloc(pool, 30);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    pool_segment_t exp[] = {
+            {10, 1},
+            {20, 0},
+            {30, 1},
+            {100000 - 60, 0}
+    };
+    check_pool(pool, exp);
+    assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, mem_alloc_id(pool, alloc0))), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // the pool store grows and shrinks back
+    pool_pt pools[64];
+    for (unsigned i = 0; i < 64; ++i) {
+        pools[i] = mem_pool_open(100, BEST_FIT);
+        assert_non_null(pools[i]);
+    }
+    for (unsigned i = 0; i < 64; ++i)
+        assert_int_equal(mem_pool_close(pools[(i * 7) % 64]), ALLOC_OK);
+    pool = mem_pool_open(100, BEST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_open_ex(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Extended open:
+     *
+     * 1. No config is the same as mem_pool_open.
+     * 2. Capacity hints presize the metadata, so that it does not grow while they hold.
+     * 3. A negative shrink factor keeps the metadata at its peak.
+     * 4. The small-object layer can be turned on at open.
+     * 5. Factors which would make the metadata grow and shrink in turn are refused.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(1000, FIRST_FIT);
+    pool_pt pool_ex = mem_pool_open_ex(1000, FIRST_FIT, NULL);
+    assert_non_null(pool_ex);
+    assert_int_equal(mem_pool_metadata_size(pool_ex), mem_pool_metadata_size(pool));
+    check_metadata(pool_ex, FIRST_FIT, 1000, 0, 0, 1);
+    assert_int_equal(mem_pool_close(pool_ex), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // presized for a thousand allocations and half as many gaps
+    pool_config_t config = {0};
+    config.expected_allocs = 1000;
+    config.expected_gaps = 500;
+    pool = mem_pool_open_ex(100000, BEST_FIT, &config);
+    assert_non_null(pool);
+    size_t presized = mem_pool_metadata_size(pool);
+    unsigned ids[1000];
+    for (unsigned i = 0; i < 1000; ++i)
+        ids[i] = mem_alloc_id(pool, mem_new_alloc(pool, 10));
+    for (unsigned i = 0; i < 1000; i += 2)
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, ids[i])), ALLOC_OK);
+    assert_int_equal(mem_pool_metadata_size(pool), presized);
+
+    // and it does not shrink below the hints either
+    for (unsigned i = 1; i < 1000; i += 2)
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, ids[i])), ALLOC_OK);
+    assert_non_null(mem_new_alloc(pool, 10));
+    assert_int_equal(mem_pool_shrink_metadata(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_metadata_size(pool), presized);
+    assert_int_equal(mem_pool_close_force(pool), ALLOC_OK);
+
+    // never shrink
+    pool_config_t keep = {0};
+    keep.shrink_factor = -1;
+    pool = mem_pool_open_ex(100000, FIRST_FIT, &keep);
+    assert_non_null(pool);
+    for (unsigned i = 0; i < 1000; ++i)
+        ids[i] = mem_alloc_id(pool, mem_new_alloc(pool, 10));
+    for (unsigned i = 0; i < 1000; i += 2)
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, ids[i])), ALLOC_OK);
+    size_t peak = mem_pool_metadata_size(pool);
+    for (unsigned i = 1; i < 1000; i += 2)
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, ids[i])), ALLOC_OK);
+    alloc_pt alloc = mem_new_alloc(pool, 10);
+    assert_int_equal(mem_pool_metadata_size(pool), peak);
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // small objects from the start
+    pool_config_t small = {0};
+    small.small_objects = 1;
+    pool = mem_pool_open_ex(100000, FIRST_FIT, &small);
+    assert_non_null(pool);
+    alloc = mem_new_alloc(pool, 16);
+    assert_true(mem_alloc_id(pool, alloc) & MEM_ALLOC_ID_SMALL);
+    assert_int_equal(mem_pool_small_enable(pool), ALLOC_CALLED_AGAIN);
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // bad factors
+    pool_config_t bad = {0};
+    bad.fill_factor = 1.5f;
+    assert_null(mem_pool_open_ex(1000, FIRST_FIT, &bad));
+    bad.fill_factor = 0.75f;
+    bad.expand_factor = 1;
+    assert_null(mem_pool_open_ex(1000, FIRST_FIT, &bad));
+    bad.expand_factor = 2;
+    bad.shrink_factor = 0.5f;
+    assert_null(mem_pool_open_ex(1000, FIRST_FIT, &bad));
+    bad.shrink_factor = 0;
+    bad.expand_factor = 4; // the default shrink factor is lowered to fit
+    pool = mem_pool_open_ex(1000, FIRST_FIT, &bad);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_subpool(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Sub-pools:
+     *
+     * 1. A sub-pool is a pinned allocation of its parent, with a pool of its own inside.
+     * 2. Compaction of the parent leaves it in place.
+     * 3. The parent cannot be reset or force-closed under it.
+     * 4. Sub-pools nest, and closing one gives its block back in one deletion.
+     * 5. The block bypasses the parent's small-object layer.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt parent = mem_pool_open(10000, FIRST_FIT);
+    alloc_pt alloc0 = mem_new_alloc(parent, 100);
+    pool_pt sub = mem_subpool_open(parent, 1000, BEST_FIT);
+    assert_non_null(sub);
+    assert_ptr_equal(sub->mem, parent->mem + 100);
+    check_metadata(sub, BEST_FIT, 1000, 0, 0, 1);
+
+    pool_segment_t exp_parent[] = {
+            {100, 1},
+            {1000, 1},
+            {8900, 0}
+    };
+    check_pool(parent, exp_parent);
+
+    // the sub-pool allocates in its block only
+    alloc_pt alloc1 = mem_new_alloc(sub, 300);
+    alloc_pt alloc2 = mem_new_alloc(sub, 700);
+    assert_ptr_equal(alloc1->mem, parent->mem + 100);
+    assert_ptr_equal(alloc2->mem, parent->mem + 400);
+    assert_null(mem_new_alloc(sub, 1));
+    assert_int_equal(mem_del_alloc(sub, alloc1), ALLOC_OK);
+
+    // too big for the parent
+    assert_null(mem_subpool_open(parent, 10000, FIRST_FIT));
+    check_pool(parent, exp_parent);
+
+    // the block is pinned
+    assert_int_equal(mem_del_alloc(parent, alloc0), ALLOC_OK);
+    assert_int_equal(mem_pool_compact(parent, NULL, NULL, 0), ALLOC_OK);
+    assert_ptr_equal(sub->mem, parent->mem + 100);
+    assert_int_equal(mem_pool_reset(parent), ALLOC_NOT_FREED);
+    assert_int_equal(mem_pool_close_force(parent), ALLOC_NOT_FREED);
+    assert_int_equal(mem_pool_close(parent), ALLOC_NOT_FREED);
+
+    // nested
+    pool_pt subsub = mem_subpool_open(sub, 200, FIRST_FIT);
+    assert_non_null(subsub);
+    assert_ptr_equal(subsub->mem, parent->mem + 100);
+    assert_int_equal(mem_pool_close_force(sub), ALLOC_NOT_FREED);
+    assert_non_null(mem_new_alloc(subsub, 50));
+    assert_int_equal(mem_pool_close_force(subsub), ALLOC_OK);
+
+    // teardown with live allocations
+    assert_int_equal(mem_pool_close_force(sub), ALLOC_OK);
+    pool_segment_t exp_empty[] = {
+            {10000, 0}
+    };
+    check_pool(parent, exp_empty);
+    check_metadata(parent, FIRST_FIT, 10000, 0, 0, 1);
+
+    // past the slabs
+    assert_int_equal(mem_pool_small_enable(parent), ALLOC_OK);
+    sub = mem_subpool_open(parent, 256, FIRST_FIT);
+    assert_non_null(sub);
+    check_metadata(parent, FIRST_FIT, 10000, 256, 1, 1);
+    assert_int_equal(mem_pool_close(sub), ALLOC_OK);
+    check_pool(parent, exp_empty);
+
+    assert_int_equal(mem_pool_close(parent), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void check_tag(pool_pt pool, unsigned tag, size_t live_bytes, unsigned long live_count, size_t peak_bytes) {
+    pool_tag_stats_t stats;
+
+    assert_int_equal(mem_pool_tag_stats(pool, tag, &stats), ALLOC_OK);
+    assert_int_equal(stats.live_bytes, live_bytes);
+    assert_int_equal(stats.live_count, live_count);
+    assert_int_equal(stats.peak_bytes, peak_bytes);
+}
+
+static void test_pool_tags(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Allocation tags:
+     *
+     * 1. Live bytes, live count and peak are kept per tag, untagged allocations under tag 0.
+     * 2. A gap left by a tagged allocation carries no tag into the next one.
+     * 3. BITMAP pools count whole blocks, and tagged small requests skip the slabs.
+     * 4. A restored pool recounts its tags.
+     */
+
+    pool_tag_stats_t stats;
+    FILE *file = tmpfile();
+    assert_non_null(file);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(1000, FIRST_FIT);
+    alloc_pt alloc0 = mem_new_alloc_tagged(pool, 100, 1);
+    alloc_pt alloc1 = mem_new_alloc_tagged(pool, 200, 2);
+    alloc_pt alloc2 = mem_new_alloc_tagged(pool, 50, 1);
+    alloc_pt alloc3 = mem_new_alloc(pool, 30);
+    check_tag(pool, 0, 30, 1, 30);
+    check_tag(pool, 1, 150, 2, 150);
+    check_tag(pool, 2, 200, 1, 200);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    check_tag(pool, 1, 50, 1, 150);
+    check_tag(pool, 2, 0, 0, 200);
+
+    // out of range
+    assert_null(mem_new_alloc_tagged(pool, 10, MEM_POOL_TAGS));
+    assert_int_equal(mem_pool_tag_stats(pool, MEM_POOL_TAGS, &stats), ALLOC_FAIL);
+
+    // the hole is untagged again
+    alloc0 = mem_new_alloc(pool, 250);
+    assert_ptr_equal(alloc0->mem, pool->mem);
+    check_tag(pool, 0, 280, 2, 280);
+    check_tag(pool, 2, 0, 0, 200);
+
+    // the tags survive a snapshot, the peaks start over
+    assert_int_equal(mem_pool_snapshot(pool, fileno(file), 0), ALLOC_OK);
+    rewind(file);
+    pool_pt copy = mem_pool_restore(fileno(file));
+    assert_non_null(copy);
+    check_tag(copy, 0, 280, 2, 280);
+    check_tag(copy, 1, 50, 1, 50);
+    check_tag(copy, 2, 0, 0, 0);
+    assert_int_equal(mem_pool_close_force(copy), ALLOC_OK);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    check_tag(pool, 0, 0, 0, 280);
+    check_tag(pool, 1, 0, 0, 150);
+
+    // tagged small requests take a node of their own
+    assert_int_equal(mem_pool_small_enable(pool), ALLOC_OK);
+    alloc0 = mem_new_alloc_tagged(pool, 16, 4);
+    assert_false(mem_alloc_id(pool, alloc0) & MEM_ALLOC_ID_SMALL);
+    alloc1 = mem_new_alloc(pool, 16);
+    assert_true(mem_alloc_id(pool, alloc1) & MEM_ALLOC_ID_SMALL);
+    check_tag(pool, 4, 16, 1, 16);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // whole blocks
+    pool = mem_pool_open(64 * 10, BITMAP);
+    alloc0 = mem_new_alloc_tagged(pool, 100, 3);
+    check_tag(pool, 3, 128, 1, 128);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    check_tag(pool, 3, 0, 0, 128);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    assert_int_equal(mem_free(), ALLOC_OK);
+    fclose(file);
+}
+
+static unsigned count_lines(FILE *file, const char *prefix, char *first, size_t first_size) {
+    char line[1024];
+    unsigned count = 0;
+
+    rewind(file);
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, prefix, strlen(prefix)) != 0)
+            continue;
+        if (count == 0 && first != NULL)
+            snprintf(first, first_size, "%s", line);
+        count += 1;
+    }
+    return count;
+}
+
+static void test_pool_profile(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Sampling profiler:
+     *
+     * 1. With a 1-byte interval every allocation is sampled.
+     * 2. The folded dump has a line per stack with its live bytes, the pprof dump a header with the totals.
+     * 3. Deleted allocations drop out of the samples, and a reset drops them all.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(1 << 20, FIRST_FIT);
+
+#ifdef MEM_POOL_PROFILE
+    alloc_pt allocs[15];
+    unsigned ids[200];
+    char first[1024];
+    FILE *file;
+
+    assert_int_equal(mem_pool_profile_start(pool, 1), ALLOC_OK);
+    assert_int_equal(mem_pool_profile_start(pool, 1), ALLOC_CALLED_AGAIN);
+
+    // two call sites, two stacks
+    for (unsigned i = 0; i < 10; ++i)
+        allocs[i] = mem_new_alloc(pool, 64);
+    for (unsigned i = 10; i < 15; ++i)
+        allocs[i] = mem_new_alloc(pool, 64);
+    for (unsigned i = 0; i < 3; ++i)
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+
+    file = tmpfile();
+    assert_int_equal(mem_pool_profile_dump(pool, file, MEM_PROFILE_FOLDED), ALLOC_OK);
+    assert_int_equal(count_lines(file, "", NULL, 0), 2);
+    assert_int_equal(count_lines(file, "", first, sizeof(first)), 2);
+    assert_true(strstr(first, " 448\n") != NULL || strstr(first, " 320\n") != NULL);
+    fclose(file);
+
+    file = tmpfile();
+    assert_int_equal(mem_pool_profile_dump(pool, file, MEM_PROFILE_PPROF), ALLOC_OK);
+    assert_int_equal(count_lines(file, "heap profile: ", first, sizeof(first)), 1);
+    assert_string_equal(first, "heap profile: 12: 768 [12: 768] @ heap_v2/1\n");
+    assert_int_equal(count_lines(file, "MAPPED_LIBRARIES:", NULL, 0), 1);
+    fclose(file);
+
+    // enough samples to grow the table, deleted out of order
+    for (unsigned i = 0; i < 15; ++i)
+        if (i >= 3)
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    for (unsigned i = 0; i < 200; ++i)
+        ids[i] = mem_alloc_id(pool, mem_new_alloc(pool, 100));
+    for (unsigned i = 0; i < 200; i += 3)
+        assert_int_equal(mem_del_alloc(pool, mem_alloc_from_id(pool, ids[(i * 7) % 200])), ALLOC_OK);
+    file = tmpfile();
+    assert_int_equal(mem_pool_profile_dump(pool, file, MEM_PROFILE_PPROF), ALLOC_OK);
+    count_lines(file, "heap profile: ", first, sizeof(first));
+    assert_string_equal(first, "heap profile: 133: 13300 [133: 13300] @ heap_v2/1\n");
+    fclose(file);
+
+    // nothing left after a reset
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    file = tmpfile();
+    assert_int_equal(mem_pool_profile_dump(pool, file, MEM_PROFILE_PPROF), ALLOC_OK);
+    count_lines(file, "heap profile: ", first, sizeof(first));
+    assert_string_equal(first, "heap profile: 0: 0 [0: 0] @ heap_v2/1\n");
+    fclose(file);
+
+    assert_int_equal(mem_pool_profile_stop(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_profile_dump(pool, stdout, MEM_PROFILE_FOLDED), ALLOC_FAIL);
+#else
+    assert_int_equal(mem_pool_profile_start(pool, 1), ALLOC_FAIL);
+#endif
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+#ifdef MEM_POOL_GUARD
+// in a child, with every allocation guarded: a 100-byte allocation, then fault kind;
+// returns the signal which ended the child (0 if none), and the first report line
+static int guard_fault(pool_pt pool, int kind, char *report, size_t report_size) {
+    FILE *file = tmpfile();
+    int status;
+
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fileno(file), STDERR_FILENO);
+        signal(SIGSEGV, SIG_DFL);
+        if (mem_pool_guard_enable(pool, 1, 4) != ALLOC_OK)
+            _exit(1);
+        alloc_pt alloc = mem_new_alloc(pool, 100);
+        volatile char *mem = alloc->mem;
+        switch (kind) {
+            case 0:     // onto the guard page
+                mem[112] = 1;
+                break;
+            case 1:     // use after free
+                mem_del_alloc(pool, alloc);
+                (void) mem[0];
+                break;
+            case 2:     // into the alignment, caught on deletion
+                mem[100] = 1;
+                mem_del_alloc(pool, alloc);
+                break;
+            default:    // double free, reported but not fatal
+                mem_del_alloc(pool, alloc);
+                mem_del_alloc(pool, alloc);
+                break;
+        }
+        _exit(0);
+    }
+
+    waitpid(pid, &status, 0);
+    report[0] = '\0';
+    count_lines(file, "mem_pool: ", report, report_size);
+    fclose(file);
+    return WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+}
+#endif
+
+static void test_pool_guard(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Guarded sampling:
+     *
+     * 1. With sample_every 1, allocations of up to a page come from guard slots outside the pool, until they run out.
+     * 2. Guarded allocations have ids, count under their tag, and keep the pool open; deleted slots are reused oldest first.
+     * 3. Along with the small-object layer, guarded handles are never taken for slab objects.
+     * 4. Overflows and use after free kill the process with a report (in a child).
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(1 << 16, FIRST_FIT);
+
+#ifdef MEM_POOL_GUARD
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    pool_tag_stats_t tag;
+    char report[1024];
+
+    assert_int_equal(mem_pool_guard_enable(pool, 0, 2), ALLOC_FAIL);
+    assert_int_equal(mem_pool_guard_enable(pool, 1, 0), ALLOC_FAIL);
+    assert_int_equal(mem_pool_guard_enable(pool, 1, 2), ALLOC_OK);
+    assert_int_equal(mem_pool_guard_enable(pool, 1, 2), ALLOC_CALLED_AGAIN);
+
+    // outside the pool, flush with the end of a page
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    assert_true(alloc0->mem < pool->mem || alloc0->mem >= pool->mem + pool->total_size);
+    assert_int_equal((uintptr_t) (alloc0->mem + 112) % page_size, 0);
+    memset(alloc0->mem, 1, 100);
+    assert_int_equal(pool->num_allocs, 0);
+    unsigned id0 = mem_alloc_id(pool, alloc0);
+    assert_int_equal(id0, MEM_ALLOC_ID_GUARD | 0);
+    assert_ptr_equal(mem_alloc_from_id(pool, id0), alloc0);
+
+    // too large for a slot, and out of slots
+    alloc_pt alloc1 = mem_new_alloc(pool, page_size + 1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 50);
+    alloc_pt alloc3 = mem_new_alloc(pool, 50);
+    assert_true(alloc1->mem >= pool->mem && alloc1->mem < pool->mem + pool->total_size);
+    assert_int_equal(mem_alloc_id(pool, alloc2), MEM_ALLOC_ID_GUARD | 1);
+    assert_true(alloc3->mem >= pool->mem && alloc3->mem < pool->mem + pool->total_size);
+    assert_int_equal(pool->num_allocs, 2);
+    assert_int_equal(mem_pool_tag_stats(pool, 0, &tag), ALLOC_OK);
+    assert_int_equal(tag.live_bytes, 100 + page_size + 1 + 50 + 50);
+    assert_int_equal(tag.live_count, 4);
+
+    // live guarded allocations keep the pool open
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    assert_int_equal(mem_pool_guard_disable(pool), ALLOC_NOT_FREED);
+
+    // quarantined, then reused oldest first
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_null(mem_alloc_from_id(pool, id0));
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_alloc_id(pool, mem_new_alloc(pool, 10)), MEM_ALLOC_ID_GUARD | 0);
+    assert_int_equal(mem_alloc_id(pool, mem_new_alloc(pool, 10)), MEM_ALLOC_ID_GUARD | 1);
+    assert_int_equal(mem_pool_tag_stats(pool, 0, &tag), ALLOC_OK);
+    assert_int_equal(tag.live_bytes, 20);
+
+    // a reset frees the slots
+    assert_int_equal(mem_pool_reset(pool), ALLOC_OK);
+    alloc0 = mem_new_alloc(pool, 10);
+    assert_int_equal(mem_alloc_id(pool, alloc0), MEM_ALLOC_ID_GUARD | 0);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+#ifdef MEM_POOL_STATS
+    pool_stats_t stats;
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+    assert_int_equal(stats.guarded_allocs, 5);
+    assert_int_equal(stats.guarded_frees, 3);
+#endif
+    assert_int_equal(mem_pool_guard_disable(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_guard_disable(pool), ALLOC_CALLED_AGAIN);
+
+    // small objects and guards together: the first 64 are guarded, the rest go to a slab
+    alloc_pt small[100];
+    pool_pt small_pool = mem_pool_open(1 << 16, FIRST_FIT);
+    assert_non_null(small_pool);
+    assert_int_equal(mem_pool_small_enable(small_pool), ALLOC_OK);
+    assert_int_equal(mem_pool_guard_enable(small_pool, 1, 64), ALLOC_OK);
+    for (unsigned u = 0; u < 100; ++u) {
+        small[u] = mem_new_alloc(small_pool, 24);
+        assert_non_null(small[u]);
+        unsigned id = mem_alloc_id(small_pool, small[u]);
+        assert_int_equal(id & (MEM_ALLOC_ID_GUARD | MEM_ALLOC_ID_SMALL),
+                         (u < 64) ? MEM_ALLOC_ID_GUARD : MEM_ALLOC_ID_SMALL);
+        assert_ptr_equal(mem_alloc_from_id(small_pool, id), small[u]);
+    }
+    for (unsigned u = 0; u < 100; ++u)
+        assert_int_equal(mem_del_alloc(small_pool, small[u]), ALLOC_OK);
+    assert_int_equal(small_pool->num_allocs, 1);    // the empty slab kept for reuse
+    assert_int_equal(mem_pool_guard_disable(small_pool), ALLOC_OK);
+    assert_int_equal(mem_pool_close(small_pool), ALLOC_OK);
+
+    // the faults
+    assert_int_equal(guard_fault(pool, 0, report, sizeof(report)), SIGSEGV);
+    assert_non_null(strstr(report, "heap-buffer-overflow"));
+    assert_non_null(strstr(report, "12 bytes past its end"));
+    assert_int_equal(guard_fault(pool, 1, report, sizeof(report)), SIGSEGV);
+    assert_non_null(strstr(report, "use-after-free"));
+    assert_int_equal(guard_fault(pool, 2, report, sizeof(report)), SIGABRT);
+    assert_non_null(strstr(report, "heap-buffer-overflow"));
+    assert_non_null(strstr(report, "0 bytes past its end"));
+    assert_int_equal(guard_fault(pool, 3, report, sizeof(report)), 0);
+    assert_non_null(strstr(report, "double-free"));
+#else
+    assert_int_equal(mem_pool_guard_enable(pool, 1, 2), ALLOC_FAIL);
+#endif
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_trace(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Event trace:
+     *
+     * 1. Trace a pool from open to a forced close through a tiny ring.
+     * 2. Flush part-way, so the ring wraps.
+     * 3. Read the records back from the sink.
+     */
+
+    FILE *sink = tmpfile();
+    assert_non_null(sink);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    assert_non_null(pool);
+
+    assert_int_equal(mem_pool_trace_start(pool, 3, sink), ALLOC_FAIL);
+    assert_int_equal(mem_pool_trace_start(pool, 4, sink), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_ptr_equal(mem_alloc_from_id(pool, mem_alloc_id(pool, alloc1)), alloc1);
+    assert_int_equal(mem_pool_trace_flush(pool), ALLOC_OK);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_null(mem_alloc_from_id(pool, mem_alloc_id(pool, alloc0)));
+    assert_null(mem_new_alloc(pool, POOL_SIZE));
+    assert_int_equal(mem_pool_close_force(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+
+    pool_trace_record_t records[8];
+    rewind(sink);
+    assert_int_equal(fread(records, sizeof(pool_trace_record_t), 8, sink), 6);
+    fclose(sink);
+
+    assert_int_equal(records[0].op, MEM_TRACE_OPEN);
+    assert_int_equal(records[0].size, POOL_SIZE);
+    assert_int_equal(records[0].handle, FIRST_FIT);
+
+    assert_int_equal(records[1].op, MEM_TRACE_ALLOC);
+    assert_int_equal(records[1].size, 100);
+    assert_int_equal(records[1].result, ALLOC_OK);
+    assert_int_equal(records[2].op, MEM_TRACE_ALLOC);
+    assert_int_equal(records[2].size, 200);
+
+    assert_int_equal(records[3].op, MEM_TRACE_DEL);
+    assert_int_equal(records[3].size, 100);
+    assert_int_equal(records[3].handle, records[1].handle);
+    assert_int_equal(records[3].result, ALLOC_OK);
+
+    assert_int_equal(records[4].op, MEM_TRACE_ALLOC);
+    assert_int_equal(records[4].handle, MEM_TRACE_NO_HANDLE);
+    assert_int_equal(records[4].result, ALLOC_FAIL);
+
+    assert_int_equal(records[5].op, MEM_TRACE_CLOSE);
+    assert_int_equal(records[5].size, 1);
+
+    for (unsigned u = 1; u < 6; ++u) {
+        assert_true(records[u].timestamp >= records[u - 1].timestamp);
+    }
+}
+
+static void test_pool_close_force(void **state) {
+    (void) state; /* unused */
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+
+    for (unsigned u = 0; u < 50; ++u) {
+        assert_non_null(mem_new_alloc(pool, 1000));
+    }
+
+    INFO("Trying to close pool...");
+    status = mem_pool_close(pool);
+    assert_int_equal(status, ALLOC_NOT_FREED);
+    INFO(" failed.\n");
+
+    INFO("Force-closing pool\n");
+    status = mem_pool_close_force(pool);
+    assert_int_equal(status, ALLOC_OK);
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
+
+/*******************************************/
+/***          6. STRESS TEST             ***/
 /***                                     ***/
 /***         [non-functional]            ***/
 /***         [see NOTE below]            ***/
@@ -2408,12 +3915,14 @@ void test_pool_stresstest(void **state) {
 
 
 /*******************************************/
-/***         6. DRIVER ROUTINE           ***/
+/***         7. DRIVER ROUTINE           ***/
 /*******************************************/
 
 int run_test_suite() {
     const struct CMUnitTest tests[] = {
             cmocka_unit_test(test_pool_store_smoketest),
+            cmocka_unit_test(test_pool_store_growth),
+            cmocka_unit_test(test_pool_gap_ix_growth),
             cmocka_unit_test(test_pool_smoketest),
 
             cmocka_unit_test(test_pool_nonempty),
@@ -2443,6 +3952,25 @@ int run_test_suite() {
             cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
 
+            cmocka_unit_test_setup_teardown(test_pool_reset, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_cursor, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_frag_stats, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_stats, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_latency, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_compact, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test(test_pool_close_force),
+            cmocka_unit_test(test_pool_trace),
+            cmocka_unit_test(test_pool_small),
+            cmocka_unit_test(test_pool_bitmap),
+            cmocka_unit_test(test_pool_policy),
+            cmocka_unit_test(test_pool_snapshot),
+            cmocka_unit_test(test_pool_shrink),
+            cmocka_unit_test(test_pool_open_ex),
+            cmocka_unit_test(test_pool_subpool),
+            cmocka_unit_test(test_pool_tags),
+            cmocka_unit_test(test_pool_profile),
+            cmocka_unit_test(test_pool_guard),
+
             // do not uncomment until the project is changed to return the allocation address
 //            cmocka_unit_test(test_pool_stresstest),
     };
@@ -0,0 +1,444 @@
+//
+// Tests for the C++17 headers, mem_pool_resource.hpp and mem_pool_object.hpp.
+// Each test reports like the cmocka suite, and the exit status is the number failed.
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mem_pool.h"
+#include "mem_pool_object.hpp"
+#include "mem_pool_resource.hpp"
+
+// not assert(), which the default RelWithDebInfo build compiles away
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            ++failures; \
+        } \
+    } while (0)
+
+namespace {
+
+int failures;   // in the test running
+
+/*******************************************/
+/***          1. POOL RESOURCE           ***/
+/*******************************************/
+
+// pmr containers on a pool, with and without the small-object layer, give every block back
+void test_resource_containers() {
+    for (int small = 0; small < 2; ++small) {
+        pool_pt pool = mem_pool_open(1 << 22, BEST_FIT);
+        CHECK(pool != nullptr);
+        if (small)
+            CHECK(mem_pool_small_enable(pool) == ALLOC_OK);
+        mem_pool::pool_resource resource(pool);
+
+        {
+            std::pmr::vector<int> v(&resource);
+            for (int i = 0; i < 10000; ++i)
+                v.push_back(i);
+            std::pmr::map<int, std::pmr::string> m(&resource);
+            for (int i = 0; i < 1000; ++i)
+                m.emplace(i, std::pmr::string(100, 'x'));
+
+            CHECK(v[9999] == 9999);
+            CHECK(m.size() == 1000 && m.at(999).size() == 100 && m.at(999)[99] == 'x');
+            // the strings in the map are on the pool too
+            CHECK(m.at(0).get_allocator().resource() == &resource);
+            CHECK(pool->num_allocs > 0);
+        }
+
+        // closing fails if anything is left
+        CHECK(mem_pool_close(pool) == ALLOC_OK);
+    }
+}
+
+// any power-of-two alignment, with the id in front of the pointer whatever its alignment
+void test_resource_alignment() {
+    struct alignas(64) wide {
+        char c[64];
+    };
+
+    pool_pt pool = mem_pool_open(1 << 20, FIRST_FIT);
+    CHECK(pool != nullptr);
+    mem_pool::pool_resource resource(pool);
+
+    for (std::size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+        void *ptr = resource.allocate(100, alignment);
+        CHECK(reinterpret_cast<std::uintptr_t>(ptr) % alignment == 0);
+        std::memset(ptr, 0xAB, 100);
+        resource.deallocate(ptr, 100, alignment);
+    }
+
+    {
+        std::pmr::vector<wide> w(&resource);
+        for (int i = 0; i < 100; ++i) {
+            w.emplace_back();
+            CHECK(reinterpret_cast<std::uintptr_t>(&w.back()) % alignof(wide) == 0);
+        }
+    }
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// resources are equal if they share a pool, and a block can go back through either
+void test_resource_equal() {
+    pool_pt pool = mem_pool_open(1 << 16, FIRST_FIT);
+    pool_pt other_pool = mem_pool_open(1 << 16, FIRST_FIT);
+    CHECK(pool != nullptr && other_pool != nullptr);
+    mem_pool::pool_resource a(pool), b(pool), c(other_pool);
+
+    CHECK(a == b && a.is_equal(b) && b.is_equal(a));
+    CHECK(a != c && !a.is_equal(c));
+    CHECK(!a.is_equal(*std::pmr::new_delete_resource()));
+    CHECK(!std::pmr::new_delete_resource()->is_equal(a));
+
+    void *ptr = a.allocate(64);
+    CHECK(pool->num_allocs == 1);
+    b.deallocate(ptr, 64);
+    CHECK(pool->num_allocs == 0);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+    CHECK(mem_pool_close(other_pool) == ALLOC_OK);
+}
+
+// a request the pool cannot serve throws, and leaves the pool as it was
+void test_resource_bad_alloc() {
+    pool_pt pool = mem_pool_open(1 << 16, FIRST_FIT);
+    CHECK(pool != nullptr);
+    mem_pool::pool_resource resource(pool);
+
+    bool threw = false;
+    try {
+        void *ptr = resource.allocate(1 << 17);
+        resource.deallocate(ptr, 1 << 17);
+    } catch (const std::bad_alloc &) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    threw = false;
+    try {
+        std::pmr::vector<char> v(1 << 17, 'x', &resource);
+    } catch (const std::bad_alloc &) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(pool->num_allocs == 0);
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// compaction leaves the blocks under a container where they are
+void test_resource_pinned() {
+    pool_pt pool = mem_pool_open(1 << 16, FIRST_FIT);
+    CHECK(pool != nullptr);
+    mem_pool::pool_resource resource(pool);
+
+    alloc_pt before = mem_new_alloc(pool, 1000);
+    CHECK(before != nullptr);
+    {
+        std::pmr::vector<int> v(100, 7, &resource);
+        const int *data = v.data();
+        CHECK(reinterpret_cast<const char *>(data) > before->mem);
+
+        CHECK(mem_del_alloc(pool, before) == ALLOC_OK);
+        CHECK(mem_pool_compact(pool, nullptr, nullptr, 0) == ALLOC_OK);
+
+        // the gap in front is still there, and filling it leaves the vector alone
+        alloc_pt after = mem_new_alloc(pool, 1000);
+        CHECK(after != nullptr && after->mem == pool->mem);
+        std::memset(after->mem, 0, 1000);
+        CHECK(v.data() == data && v[0] == 7 && v[99] == 7);
+        CHECK(mem_del_alloc(pool, after) == ALLOC_OK);
+    }
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+/*******************************************/
+/***           2. OBJECT POOL            ***/
+/*******************************************/
+
+struct point {
+    point(int x, int y) : x(x), y(y) {}
+    int x, y;
+};
+
+struct alignas(64) wide_point {
+    int x;
+};
+
+struct big {
+    explicit big(char c) { std::memset(bytes, c, sizeof(bytes)); }
+    char bytes[MEM_POOL_SMALL_MAX + 1];
+};
+
+struct throwing {
+    explicit throwing(bool fail) {
+        if (fail)
+            throw std::runtime_error("throwing");
+    }
+    int x = 0;
+};
+
+// make() constructs in place at T's alignment, and the handles own, move and give back their objects
+void test_object_make() {
+    pool_pt pool = mem_pool_open(1 << 16, FIRST_FIT);
+    CHECK(pool != nullptr);
+    {
+        mem_pool::object_pool<point> points(pool);
+        static_assert(mem_pool::object_pool<point>::slab_path, "point takes the slab path");
+        CHECK(points.pool() == pool);
+
+        auto p = points.make(1, 2);
+        CHECK(p && p->x == 1 && p->y == 2 && (*p).y == 2);
+
+        // moving hands the object over
+        point *object = p.get();
+        auto q = std::move(p);
+        CHECK(!p && q.get() == object);
+
+        // a reset slot is the next one made
+        q.reset();
+        CHECK(!q);
+        auto r = points.make(3, 4);
+        CHECK(r.get() == object && r->x == 3);
+
+        // a released object is the caller's until destroyed
+        point *released = r.release();
+        CHECK(!r && released == object);
+        points.destroy(released);
+        CHECK(points.make(5, 6).get() == object);
+
+        // move assignment deletes what was there
+        auto a = points.make(7, 8);
+        auto b = points.make(9, 10);
+        point *kept = b.get();
+        a = std::move(b);
+        CHECK(a.get() == kept && !b);
+        CHECK(points.make(0, 0).get() != kept);
+
+        mem_pool::object_pool<wide_point> wide(pool);
+        for (int i = 0; i < 100; ++i) {
+            auto w = wide.make();
+            CHECK(reinterpret_cast<std::uintptr_t>(w.get()) % alignof(wide_point) == 0);
+        }
+    }
+
+    // the object_pools gave their slabs back
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// a slab is one pool allocation of slab_objects slots, made when the free list runs out
+void test_object_slabs() {
+    using pool_type = mem_pool::object_pool<point>;
+
+    pool_pt pool = mem_pool_open(1 << 20, BEST_FIT);
+    CHECK(pool != nullptr);
+    {
+        pool_type points(pool);
+        std::vector<pool_type::handle> handles;
+
+        handles.push_back(points.make(0, 0));
+        CHECK(pool->num_allocs == 1);
+        for (std::size_t i = 1; i < 2 * pool_type::slab_objects + 1; ++i)
+            handles.push_back(points.make(static_cast<int>(i), 0));
+        CHECK(pool->num_allocs == 3);
+
+        for (std::size_t i = 0; i < handles.size(); ++i)
+            CHECK(handles[i]->x == static_cast<int>(i));
+
+        // the slabs stay with the object_pool when its objects go
+        handles.clear();
+        CHECK(pool->num_allocs == 3);
+        for (std::size_t i = 0; i < 3 * pool_type::slab_objects; ++i)
+            handles.push_back(points.make(0, 0));
+        CHECK(pool->num_allocs == 3);
+    }
+
+    CHECK(pool->num_allocs == 0);
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// larger types get one pool allocation each, deleted with their handle
+void test_object_large() {
+    static_assert(!mem_pool::object_pool<big>::slab_path, "big takes the pool path");
+
+    pool_pt pool = mem_pool_open(1 << 20, BEST_FIT);
+    CHECK(pool != nullptr);
+    {
+        mem_pool::object_pool<big> bigs(pool);
+
+        auto a = bigs.make('a');
+        auto b = bigs.make('b');
+        CHECK(pool->num_allocs == 2);
+        CHECK(a->bytes[0] == 'a' && a->bytes[MEM_POOL_SMALL_MAX] == 'a');
+        CHECK(b->bytes[0] == 'b' && b->bytes[MEM_POOL_SMALL_MAX] == 'b');
+
+        a.reset();
+        CHECK(pool->num_allocs == 1);
+        bigs.destroy(b.release());
+        CHECK(pool->num_allocs == 0);
+
+        // the pool running out throws
+        bool threw = false;
+        std::vector<mem_pool::object_pool<big>::handle> handles;
+        try {
+            for (;;)
+                handles.push_back(bigs.make('c'));
+        } catch (const std::bad_alloc &) {
+            threw = true;
+        }
+        CHECK(threw && !handles.empty());
+    }
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// a constructor that throws gives its slot back, on either path
+void test_object_throws() {
+    pool_pt pool = mem_pool_open(1 << 16, FIRST_FIT);
+    CHECK(pool != nullptr);
+    {
+        mem_pool::object_pool<throwing> objects(pool);
+
+        auto kept = objects.make(false);
+        void *slot = objects.make(false).get();
+        bool threw = false;
+        try {
+            objects.make(true);
+        } catch (const std::runtime_error &) {
+            threw = true;
+        }
+        CHECK(threw);
+        CHECK(objects.make(false).get() == slot);
+
+        std::size_t allocs = pool->num_allocs;
+        struct big_throwing : big {
+            big_throwing() : big('x') { throw std::runtime_error("big_throwing"); }
+        };
+        mem_pool::object_pool<big_throwing> throwing_bigs(pool);
+        threw = false;
+        try {
+            throwing_bigs.make();
+        } catch (const std::runtime_error &) {
+            threw = true;
+        }
+        CHECK(threw && pool->num_allocs == allocs);
+    }
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+// the standard containers on a pool_allocator, which is equal to any other over the same pool
+void test_allocator_containers() {
+    pool_pt pool = mem_pool_open(1 << 22, BEST_FIT);
+    pool_pt other_pool = mem_pool_open(1 << 16, FIRST_FIT);
+    CHECK(pool != nullptr && other_pool != nullptr);
+
+    mem_pool::pool_allocator<int> ints(pool);
+    mem_pool::pool_allocator<double> doubles(ints);
+    CHECK(ints == doubles && doubles.pool() == pool);
+    CHECK(ints != mem_pool::pool_allocator<int>(other_pool));
+    {
+        std::vector<int, mem_pool::pool_allocator<int>> v(ints);
+        std::list<int, mem_pool::pool_allocator<int>> l(ints);
+        for (int i = 0; i < 10000; ++i) {
+            v.push_back(i);
+            l.push_back(i);
+        }
+        CHECK(v[9999] == 9999 && l.size() == 10000 && l.back() == 9999);
+        // the list allocates its nodes through a rebound copy, one block each
+        CHECK(pool->num_allocs > 10000);
+        l.clear();
+        CHECK(pool->num_allocs == 1);
+    }
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+
+    bool threw = false;
+    try {
+        std::vector<char, mem_pool::pool_allocator<char>> v(1 << 17, 'x',
+                                                             mem_pool::pool_allocator<char>(other_pool));
+    } catch (const std::bad_alloc &) {
+        threw = true;
+    }
+    CHECK(threw && other_pool->num_allocs == 0);
+    CHECK(mem_pool_close(other_pool) == ALLOC_OK);
+}
+
+// compaction leaves the blocks under a container where they are, as for pool_resource
+void test_allocator_pinned() {
+    pool_pt pool = mem_pool_open(1 << 16, FIRST_FIT);
+    CHECK(pool != nullptr);
+
+    alloc_pt before = mem_new_alloc(pool, 1000);
+    CHECK(before != nullptr);
+    {
+        std::vector<int, mem_pool::pool_allocator<int>> v(100, 7, mem_pool::pool_allocator<int>(pool));
+        const int *data = v.data();
+        CHECK(reinterpret_cast<const char *>(data) > before->mem);
+
+        CHECK(mem_del_alloc(pool, before) == ALLOC_OK);
+        CHECK(mem_pool_compact(pool, nullptr, nullptr, 0) == ALLOC_OK);
+
+        alloc_pt after = mem_new_alloc(pool, 1000);
+        CHECK(after != nullptr && after->mem == pool->mem);
+        std::memset(after->mem, 0, 1000);
+        CHECK(v.data() == data && v[0] == 7 && v[99] == 7);
+        CHECK(mem_del_alloc(pool, after) == ALLOC_OK);
+    }
+
+    CHECK(mem_pool_close(pool) == ALLOC_OK);
+}
+
+struct test_case {
+    const char *name;
+    void (*run)();
+};
+
+#define TEST(fn) {#fn, fn}
+
+const test_case tests[] = {
+        TEST(test_resource_containers),
+        TEST(test_resource_alignment),
+        TEST(test_resource_equal),
+        TEST(test_resource_bad_alloc),
+        TEST(test_resource_pinned),
+        TEST(test_object_make),
+        TEST(test_object_slabs),
+        TEST(test_object_large),
+        TEST(test_object_throws),
+        TEST(test_allocator_containers),
+        TEST(test_allocator_pinned),
+};
+
+} // namespace
+
+int main() {
+    int failed = 0;
+
+    for (const test_case &test : tests) {
+        failures = 0;
+        CHECK(mem_init() == ALLOC_OK);
+        test.run();
+        CHECK(mem_free() == ALLOC_OK);
+
+        std::fprintf(stderr, "%s %s\n", (failures > 0) ? "[FAILED]" : "[  OK  ]", test.name);
+        failed += (failures > 0);
+    }
+
+    std::fprintf(stderr, "%d/%zu failed\n", failed, sizeof(tests) / sizeof(tests[0]));
+    return failed;
+}